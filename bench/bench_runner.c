@@ -0,0 +1,234 @@
+/*
+Benchmark runner for the line counters.
+
+Runs each program on the same input several times, with a warm page cache
+(after one untimed run) and with a cold one (the input's cached pages are
+dropped with posix_fadvise(POSIX_FADV_DONTNEED) before every run, which
+needs no root as long as the pages are clean). For every run it appends one
+CSV row with wall time, MB/s, lines/s and the child's peak RSS as reported
+by wait4().
+
+Build:
+  gcc -std=gnu11 -O2 -o bench_runner bench/bench_runner.c
+Run:
+  ./bench_runner --input corpus.txt --runs 5 --csv bench.csv \
+      --prog "pthread=./line_counters" --prog "pthread-j4=./line_counters -j 4" \
+      --prog "c11=./line_counters_threads"
+*/
+
+#include <sys/resource.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_PROGRAMS 16
+#define MAX_PROGRAM_ARGS 32
+
+/* A program under test: "label=path arg arg", split on blanks. */
+typedef struct {
+    char* label;
+    char* argv[MAX_PROGRAM_ARGS + 2]; /* + input path + NULL */
+} program_t;
+
+typedef enum { CACHE_WARM = 1, CACHE_COLD = 2 } cache_mode_t;
+
+/* One timed execution. */
+typedef struct {
+    double seconds;
+    long max_rss_kb;
+    int status;  /* exit code, or 128 + signal */
+} run_result_t;
+
+static int parse_program(char* spec, program_t* p) {
+    char* eq = strchr(spec, '=');
+    if (!eq) return -1;
+    *eq = '\0';
+    p->label = spec;
+    size_t argc = 0;
+    for (char* tok = strtok(eq + 1, " \t"); tok; tok = strtok(NULL, " \t")) {
+        if (argc == MAX_PROGRAM_ARGS) return -1;
+        p->argv[argc++] = tok;
+    }
+    if (argc == 0) return -1;
+    p->argv[argc] = NULL; /* the input path goes here at run time */
+    p->argv[argc + 1] = NULL;
+    return 0;
+}
+
+/* Size and line count of the input, for the throughput columns. */
+static int scan_input(const char* path, unsigned long long* bytes,
+                      unsigned long long* lines) {
+    FILE* f = fopen(path, "rb");
+    if (!f) return -1;
+    static char buf[1 << 16];
+    size_t n;
+    *bytes = 0;
+    *lines = 0;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+        *bytes += n;
+        for (const char* p = buf; (p = memchr(p, '\n', (size_t)(buf + n - p)));
+             ++p) {
+            ++*lines;
+        }
+    }
+    int err = ferror(f);
+    fclose(f);
+    return err ? -1 : 0;
+}
+
+/* Ask the kernel to drop the cached pages of the input. */
+static void drop_page_cache(const char* path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return;
+    (void)posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+/* Run the program once with stdout discarded; stderr is kept for errors. */
+static int run_once(program_t* p, const char* input, run_result_t* r) {
+    size_t argc = 0;
+    while (p->argv[argc]) ++argc;
+    p->argv[argc] = (char*)input;
+
+    double start = now_seconds();
+    pid_t pid = fork();
+    if (pid < 0) {
+        p->argv[argc] = NULL;
+        return -1;
+    }
+    if (pid == 0) {
+        int devnull = open("/dev/null", O_WRONLY);
+        if (devnull >= 0) dup2(devnull, STDOUT_FILENO);
+        execv(p->argv[0], p->argv);
+        _exit(127);
+    }
+    p->argv[argc] = NULL;
+
+    int status;
+    struct rusage ru;
+    if (wait4(pid, &status, 0, &ru) < 0) return -1;
+    r->seconds = now_seconds() - start;
+    r->max_rss_kb = ru.ru_maxrss;
+    r->status = WIFEXITED(status) ? WEXITSTATUS(status)
+                                  : 128 + WTERMSIG(status);
+    return 0;
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr, "Usage: %s --input FILE --prog LABEL=CMD [--prog ...] "
+            "[options]\n"
+            "  -i, --input FILE   corpus passed as the last argument\n"
+            "  -p, --prog SPEC    LABEL=path [args], repeatable\n"
+            "  -n, --runs N       timed runs per program and cache mode "
+            "(default 5)\n"
+            "  -c, --cache MODE   warm, cold or both (default both)\n"
+            "  -o, --csv FILE     append rows to FILE (default stdout)\n",
+            prog);
+}
+
+int main(int argc, char** argv) {
+    static const struct option long_options[] = {
+        { "input", required_argument, NULL, 'i' },
+        { "prog", required_argument, NULL, 'p' },
+        { "runs", required_argument, NULL, 'n' },
+        { "cache", required_argument, NULL, 'c' },
+        { "csv", required_argument, NULL, 'o' },
+        { NULL, 0, NULL, 0 }
+    };
+    program_t programs[MAX_PROGRAMS];
+    size_t program_count = 0;
+    const char* input = NULL;
+    const char* csv_path = NULL;
+    long runs = 5;
+    int cache_modes = CACHE_WARM | CACHE_COLD;
+    int opt;
+    while ((opt = getopt_long(argc, argv, "i:p:n:c:o:", long_options,
+                              NULL)) != -1) {
+        int bad = 0;
+        switch (opt) {
+        case 'i': input = optarg; break;
+        case 'p':
+            bad = program_count == MAX_PROGRAMS
+                || parse_program(optarg, &programs[program_count++]) != 0;
+            break;
+        case 'n':
+            runs = strtol(optarg, NULL, 10);
+            bad = runs <= 0;
+            break;
+        case 'c':
+            if (strcmp(optarg, "warm") == 0) cache_modes = CACHE_WARM;
+            else if (strcmp(optarg, "cold") == 0) cache_modes = CACHE_COLD;
+            else if (strcmp(optarg, "both") == 0) {
+                cache_modes = CACHE_WARM | CACHE_COLD;
+            }
+            else bad = 1;
+            break;
+        case 'o': csv_path = optarg; break;
+        default: bad = 1; break;
+        }
+        if (bad) {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (!input || program_count == 0) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    unsigned long long bytes, lines;
+    if (scan_input(input, &bytes, &lines) != 0) {
+        fprintf(stderr, "Failed to read '%s': %s\n", input, strerror(errno));
+        return EXIT_FAILURE;
+    }
+    FILE* csv = csv_path ? fopen(csv_path, "a") : stdout;
+    if (!csv) {
+        fprintf(stderr, "Failed to open '%s': %s\n", csv_path, strerror(errno));
+        return EXIT_FAILURE;
+    }
+    // Header only for a new file (or a pipe); appended runs share it.
+    if (csv == stdout || fseek(csv, 0, SEEK_END) != 0 || ftell(csv) <= 0) {
+        fprintf(csv, "program,cache,run,bytes,lines,seconds,mb_per_s,"
+                "lines_per_s,peak_rss_kb,exit_status\n");
+    }
+
+    int failed = 0;
+    for (size_t i = 0; i < program_count; ++i) {
+        for (int mode = CACHE_WARM; mode <= CACHE_COLD; mode <<= 1) {
+            if (!(cache_modes & mode)) continue;
+            run_result_t r;
+            if (mode == CACHE_WARM) run_once(&programs[i], input, &r);
+            for (long run = 1; run <= runs; ++run) {
+                if (mode == CACHE_COLD) drop_page_cache(input);
+                if (run_once(&programs[i], input, &r) != 0) {
+                    fprintf(stderr, "Failed to run %s: %s\n",
+                            programs[i].label, strerror(errno));
+                    failed = 1;
+                    break;
+                }
+                failed |= (r.status != 0);
+                fprintf(csv, "%s,%s,%ld,%llu,%llu,%.6f,%.1f,%.0f,%ld,%d\n",
+                        programs[i].label, mode == CACHE_WARM ? "warm" : "cold",
+                        run, bytes, lines, r.seconds,
+                        (double)bytes / (1024.0 * 1024.0) / r.seconds,
+                        (double)lines / r.seconds, r.max_rss_kb, r.status);
+                fflush(csv);
+            }
+        }
+    }
+    if (csv != stdout) fclose(csv);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,226 @@
+/*
+Synthetic corpus generator for the line counter benchmarks.
+
+Writes roughly --size bytes of text made of space-separated words. Line
+lengths follow one of three distributions, letters are vowels with a given
+probability, and a given fraction of letters can be replaced with multi-byte
+UTF-8 characters. The output is deterministic for a given --seed.
+
+Build:
+  gcc -std=gnu11 -O2 -o gen_corpus bench/gen_corpus.c -lm
+Run:
+  ./gen_corpus --size 256M --lines exp:40 --vowels 0.35 --utf8 0.05 -o corpus.txt
+*/
+
+#include <errno.h>
+#include <getopt.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Line length distributions (lengths in bytes, excluding '\n'). */
+typedef enum {
+    LINES_FIXED,    /* fixed:N */
+    LINES_UNIFORM,  /* uniform:MIN:MAX */
+    LINES_EXP       /* exp:MEAN, a long tail of very long lines */
+} line_dist_t;
+
+typedef struct {
+    unsigned long long size;
+    line_dist_t dist;
+    double a;
+    double b;
+    double vowel_density;
+    double utf8_fraction;
+    uint64_t seed;
+    const char* out_path;
+} gen_options_t;
+
+/* xorshift64*: fast, good enough for test data, identical on every libc. */
+static uint64_t next_random(uint64_t* state) {
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * UINT64_C(2685821657736338717);
+}
+
+/* Uniform double in [0, 1). */
+static double next_unit(uint64_t* state) {
+    return (double)(next_random(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/* Inverse-CDF exponential sample. */
+static double exp_sample(uint64_t* state, double mean) {
+    return -mean * log(1.0 - next_unit(state)); /* 1 - u is in (0, 1] */
+}
+
+static size_t next_line_length(uint64_t* state, const gen_options_t* o) {
+    switch (o->dist) {
+    case LINES_FIXED:
+        return (size_t)o->a;
+    case LINES_UNIFORM:
+        return (size_t)(o->a + next_unit(state) * (o->b - o->a + 1.0));
+    case LINES_EXP:
+    default:
+        return (size_t)exp_sample(state, o->a);
+    }
+}
+
+/* Multi-byte characters: 2, 3 and 4 byte UTF-8 sequences. */
+static const char* const UTF8_CHARS[] = {
+    "\xc3\xa9", "\xc3\xbc", "\xd0\xb6", "\xce\xbb",      /* é ü ж λ */
+    "\xe4\xb8\xad", "\xe3\x81\x82", "\xe2\x82\xac",      /* 中 あ € */
+    "\xf0\x9f\x98\x80"                                   /* 😀 */
+};
+#define UTF8_CHAR_COUNT (sizeof(UTF8_CHARS) / sizeof(UTF8_CHARS[0]))
+
+static const char VOWELS[] = "aeiouAEIOU";
+static const char CONSONANTS[] = "bcdfghjklmnpqrstvwxyzBCDFGHJKLMNPQRSTVWXYZ";
+
+/* Append one letter to buf; returns the number of bytes written. */
+static size_t put_letter(char* buf, uint64_t* state, const gen_options_t* o) {
+    if (o->utf8_fraction > 0.0 && next_unit(state) < o->utf8_fraction) {
+        const char* c = UTF8_CHARS[next_random(state) % UTF8_CHAR_COUNT];
+        size_t n = strlen(c);
+        memcpy(buf, c, n);
+        return n;
+    }
+    if (next_unit(state) < o->vowel_density) {
+        *buf = VOWELS[next_random(state) % (sizeof(VOWELS) - 1)];
+    }
+    else {
+        *buf = CONSONANTS[next_random(state) % (sizeof(CONSONANTS) - 1)];
+    }
+    return 1;
+}
+
+/* Write one line of about `len` bytes of words plus '\n'. Lines may run a
+   few bytes over so that a multi-byte character is never split. */
+static int write_line(FILE* out, size_t len, uint64_t* state,
+                      const gen_options_t* o, unsigned long long* written) {
+    char word[64];
+    size_t line_bytes = 0;
+    while (line_bytes < len) {
+        size_t word_len = 1 + next_random(state) % 10;
+        size_t n = 0;
+        for (size_t i = 0; i < word_len && line_bytes + n < len; ++i) {
+            n += put_letter(word + n, state, o);
+        }
+        if (line_bytes + n < len) word[n++] = ' ';
+        if (fwrite(word, 1, n, out) != n) return -1;
+        line_bytes += n;
+    }
+    if (fputc('\n', out) == EOF) return -1;
+    *written += line_bytes + 1;
+    return 0;
+}
+
+/* Parse "256M"-style sizes (K, M, G are powers of 1024). */
+static int parse_size(const char* arg, unsigned long long* out) {
+    char* end;
+    errno = 0;
+    unsigned long long v = strtoull(arg, &end, 10);
+    if (end == arg || errno != 0) return -1;
+    switch (*end) {
+    case 'K': case 'k': v <<= 10; ++end; break;
+    case 'M': case 'm': v <<= 20; ++end; break;
+    case 'G': case 'g': v <<= 30; ++end; break;
+    default: break;
+    }
+    if (*end != '\0') return -1;
+    *out = v;
+    return 0;
+}
+
+static int parse_dist(const char* arg, gen_options_t* o) {
+    if (sscanf(arg, "fixed:%lf", &o->a) == 1 && o->a >= 0) {
+        o->dist = LINES_FIXED;
+        return 0;
+    }
+    if (sscanf(arg, "uniform:%lf:%lf", &o->a, &o->b) == 2
+        && o->a >= 0 && o->b >= o->a) {
+        o->dist = LINES_UNIFORM;
+        return 0;
+    }
+    if (sscanf(arg, "exp:%lf", &o->a) == 1 && o->a > 0) {
+        o->dist = LINES_EXP;
+        return 0;
+    }
+    return -1;
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr, "Usage: %s [options]\n"
+            "  -s, --size N         bytes to write, K/M/G suffixes (default 64M)\n"
+            "  -l, --lines DIST     fixed:N | uniform:MIN:MAX | exp:MEAN "
+            "(default uniform:20:60)\n"
+            "  -v, --vowels P       probability a letter is a vowel "
+            "(default 0.38)\n"
+            "  -u, --utf8 P         probability a letter is multi-byte UTF-8 "
+            "(default 0)\n"
+            "  -r, --seed N         random seed (default 1)\n"
+            "  -o, --output FILE    output file (default stdout)\n", prog);
+}
+
+int main(int argc, char** argv) {
+    static const struct option long_options[] = {
+        { "size", required_argument, NULL, 's' },
+        { "lines", required_argument, NULL, 'l' },
+        { "vowels", required_argument, NULL, 'v' },
+        { "utf8", required_argument, NULL, 'u' },
+        { "seed", required_argument, NULL, 'r' },
+        { "output", required_argument, NULL, 'o' },
+        { NULL, 0, NULL, 0 }
+    };
+    gen_options_t o = {
+        64ULL << 20, LINES_UNIFORM, 20, 60, 0.38, 0.0, 1, NULL
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "s:l:v:u:r:o:", long_options,
+                              NULL)) != -1) {
+        int bad = 0;
+        switch (opt) {
+        case 's': bad = parse_size(optarg, &o.size); break;
+        case 'l': bad = parse_dist(optarg, &o); break;
+        case 'v':
+            o.vowel_density = strtod(optarg, NULL);
+            bad = o.vowel_density < 0 || o.vowel_density > 1;
+            break;
+        case 'u':
+            o.utf8_fraction = strtod(optarg, NULL);
+            bad = o.utf8_fraction < 0 || o.utf8_fraction > 1;
+            break;
+        case 'r': o.seed = strtoull(optarg, NULL, 10); break;
+        case 'o': o.out_path = optarg; break;
+        default: bad = 1; break;
+        }
+        if (bad) {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    FILE* out = o.out_path ? fopen(o.out_path, "w") : stdout;
+    if (!out) {
+        fprintf(stderr, "Failed to open '%s': %s\n", o.out_path, strerror(errno));
+        return EXIT_FAILURE;
+    }
+    uint64_t state = o.seed ? o.seed : 1; /* xorshift must not start at 0 */
+    unsigned long long written = 0;
+    int rc = 0;
+    while (written < o.size && rc == 0) {
+        size_t len = next_line_length(&state, &o);
+        if (len > o.size - written) len = (size_t)(o.size - written);
+        rc = write_line(out, len, &state, &o, &written);
+    }
+    if (rc != 0 || ferror(out)) {
+        fprintf(stderr, "Write failed: %s\n", strerror(errno));
+        rc = -1;
+    }
+    if (out != stdout && fclose(out) != 0) rc = -1;
+    return rc == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
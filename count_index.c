@@ -0,0 +1,305 @@
+/*
+Sidecar count index for incremental recounts.
+
+Log files are append-only and get recounted every few minutes; rescanning
+50 GB to learn about the last 10 MB is wasted work. The index stores the
+counts of every 16 MB chunk together with the file's identity (device,
+inode, size, mtime) and a hash of each chunk:
+
+- same identity: the stored totals are the answer, nothing is read;
+- same inode and larger (an append): the first and last old chunks are
+  hashed to catch a rewrite, the other old chunks are trusted, and only
+  the last old chunk (if it grew) and the new ones are counted;
+- anything else (rewritten, truncated, replaced by rotation): every old
+  chunk whose boundaries survived is hashed, which is cheaper than
+  counting, and only the ones that differ are counted.
+
+Chunk boundaries are line starts, so chunk counts add up exactly: chunk i
+holds the lines that start in [i * chunk, (i + 1) * chunk).
+
+The file format is the in-memory layout (host byte order): a header, the
+chunks and a hash over both. An index from another machine or a torn file
+fails the checks and is rebuilt.
+*/
+
+#include <sys/types.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "count_index.h"
+
+#define INDEX_MAGIC "LCINDEX1"
+#define INDEX_VERSION 1
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t flags;
+    uint64_t chunk_size;
+    index_key_t key;
+    uint64_t count;
+} index_header_t;
+
+/* XXH64 (Yann Collet's xxHash), seed 0: ~10 GB/s on one core, several
+   times faster than counting a chunk. */
+#define XXH_P1 11400714785074694791ULL
+#define XXH_P2 14029467366897019727ULL
+#define XXH_P3 1609587929392839161ULL
+#define XXH_P4 9650029242287828579ULL
+#define XXH_P5 2870177450012600261ULL
+
+static uint64_t rotl64(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static uint64_t read64(const char* p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint32_t read32(const char* p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint64_t xxh_round(uint64_t acc, uint64_t input) {
+    acc += input * XXH_P2;
+    return rotl64(acc, 31) * XXH_P1;
+}
+
+static uint64_t xxh_merge(uint64_t acc, uint64_t val) {
+    acc ^= xxh_round(0, val);
+    return acc * XXH_P1 + XXH_P4;
+}
+
+uint64_t count_index_hash(const char* data, size_t len) {
+    const char* p = data;
+    const char* end = data + len;
+    uint64_t h;
+    if (len >= 32) {
+        uint64_t v1 = XXH_P1 + XXH_P2, v2 = XXH_P2, v3 = 0, v4 = -XXH_P1;
+        do {
+            v1 = xxh_round(v1, read64(p));
+            v2 = xxh_round(v2, read64(p + 8));
+            v3 = xxh_round(v3, read64(p + 16));
+            v4 = xxh_round(v4, read64(p + 24));
+            p += 32;
+        } while (end - p >= 32);
+        h = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+        h = xxh_merge(h, v1);
+        h = xxh_merge(h, v2);
+        h = xxh_merge(h, v3);
+        h = xxh_merge(h, v4);
+    }
+    else {
+        h = XXH_P5;
+    }
+    h += (uint64_t)len;
+    for (; end - p >= 8; p += 8) {
+        h ^= xxh_round(0, read64(p));
+        h = rotl64(h, 27) * XXH_P1 + XXH_P4;
+    }
+    if (end - p >= 4) {
+        h ^= (uint64_t)read32(p) * XXH_P1;
+        h = rotl64(h, 23) * XXH_P2 + XXH_P3;
+        p += 4;
+    }
+    for (; p < end; ++p) {
+        h ^= (uint64_t)(unsigned char)*p * XXH_P5;
+        h = rotl64(h, 11) * XXH_P1;
+    }
+    h ^= h >> 33;
+    h *= XXH_P2;
+    h ^= h >> 29;
+    h *= XXH_P3;
+    h ^= h >> 32;
+    return h;
+}
+
+int count_index_load(count_index_t* idx, const char* path) {
+    idx->chunks = NULL;
+    idx->count = 0;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+    off_t size = lseek(fd, 0, SEEK_END);
+    if (size < (off_t)(sizeof(index_header_t) + sizeof(uint64_t))
+        || lseek(fd, 0, SEEK_SET) != 0) {
+        close(fd);
+        errno = EINVAL; /* too short to be an index */
+        return -1;
+    }
+    size_t len = (size_t)size;
+    char* buf = malloc(len);
+    if (!buf) {
+        close(fd);
+        errno = ENOMEM;
+        return -1;
+    }
+    size_t got = 0;
+    while (got < len) {
+        ssize_t n = read(fd, buf + got, len - got);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        got += (size_t)n;
+    }
+    close(fd);
+
+    index_header_t h;
+    memcpy(&h, buf, sizeof(h));
+    size_t body = len - sizeof(uint64_t);
+    if (got != len || memcmp(h.magic, INDEX_MAGIC, sizeof(h.magic)) != 0
+        || h.version != INDEX_VERSION
+        || h.count != (body - sizeof(h)) / sizeof(index_chunk_t)
+        || sizeof(h) + h.count * sizeof(index_chunk_t) != body
+        || read64(buf + body) != count_index_hash(buf, body)) {
+        free(buf);
+        errno = EINVAL;
+        return -1;
+    }
+    idx->key = h.key;
+    idx->chunk_size = h.chunk_size;
+    idx->flags = h.flags;
+    idx->count = (size_t)h.count;
+    if (idx->count > 0) {
+        idx->chunks = malloc(idx->count * sizeof(index_chunk_t));
+        if (!idx->chunks) {
+            free(buf);
+            idx->count = 0;
+            errno = ENOMEM;
+            return -1;
+        }
+        memcpy(idx->chunks, buf + sizeof(h), idx->count * sizeof(index_chunk_t));
+    }
+    free(buf);
+    return 0;
+}
+
+int count_index_save(const count_index_t* idx, const char* path) {
+    size_t body = sizeof(index_header_t) + idx->count * sizeof(index_chunk_t);
+    char* buf = malloc(body + sizeof(uint64_t));
+    size_t tmp_len = strlen(path) + 32;
+    char* tmp = malloc(tmp_len);
+    if (!buf || !tmp) {
+        free(buf);
+        free(tmp);
+        errno = ENOMEM;
+        return -1;
+    }
+    index_header_t h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, INDEX_MAGIC, sizeof(h.magic));
+    h.version = INDEX_VERSION;
+    h.flags = idx->flags;
+    h.chunk_size = idx->chunk_size;
+    h.key = idx->key;
+    h.count = idx->count;
+    memcpy(buf, &h, sizeof(h));
+    if (idx->count > 0) {
+        memcpy(buf + sizeof(h), idx->chunks,
+               idx->count * sizeof(index_chunk_t));
+    }
+    uint64_t check = count_index_hash(buf, body);
+    memcpy(buf + body, &check, sizeof(check));
+
+    snprintf(tmp, tmp_len, "%s.%ld.tmp", path, (long)getpid());
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    int rc = -1;
+    if (fd >= 0) {
+        size_t len = body + sizeof(uint64_t);
+        size_t done = 0;
+        while (done < len) {
+            ssize_t n = write(fd, buf + done, len - done);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) break;
+            done += (size_t)n;
+        }
+        int saved = errno;
+        if (close(fd) == 0 && done == len && rename(tmp, path) == 0) rc = 0;
+        else saved = errno;
+        if (rc != 0) {
+            unlink(tmp);
+            errno = saved;
+        }
+    }
+    free(tmp);
+    free(buf);
+    return rc;
+}
+
+void count_index_free(count_index_t* idx) {
+    free(idx->chunks);
+    idx->chunks = NULL;
+    idx->count = 0;
+}
+
+/* The first line start at or after pos. */
+static size_t line_start(const char* data, size_t size, size_t pos) {
+    if (pos >= size) return size;
+    if (pos == 0 || data[pos - 1] == '\n') return pos;
+    const char* nl = memchr(data + pos, '\n', size - pos);
+    return nl ? (size_t)(nl - data) + 1 : size;
+}
+
+int count_index_layout(count_index_t* idx, const char* data, size_t size,
+                       size_t chunkSize) {
+    idx->chunk_size = chunkSize;
+    idx->count = (size + chunkSize - 1) / chunkSize;
+    idx->chunks = NULL;
+    if (idx->count == 0) return 0;
+    idx->chunks = calloc(idx->count, sizeof(index_chunk_t));
+    if (!idx->chunks) {
+        idx->count = 0;
+        return -1;
+    }
+    size_t begin = 0;
+    for (size_t i = 0; i < idx->count; ++i) {
+        size_t end = (i + 1 == idx->count)
+            ? size : line_start(data, size, (i + 1) * chunkSize);
+        idx->chunks[i].begin = begin;
+        idx->chunks[i].end = end;
+        begin = end;
+    }
+    return 0;
+}
+
+static int same_bytes(const index_chunk_t* c, const char* data) {
+    return count_index_hash(data + c->begin, c->end - c->begin) == c->hash;
+}
+
+int count_index_appended(const count_index_t* old, const index_key_t* key,
+                         const char* data) {
+    if (old->key.dev != key->dev || old->key.ino != key->ino
+        || key->size <= old->key.size) {
+        return 0;
+    }
+    if (old->count == 0) return 1;
+    return same_bytes(&old->chunks[0], data)
+        && same_bytes(&old->chunks[old->count - 1], data);
+}
+
+size_t count_index_reuse(count_index_t* fresh, const count_index_t* old,
+                         const char* data, int appended,
+                         unsigned char* reused) {
+    size_t n = 0;
+    memset(reused, 0, fresh->count);
+    if (old->chunk_size != fresh->chunk_size || old->flags != fresh->flags) {
+        return 0;
+    }
+    size_t common = old->count < fresh->count ? old->count : fresh->count;
+    for (size_t i = 0; i < common; ++i) {
+        const index_chunk_t* o = &old->chunks[i];
+        index_chunk_t* c = &fresh->chunks[i];
+        if (o->begin != c->begin || o->end != c->end) continue;
+        if (!appended && !same_bytes(o, data)) continue;
+        c->hash = o->hash;
+        c->counts = o->counts;
+        reused[i] = 1;
+        ++n;
+    }
+    return n;
+}
@@ -0,0 +1,76 @@
+#ifndef COUNT_INDEX_H
+#define COUNT_INDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "count_kernels.h"
+
+/* Counts of the lines that start in one fixed-size chunk of a file, i.e.
+   of the bytes [begin, end) where both ends are line starts (or the end of
+   the file), and a hash of those bytes. Such counts add up exactly. */
+typedef struct {
+    uint64_t begin;
+    uint64_t end;
+    uint64_t hash;
+    counts_t counts;
+} index_chunk_t;
+
+/* The file an index describes, as fstat() saw it. */
+typedef struct {
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t size;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+} index_key_t;
+
+#define COUNT_INDEX_UTF8 1u  /* counts are from the UTF-8 kernels */
+
+/* Per-chunk counts of a file, stored next to it so that a later run only
+   counts the chunks that changed or were appended. */
+typedef struct {
+    index_key_t key;
+    uint64_t chunk_size;
+    uint32_t flags;
+    index_chunk_t* chunks;
+    size_t count;
+} count_index_t;
+
+/* 16 MB chunks: a 50 GB file needs 3200 entries (150 KB of index), and
+   an appended tail is recounted in at most a few milliseconds. */
+#define COUNT_INDEX_DEFAULT_CHUNK (16 * 1024 * 1024)
+
+/* Read an index written by count_index_save(). Returns 0, or -1 if it is
+   missing, unreadable, truncated or fails its checksum (errno is set). */
+int count_index_load(count_index_t* idx, const char* path);
+
+/* Write the index to a temporary file and rename it over `path`, so that
+   readers never see half an index. Returns 0, or -1 with errno set. */
+int count_index_save(const count_index_t* idx, const char* path);
+
+void count_index_free(count_index_t* idx);
+
+/* Lay out the chunks of data[0, size): chunk i holds the lines starting in
+   [i * chunkSize, (i + 1) * chunkSize). Sets begin and end and clears the
+   rest. Returns 0, or -1 if out of memory. */
+int count_index_layout(count_index_t* idx, const char* data, size_t size,
+                       size_t chunkSize);
+
+/* Copy the counts of the chunks of `old` that still hold the same bytes
+   into `fresh` (laid out on the current data). A chunk is reused when its
+   boundaries are unchanged and either `appended` is set (the file only
+   grew since `old`: the bytes before the old end are trusted) or its hash
+   matches. reused[i] is set for every chunk copied. Returns their number. */
+size_t count_index_reuse(count_index_t* fresh, const count_index_t* old,
+                         const char* data, int appended,
+                         unsigned char* reused);
+
+/* Whether the file looks like `old` plus appended bytes: same inode,
+   larger, and the first and last old chunks still hash the same. */
+int count_index_appended(const count_index_t* old, const index_key_t* key,
+                         const char* data);
+
+/* 64-bit hash of a chunk (XXH64 with seed 0). */
+uint64_t count_index_hash(const char* data, size_t len);
+
+#endif /* COUNT_INDEX_H */
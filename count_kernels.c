@@ -0,0 +1,1188 @@
+/*
+Counting kernels for the line counters.
+
+The scalar versions are the original byte-at-a-time loops and stay the
+reference. The vector versions classify 16/32/64 bytes per step with byte
+compares, turn the result into a bit mask with movemask (or an AVX-512
+mask register) and popcount it:
+  - chars:  len - popcount(byte == '\n')
+  - vowels: popcount((byte | 0x20) is one of "aeiou")
+  - words:  popcount(word_byte & ~(word_byte << 1 | carry)), i.e. the number
+            of bytes that start a run of non-whitespace; carry holds whether
+            the last byte of the previous block was inside a word.
+The fused all() kernels load each block once and produce all three masks,
+so a chunk-parallel worker reads its bytes a single time.
+The x86 variants are compiled with per-function target attributes, so the
+translation unit builds without -mavx2 and the choice is made at run time.
+
+Each implementation has a UTF-8 variant. Code points are the bytes that are
+not continuation bytes (one compare and popcount, like chars), multi-byte
+whitespace is found by comparing the block with itself loaded one and two
+bytes further on, and validation is a handful of table lookups per block
+(see UTF-8 mode below), so UTF-8 counting stays within a small factor of
+the byte kernels instead of decoding a character at a time.
+*/
+
+#include <ctype.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "count_kernels.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define COUNT_KERNELS_X86 1
+#include <immintrin.h>
+#endif
+
+/* "C" locale classification, used by the vector tails. */
+static inline int is_space_c(unsigned char c) {
+    return c == ' ' || (unsigned)(c - '\t') <= (unsigned)('\r' - '\t');
+}
+
+static inline int is_vowel_c(unsigned char c) {
+    c |= 0x20; /* ASCII lower case; no non-ASCII byte maps onto a vowel */
+    return c == 'a' || c == 'e' || c == 'i' || c == 'o' || c == 'u';
+}
+
+/* Finish a words count byte by byte; inWord carries the state of the
+   byte just before s. */
+static size_t words_tail(const char* s, size_t len, unsigned inWord) {
+    size_t words = 0;
+    for (size_t i = 0; i < len; ++i) {
+        unsigned word = !is_space_c((unsigned char)s[i]);
+        words += word & ~inWord;
+        inWord = word;
+    }
+    return words;
+}
+
+static size_t newlines_tail(const char* s, size_t len) {
+    size_t n = 0;
+    for (size_t i = 0; i < len; ++i) n += (s[i] == '\n');
+    return n;
+}
+
+static size_t vowels_tail(const char* s, size_t len) {
+    size_t v = 0;
+    for (size_t i = 0; i < len; ++i) v += is_vowel_c((unsigned char)s[i]);
+    return v;
+}
+
+/* Store the result of a fused pass; lines are the newlines plus a final
+   unterminated line. */
+static void finish_all(const char* s, size_t len, size_t words,
+                       size_t newlines, size_t vowels, counts_t* out) {
+    out->words = words;
+    out->chars = len - newlines;
+    out->vowels = vowels;
+    out->lines = newlines + (len > 0 && s[len - 1] != '\n');
+    out->invalid = 0;
+}
+
+/* ---- Scalar reference ---------------------------------------------------- */
+
+static size_t words_scalar(const char* s, size_t len) {
+    size_t words = 0;
+    int in_word = 0;
+    for (const char* end = s + len; s < end; ++s) {
+        if (!isspace((unsigned char)*s)) {
+            if (!in_word) { in_word = 1; ++words; }
+        }
+        else {
+            in_word = 0;
+        }
+    }
+    return words;
+}
+
+static size_t chars_scalar(const char* s, size_t len) {
+    size_t chars = 0;
+    for (const char* end = s + len; s < end; ++s) {
+        if (*s != '\n') ++chars; /* exclude newline from character count */
+    }
+    return chars;
+}
+
+static size_t vowels_scalar(const char* s, size_t len) {
+    size_t v = 0;
+    for (const char* end = s + len; s < end; ++s) {
+        char c = tolower((unsigned char)*s);
+        if (c == 'a' || c == 'e' || c == 'i' || c == 'o' || c == 'u') ++v;
+    }
+    return v;
+}
+
+static void all_scalar(const char* s, size_t len, counts_t* out) {
+    size_t chars = chars_scalar(s, len);
+    finish_all(s, len, words_scalar(s, len), len - chars,
+               vowels_scalar(s, len), out);
+}
+
+static const count_kernels_t kernels_scalar = {
+    "scalar", words_scalar, chars_scalar, vowels_scalar, all_scalar, NULL
+};
+
+/* ---- UTF-8 mode: scalar reference and shared tails ---------------------- */
+
+/* Length of the Unicode whitespace character starting at s, or 0. Beyond
+   the C-locale set these are U+0085, U+00A0, U+1680, U+2000..U+200A,
+   U+2028, U+2029, U+202F, U+205F and U+3000. A lead byte always starts a
+   new character in a decoder, even after an ill-formed sequence, so
+   matching the byte patterns gives the same answer as decoding. */
+static inline size_t utf8_space_len(const unsigned char* s, size_t avail) {
+    unsigned char c = s[0];
+    if (c < 0x80) return (size_t)is_space_c(c);
+    if (c == 0xC2) {
+        return (avail >= 2 && (s[1] == 0x85 || s[1] == 0xA0)) ? 2 : 0;
+    }
+    if (avail < 3 || c < 0xE1 || c > 0xE3) return 0;
+    unsigned char c1 = s[1], c2 = s[2];
+    if (c == 0xE1) return (c1 == 0x9A && c2 == 0x80) ? 3 : 0;
+    if (c == 0xE3) return (c1 == 0x80 && c2 == 0x80) ? 3 : 0;
+    if (c1 == 0x80) {
+        return ((c2 >= 0x80 && c2 <= 0x8A) || c2 == 0xA8 || c2 == 0xA9
+                || c2 == 0xAF) ? 3 : 0;
+    }
+    return (c1 == 0x81 && c2 == 0x9F) ? 3 : 0;
+}
+
+/* Words separated by Unicode whitespace. inWord carries the state of the
+   byte just before s; the first `skip` bytes are the end of a whitespace
+   character that started before s. */
+static size_t words_utf8_tail(const char* s, size_t len, unsigned inWord,
+                              size_t skip) {
+    const unsigned char* p = (const unsigned char*)s;
+    size_t words = 0;
+    size_t i = skip < len ? skip : len;
+    if (skip) inWord = 0;
+    while (i < len) {
+        size_t n = utf8_space_len(p + i, len - i);
+        if (n) {
+            inWord = 0;
+            i += n;
+        }
+        else {
+            words += !inWord;
+            inWord = 1;
+            ++i;
+        }
+    }
+    return words;
+}
+
+/* Bytes that start a character, i.e. are not 10xxxxxx. */
+static size_t leads_tail(const char* s, size_t len) {
+    size_t n = 0;
+    for (size_t i = 0; i < len; ++i) n += ((unsigned char)s[i] & 0xC0) != 0x80;
+    return n;
+}
+
+/* Count ill-formed sequences: a byte that cannot start a character, or a
+   lead byte followed by too few valid continuation bytes (Unicode table
+   3-7), counting each maximal subpart once. */
+static size_t invalid_utf8_scalar(const char* s, size_t len) {
+    const unsigned char* p = (const unsigned char*)s;
+    size_t invalid = 0;
+    size_t i = 0;
+    while (i < len) {
+        unsigned char c = p[i];
+        if (c < 0x80) {
+            ++i;
+            continue;
+        }
+        size_t need;
+        unsigned char lo = 0x80, hi = 0xBF; /* range of the next byte */
+        if (c >= 0xC2 && c <= 0xDF) need = 1;
+        else if (c == 0xE0) { need = 2; lo = 0xA0; }
+        else if (c == 0xED) { need = 2; hi = 0x9F; }  /* no surrogates */
+        else if (c >= 0xE1 && c <= 0xEF) need = 2;
+        else if (c == 0xF0) { need = 3; lo = 0x90; }
+        else if (c == 0xF4) { need = 3; hi = 0x8F; }  /* <= U+10FFFF */
+        else if (c >= 0xF1 && c <= 0xF3) need = 3;
+        else {
+            ++invalid; /* continuation byte, C0, C1 or F5..FF */
+            ++i;
+            continue;
+        }
+        size_t k = 1;
+        while (k <= need && i + k < len && p[i + k] >= lo && p[i + k] <= hi) {
+            lo = 0x80;
+            hi = 0xBF;
+            ++k;
+        }
+        invalid += (k <= need);
+        i += k;
+    }
+    return invalid;
+}
+
+/* finish_all() for the UTF-8 kernels: chars are the lead bytes that are
+   not newlines. */
+static void finish_all_utf8(const char* s, size_t len, size_t words,
+                            size_t leads, size_t newlines, size_t vowels,
+                            size_t invalid, counts_t* out) {
+    finish_all(s, len, words, newlines, vowels, out);
+    out->chars = leads - newlines;
+    out->invalid = invalid;
+}
+
+static size_t words_utf8_scalar(const char* s, size_t len) {
+    return words_utf8_tail(s, len, 0, 0);
+}
+
+static size_t chars_utf8_scalar(const char* s, size_t len) {
+    return leads_tail(s, len) - newlines_tail(s, len);
+}
+
+static void all_utf8_scalar(const char* s, size_t len, counts_t* out) {
+    finish_all_utf8(s, len, words_utf8_scalar(s, len), leads_tail(s, len),
+                    newlines_tail(s, len), vowels_scalar(s, len),
+                    invalid_utf8_scalar(s, len), out);
+}
+
+static const count_kernels_t kernels_utf8_scalar = {
+    "scalar-utf8", words_utf8_scalar, chars_utf8_scalar, vowels_scalar,
+    all_utf8_scalar, invalid_utf8_scalar
+};
+
+/* Expand the start bits of 2- and 3-byte whitespace characters in a block
+   of `width` bytes into a mask of all their bytes. Bytes that fall into the
+   next block come in and go out through *pending. */
+static inline uint64_t spread_spaces(uint64_t two, uint64_t three,
+                                     unsigned width, uint64_t* pending) {
+    uint64_t mask = two | (two << 1) | three | (three << 1) | (three << 2)
+                  | *pending;
+    *pending = (two >> (width - 1)) | (three >> (width - 1))
+             | (three >> (width - 2));
+    return width == 64 ? mask : mask & ((UINT64_C(1) << width) - 1);
+}
+
+/* Bytes of the pending mask, i.e. the skip for words_utf8_tail(). */
+static inline size_t pending_bytes(uint64_t pending) {
+    return (pending & 2) ? 2 : (size_t)(pending & 1);
+}
+
+#ifdef COUNT_KERNELS_X86
+
+/* ---- SSE2 (baseline on x86-64) ------------------------------------------- */
+
+static inline __m128i space_sse2(__m128i v) {
+    // '\t'..'\r' are contiguous: (v - '\t') <= 4 as unsigned bytes.
+    __m128i ctl = _mm_sub_epi8(v, _mm_set1_epi8('\t'));
+    __m128i is_ctl = _mm_cmpeq_epi8(_mm_min_epu8(ctl, _mm_set1_epi8(4)), ctl);
+    return _mm_or_si128(is_ctl, _mm_cmpeq_epi8(v, _mm_set1_epi8(' ')));
+}
+
+static inline __m128i vowel_sse2(__m128i v) {
+    __m128i lo = _mm_or_si128(v, _mm_set1_epi8(0x20));
+    __m128i m = _mm_cmpeq_epi8(lo, _mm_set1_epi8('a'));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(lo, _mm_set1_epi8('e')));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(lo, _mm_set1_epi8('i')));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(lo, _mm_set1_epi8('o')));
+    return _mm_or_si128(m, _mm_cmpeq_epi8(lo, _mm_set1_epi8('u')));
+}
+
+static size_t words_sse2(const char* s, size_t len) {
+    size_t words = 0;
+    unsigned carry = 0;
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(s + i));
+        unsigned word = ~(unsigned)_mm_movemask_epi8(space_sse2(v)) & 0xFFFFu;
+        words += (size_t)__builtin_popcount(word & ~((word << 1) | carry));
+        carry = word >> 15;
+    }
+    return words + words_tail(s + i, len - i, carry);
+}
+
+static size_t chars_sse2(const char* s, size_t len) {
+    const __m128i nl = _mm_set1_epi8('\n');
+    size_t newlines = 0;
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(s + i));
+        unsigned m = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v, nl));
+        newlines += (size_t)__builtin_popcount(m);
+    }
+    return len - newlines - newlines_tail(s + i, len - i);
+}
+
+static size_t vowels_sse2(const char* s, size_t len) {
+    size_t v = 0;
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i m = vowel_sse2(_mm_loadu_si128((const __m128i*)(s + i)));
+        v += (size_t)__builtin_popcount((unsigned)_mm_movemask_epi8(m));
+    }
+    return v + vowels_tail(s + i, len - i);
+}
+
+static void all_sse2(const char* s, size_t len, counts_t* out) {
+    const __m128i nl = _mm_set1_epi8('\n');
+    size_t words = 0, newlines = 0, vowels = 0;
+    unsigned carry = 0;
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(s + i));
+        unsigned word = ~(unsigned)_mm_movemask_epi8(space_sse2(v)) & 0xFFFFu;
+        words += (size_t)__builtin_popcount(word & ~((word << 1) | carry));
+        carry = word >> 15;
+        newlines += (size_t)__builtin_popcount(
+            (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v, nl)));
+        vowels += (size_t)__builtin_popcount(
+            (unsigned)_mm_movemask_epi8(vowel_sse2(v)));
+    }
+    words += words_tail(s + i, len - i, carry);
+    newlines += newlines_tail(s + i, len - i);
+    vowels += vowels_tail(s + i, len - i);
+    finish_all(s, len, words, newlines, vowels, out);
+}
+
+static const count_kernels_t kernels_sse2 = {
+    "sse2", words_sse2, chars_sse2, vowels_sse2, all_sse2, NULL
+};
+
+/* ---- AVX2 ---------------------------------------------------------------- */
+
+#define AVX2_TARGET __attribute__((target("avx2,popcnt")))
+
+AVX2_TARGET static inline __m256i space_avx2(__m256i v) {
+    __m256i ctl = _mm256_sub_epi8(v, _mm256_set1_epi8('\t'));
+    __m256i is_ctl = _mm256_cmpeq_epi8(
+        _mm256_min_epu8(ctl, _mm256_set1_epi8(4)), ctl);
+    return _mm256_or_si256(is_ctl, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')));
+}
+
+AVX2_TARGET static inline __m256i vowel_avx2(__m256i v) {
+    __m256i lo = _mm256_or_si256(v, _mm256_set1_epi8(0x20));
+    __m256i m = _mm256_cmpeq_epi8(lo, _mm256_set1_epi8('a'));
+    m = _mm256_or_si256(m, _mm256_cmpeq_epi8(lo, _mm256_set1_epi8('e')));
+    m = _mm256_or_si256(m, _mm256_cmpeq_epi8(lo, _mm256_set1_epi8('i')));
+    m = _mm256_or_si256(m, _mm256_cmpeq_epi8(lo, _mm256_set1_epi8('o')));
+    return _mm256_or_si256(m, _mm256_cmpeq_epi8(lo, _mm256_set1_epi8('u')));
+}
+
+AVX2_TARGET static size_t words_avx2(const char* s, size_t len) {
+    size_t words = 0;
+    uint32_t carry = 0;
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(s + i));
+        uint32_t word = ~(uint32_t)_mm256_movemask_epi8(space_avx2(v));
+        words += (size_t)__builtin_popcount(word & ~((word << 1) | carry));
+        carry = word >> 31;
+    }
+    return words + words_tail(s + i, len - i, carry);
+}
+
+AVX2_TARGET static size_t chars_avx2(const char* s, size_t len) {
+    const __m256i nl = _mm256_set1_epi8('\n');
+    size_t newlines = 0;
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(s + i));
+        uint32_t m = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, nl));
+        newlines += (size_t)__builtin_popcount(m);
+    }
+    return len - newlines - newlines_tail(s + i, len - i);
+}
+
+AVX2_TARGET static size_t vowels_avx2(const char* s, size_t len) {
+    size_t v = 0;
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i m = vowel_avx2(_mm256_loadu_si256((const __m256i*)(s + i)));
+        v += (size_t)__builtin_popcount((uint32_t)_mm256_movemask_epi8(m));
+    }
+    return v + vowels_tail(s + i, len - i);
+}
+
+AVX2_TARGET static void all_avx2(const char* s, size_t len, counts_t* out) {
+    const __m256i nl = _mm256_set1_epi8('\n');
+    size_t words = 0, newlines = 0, vowels = 0;
+    uint32_t carry = 0;
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(s + i));
+        uint32_t word = ~(uint32_t)_mm256_movemask_epi8(space_avx2(v));
+        words += (size_t)__builtin_popcount(word & ~((word << 1) | carry));
+        carry = word >> 31;
+        newlines += (size_t)__builtin_popcount(
+            (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, nl)));
+        vowels += (size_t)__builtin_popcount(
+            (uint32_t)_mm256_movemask_epi8(vowel_avx2(v)));
+    }
+    words += words_tail(s + i, len - i, carry);
+    newlines += newlines_tail(s + i, len - i);
+    vowels += vowels_tail(s + i, len - i);
+    finish_all(s, len, words, newlines, vowels, out);
+}
+
+static const count_kernels_t kernels_avx2 = {
+    "avx2", words_avx2, chars_avx2, vowels_avx2, all_avx2, NULL
+};
+
+/* ---- AVX-512BW ----------------------------------------------------------- */
+
+#define AVX512_TARGET __attribute__((target("avx512f,avx512bw,popcnt")))
+
+AVX512_TARGET static inline __mmask64 space_avx512(__m512i v) {
+    __mmask64 ctl = _mm512_cmple_epu8_mask(
+        _mm512_sub_epi8(v, _mm512_set1_epi8('\t')), _mm512_set1_epi8(4));
+    return ctl | _mm512_cmpeq_epi8_mask(v, _mm512_set1_epi8(' '));
+}
+
+AVX512_TARGET static inline __mmask64 vowel_avx512(__m512i v) {
+    __m512i lo = _mm512_or_si512(v, _mm512_set1_epi8(0x20));
+    return _mm512_cmpeq_epi8_mask(lo, _mm512_set1_epi8('a'))
+         | _mm512_cmpeq_epi8_mask(lo, _mm512_set1_epi8('e'))
+         | _mm512_cmpeq_epi8_mask(lo, _mm512_set1_epi8('i'))
+         | _mm512_cmpeq_epi8_mask(lo, _mm512_set1_epi8('o'))
+         | _mm512_cmpeq_epi8_mask(lo, _mm512_set1_epi8('u'));
+}
+
+AVX512_TARGET static size_t words_avx512(const char* s, size_t len) {
+    size_t words = 0;
+    uint64_t carry = 0;
+    size_t i = 0;
+    for (; i + 64 <= len; i += 64) {
+        __m512i v = _mm512_loadu_si512((const void*)(s + i));
+        uint64_t word = ~(uint64_t)space_avx512(v);
+        words += (size_t)__builtin_popcountll(word & ~((word << 1) | carry));
+        carry = word >> 63;
+    }
+    return words + words_tail(s + i, len - i, (unsigned)carry);
+}
+
+AVX512_TARGET static size_t chars_avx512(const char* s, size_t len) {
+    const __m512i nl = _mm512_set1_epi8('\n');
+    size_t newlines = 0;
+    size_t i = 0;
+    for (; i + 64 <= len; i += 64) {
+        __m512i v = _mm512_loadu_si512((const void*)(s + i));
+        newlines += (size_t)__builtin_popcountll(_mm512_cmpeq_epi8_mask(v, nl));
+    }
+    return len - newlines - newlines_tail(s + i, len - i);
+}
+
+AVX512_TARGET static size_t vowels_avx512(const char* s, size_t len) {
+    size_t v = 0;
+    size_t i = 0;
+    for (; i + 64 <= len; i += 64) {
+        __m512i lo = _mm512_loadu_si512((const void*)(s + i));
+        v += (size_t)__builtin_popcountll(vowel_avx512(lo));
+    }
+    return v + vowels_tail(s + i, len - i);
+}
+
+AVX512_TARGET static void all_avx512(const char* s, size_t len,
+                                     counts_t* out) {
+    const __m512i nl = _mm512_set1_epi8('\n');
+    size_t words = 0, newlines = 0, vowels = 0;
+    uint64_t carry = 0;
+    size_t i = 0;
+    for (; i + 64 <= len; i += 64) {
+        __m512i v = _mm512_loadu_si512((const void*)(s + i));
+        uint64_t word = ~(uint64_t)space_avx512(v);
+        words += (size_t)__builtin_popcountll(word & ~((word << 1) | carry));
+        carry = word >> 63;
+        newlines += (size_t)__builtin_popcountll(_mm512_cmpeq_epi8_mask(v, nl));
+        vowels += (size_t)__builtin_popcountll(vowel_avx512(v));
+    }
+    words += words_tail(s + i, len - i, (unsigned)carry);
+    newlines += newlines_tail(s + i, len - i);
+    vowels += vowels_tail(s + i, len - i);
+    finish_all(s, len, words, newlines, vowels, out);
+}
+
+static const count_kernels_t kernels_avx512 = {
+    "avx512", words_avx512, chars_avx512, vowels_avx512, all_avx512, NULL
+};
+
+/* ---- UTF-8 mode: vector kernels ----------------------------------------- */
+
+/* Validation follows Keiser and Lemire, "Validating UTF-8 In Less Than One
+   Instruction Per Byte" (2021): three 16-entry nibble lookups on each byte
+   and the one before it flag every 2-byte error class, and a check on the
+   bytes 2 and 3 back catches missing or extra continuation bytes of longer
+   sequences. Blocks without a high bit skip all of it. The vectors only say
+   whether a range is valid; the rare invalid range is then counted with
+   the scalar code, so the counts match it exactly. */
+#define UTF8_TOO_SHORT (1 << 0)
+#define UTF8_TOO_LONG (1 << 1)
+#define UTF8_OVERLONG_3 (1 << 2)
+#define UTF8_TOO_LARGE (1 << 3)
+#define UTF8_SURROGATE (1 << 4)
+#define UTF8_OVERLONG_2 (1 << 5)
+#define UTF8_TOO_LARGE_1000 (1 << 6)
+#define UTF8_OVERLONG_4 (1 << 6)
+#define UTF8_TWO_CONTS (1 << 7)
+#define UTF8_CARRY (UTF8_TOO_SHORT | UTF8_TOO_LONG | UTF8_TWO_CONTS)
+
+/* Indexed by the high nibble of the previous byte. */
+static const uint8_t UTF8_BYTE1_HIGH[16] = {
+    UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,
+    UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,
+    UTF8_TWO_CONTS, UTF8_TWO_CONTS, UTF8_TWO_CONTS, UTF8_TWO_CONTS,
+    UTF8_TOO_SHORT | UTF8_OVERLONG_2,
+    UTF8_TOO_SHORT,
+    UTF8_TOO_SHORT | UTF8_OVERLONG_3 | UTF8_SURROGATE,
+    UTF8_TOO_SHORT | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4
+};
+
+/* Indexed by the low nibble of the previous byte. */
+static const uint8_t UTF8_BYTE1_LOW[16] = {
+    UTF8_CARRY | UTF8_OVERLONG_3 | UTF8_OVERLONG_2 | UTF8_OVERLONG_4,
+    UTF8_CARRY | UTF8_OVERLONG_2,
+    UTF8_CARRY,
+    UTF8_CARRY,
+    UTF8_CARRY | UTF8_TOO_LARGE,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_SURROGATE,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000
+};
+
+/* Indexed by the high nibble of the current byte. */
+static const uint8_t UTF8_BYTE2_HIGH[16] = {
+    UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+    UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+    UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3
+        | UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4,
+    UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3
+        | UTF8_TOO_LARGE,
+    UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE
+        | UTF8_TOO_LARGE,
+    UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE
+        | UTF8_TOO_LARGE,
+    UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT
+};
+
+/* -- SSE2: no byte shuffle, so validation falls back to the scalar code,
+      but only for ranges that contain a non-ASCII byte at all. */
+
+/* Start bits of 2- and 3-byte whitespace characters; v1 and v2 are the
+   same block loaded 1 and 2 bytes further on. */
+static inline void spaces_sse2(__m128i v, __m128i v1, __m128i v2,
+                               uint64_t* two, uint64_t* three) {
+    __m128i e2 = _mm_cmpeq_epi8(v, _mm_set1_epi8((char)0xE2));
+    __m128i b1_80 = _mm_cmpeq_epi8(v1, _mm_set1_epi8((char)0x80));
+    __m128i b2_80 = _mm_cmpeq_epi8(v2, _mm_set1_epi8((char)0x80));
+    // U+0085, U+00A0
+    __m128i m2 = _mm_and_si128(
+        _mm_cmpeq_epi8(v, _mm_set1_epi8((char)0xC2)),
+        _mm_or_si128(_mm_cmpeq_epi8(v1, _mm_set1_epi8((char)0x85)),
+                     _mm_cmpeq_epi8(v1, _mm_set1_epi8((char)0xA0))));
+    // U+2000..U+200A, U+2028, U+2029, U+202F
+    __m128i t = _mm_sub_epi8(v2, _mm_set1_epi8((char)0x80));
+    __m128i low = _mm_cmpeq_epi8(_mm_min_epu8(t, _mm_set1_epi8(0x0A)), t);
+    low = _mm_or_si128(low, _mm_cmpeq_epi8(v2, _mm_set1_epi8((char)0xA8)));
+    low = _mm_or_si128(low, _mm_cmpeq_epi8(v2, _mm_set1_epi8((char)0xA9)));
+    low = _mm_or_si128(low, _mm_cmpeq_epi8(v2, _mm_set1_epi8((char)0xAF)));
+    __m128i m3 = _mm_and_si128(_mm_and_si128(e2, b1_80), low);
+    // U+205F
+    m3 = _mm_or_si128(m3, _mm_and_si128(_mm_and_si128(
+        e2, _mm_cmpeq_epi8(v1, _mm_set1_epi8((char)0x81))),
+        _mm_cmpeq_epi8(v2, _mm_set1_epi8((char)0x9F))));
+    // U+1680
+    m3 = _mm_or_si128(m3, _mm_and_si128(_mm_and_si128(
+        _mm_cmpeq_epi8(v, _mm_set1_epi8((char)0xE1)),
+        _mm_cmpeq_epi8(v1, _mm_set1_epi8((char)0x9A))), b2_80));
+    // U+3000
+    m3 = _mm_or_si128(m3, _mm_and_si128(_mm_and_si128(
+        _mm_cmpeq_epi8(v, _mm_set1_epi8((char)0xE3)), b1_80), b2_80));
+    *two = (uint64_t)_mm_movemask_epi8(m2);
+    *three = (uint64_t)_mm_movemask_epi8(m3);
+}
+
+/* Mask of the whitespace bytes of a block; *pending carries the bytes of a
+   multi-byte space that continue into the next block. */
+static inline unsigned space_utf8_sse2(const char* p, uint64_t* pending) {
+    __m128i v = _mm_loadu_si128((const __m128i*)p);
+    unsigned space = (unsigned)_mm_movemask_epi8(space_sse2(v));
+    if (_mm_movemask_epi8(v) == 0 && *pending == 0) return space;
+    uint64_t two, three;
+    spaces_sse2(v, _mm_loadu_si128((const __m128i*)(p + 1)),
+                _mm_loadu_si128((const __m128i*)(p + 2)), &two, &three);
+    return space | (unsigned)spread_spaces(two, three, 16, pending);
+}
+
+static size_t words_utf8_sse2(const char* s, size_t len) {
+    size_t words = 0;
+    unsigned carry = 0;
+    uint64_t pending = 0;
+    size_t i = 0;
+    for (; i + 18 <= len; i += 16) {
+        unsigned word = ~space_utf8_sse2(s + i, &pending) & 0xFFFFu;
+        words += (size_t)__builtin_popcount(word & ~((word << 1) | carry));
+        carry = word >> 15;
+    }
+    return words + words_utf8_tail(s + i, len - i, carry,
+                                   pending_bytes(pending));
+}
+
+/* Lead bytes, i.e. bytes that are not 10xxxxxx (signed < -64). */
+static inline unsigned leads_sse2(__m128i v) {
+    __m128i cont = _mm_cmplt_epi8(v, _mm_set1_epi8((char)0xC0));
+    return ~(unsigned)_mm_movemask_epi8(cont) & 0xFFFFu;
+}
+
+static size_t chars_utf8_sse2(const char* s, size_t len) {
+    const __m128i nl = _mm_set1_epi8('\n');
+    size_t chars = 0;
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(s + i));
+        unsigned m = leads_sse2(v)
+                   & ~(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v, nl));
+        chars += (size_t)__builtin_popcount(m);
+    }
+    return chars + chars_utf8_scalar(s + i, len - i);
+}
+
+static size_t invalid_utf8_sse2(const char* s, size_t len) {
+    __m128i high = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        high = _mm_or_si128(high, _mm_loadu_si128((const __m128i*)(s + i)));
+    }
+    int ascii = _mm_movemask_epi8(high) == 0;
+    for (; i < len && ascii; ++i) ascii = (unsigned char)s[i] < 0x80;
+    return ascii ? 0 : invalid_utf8_scalar(s, len);
+}
+
+static void all_utf8_sse2(const char* s, size_t len, counts_t* out) {
+    const __m128i nl = _mm_set1_epi8('\n');
+    size_t words = 0, leads = 0, newlines = 0, vowels = 0;
+    unsigned carry = 0;
+    uint64_t pending = 0;
+    __m128i high = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 18 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(s + i));
+        unsigned word = ~space_utf8_sse2(s + i, &pending) & 0xFFFFu;
+        words += (size_t)__builtin_popcount(word & ~((word << 1) | carry));
+        carry = word >> 15;
+        leads += (size_t)__builtin_popcount(leads_sse2(v));
+        newlines += (size_t)__builtin_popcount(
+            (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v, nl)));
+        vowels += (size_t)__builtin_popcount(
+            (unsigned)_mm_movemask_epi8(vowel_sse2(v)));
+        high = _mm_or_si128(high, v);
+    }
+    words += words_utf8_tail(s + i, len - i, carry, pending_bytes(pending));
+    leads += leads_tail(s + i, len - i);
+    newlines += newlines_tail(s + i, len - i);
+    vowels += vowels_tail(s + i, len - i);
+    size_t invalid = 0;
+    if (_mm_movemask_epi8(high) != 0) invalid = invalid_utf8_scalar(s, len);
+    else invalid = invalid_utf8_sse2(s + i, len - i);
+    finish_all_utf8(s, len, words, leads, newlines, vowels, invalid, out);
+}
+
+static const count_kernels_t kernels_utf8_sse2 = {
+    "sse2-utf8", words_utf8_sse2, chars_utf8_sse2, vowels_sse2,
+    all_utf8_sse2, invalid_utf8_sse2
+};
+
+/* -- AVX2 */
+
+AVX2_TARGET static inline void spaces_avx2(__m256i v, __m256i v1, __m256i v2,
+                                           uint64_t* two, uint64_t* three) {
+    __m256i e2 = _mm256_cmpeq_epi8(v, _mm256_set1_epi8((char)0xE2));
+    __m256i b1_80 = _mm256_cmpeq_epi8(v1, _mm256_set1_epi8((char)0x80));
+    __m256i b2_80 = _mm256_cmpeq_epi8(v2, _mm256_set1_epi8((char)0x80));
+    __m256i m2 = _mm256_and_si256(
+        _mm256_cmpeq_epi8(v, _mm256_set1_epi8((char)0xC2)),
+        _mm256_or_si256(_mm256_cmpeq_epi8(v1, _mm256_set1_epi8((char)0x85)),
+                        _mm256_cmpeq_epi8(v1, _mm256_set1_epi8((char)0xA0))));
+    __m256i t = _mm256_sub_epi8(v2, _mm256_set1_epi8((char)0x80));
+    __m256i low = _mm256_cmpeq_epi8(
+        _mm256_min_epu8(t, _mm256_set1_epi8(0x0A)), t);
+    low = _mm256_or_si256(low,
+        _mm256_cmpeq_epi8(v2, _mm256_set1_epi8((char)0xA8)));
+    low = _mm256_or_si256(low,
+        _mm256_cmpeq_epi8(v2, _mm256_set1_epi8((char)0xA9)));
+    low = _mm256_or_si256(low,
+        _mm256_cmpeq_epi8(v2, _mm256_set1_epi8((char)0xAF)));
+    __m256i m3 = _mm256_and_si256(_mm256_and_si256(e2, b1_80), low);
+    m3 = _mm256_or_si256(m3, _mm256_and_si256(_mm256_and_si256(
+        e2, _mm256_cmpeq_epi8(v1, _mm256_set1_epi8((char)0x81))),
+        _mm256_cmpeq_epi8(v2, _mm256_set1_epi8((char)0x9F))));
+    m3 = _mm256_or_si256(m3, _mm256_and_si256(_mm256_and_si256(
+        _mm256_cmpeq_epi8(v, _mm256_set1_epi8((char)0xE1)),
+        _mm256_cmpeq_epi8(v1, _mm256_set1_epi8((char)0x9A))), b2_80));
+    m3 = _mm256_or_si256(m3, _mm256_and_si256(_mm256_and_si256(
+        _mm256_cmpeq_epi8(v, _mm256_set1_epi8((char)0xE3)), b1_80), b2_80));
+    *two = (uint32_t)_mm256_movemask_epi8(m2);
+    *three = (uint32_t)_mm256_movemask_epi8(m3);
+}
+
+/* Word bytes of the 32-byte block at p, which must be followed by two more
+   readable bytes; bits outside `valid` are cleared. Used in three loops,
+   which is enough for gcc to stop inlining it without being told. */
+AVX2_TARGET __attribute__((always_inline))
+static inline uint32_t word_utf8_avx2(const char* p, uint32_t valid,
+                                                  uint64_t* pending) {
+    __m256i v = _mm256_loadu_si256((const __m256i*)p);
+    uint32_t space = (uint32_t)_mm256_movemask_epi8(space_avx2(v));
+    if (_mm256_movemask_epi8(v) != 0 || *pending != 0) {
+        uint64_t two, three;
+        spaces_avx2(v, _mm256_loadu_si256((const __m256i*)(p + 1)),
+                    _mm256_loadu_si256((const __m256i*)(p + 2)), &two, &three);
+        space |= (uint32_t)spread_spaces(two, three, 32, pending);
+    }
+    return ~space & valid;
+}
+
+/* Bytes [0, n) of a 32-byte block. */
+static inline uint32_t block_mask32(size_t n) {
+    return n >= 32 ? ~UINT32_C(0) : (UINT32_C(1) << n) - 1;
+}
+
+/* Short lines would otherwise be counted entirely by the scalar tails:
+   the last bytes are copied into a zeroed buffer with room for the
+   look-ahead loads and run through the vector code like a full block. */
+#define UTF8_PAD_AVX2 (2 * 32 + 32)
+
+AVX2_TARGET static inline uint32_t leads_avx2(__m256i v) {
+    __m256i cont = _mm256_cmpgt_epi8(_mm256_set1_epi8((char)0xC0), v);
+    return ~(uint32_t)_mm256_movemask_epi8(cont);
+}
+
+/* Validation state carried from block to block. */
+typedef struct {
+    __m256i prev;        /* previous block */
+    __m256i incomplete;  /* nonzero if it ended inside a sequence */
+    __m256i error;
+} utf8_check_avx2_t;
+
+/* The bytes 1, 2 or 3 positions before each byte of in. */
+#define PREV_AVX2(in, prev, n) _mm256_alignr_epi8( \
+    (in), _mm256_permute2x128_si256((prev), (in), 0x21), 16 - (n))
+
+AVX2_TARGET static inline __m256i lookup_avx2(const uint8_t* table,
+                                              __m256i nibbles) {
+    __m256i t = _mm256_broadcastsi128_si256(
+        _mm_loadu_si128((const __m128i*)table));
+    return _mm256_shuffle_epi8(t, nibbles);
+}
+
+AVX2_TARGET static inline void check_utf8_avx2(utf8_check_avx2_t* c,
+                                               __m256i in) {
+    if (_mm256_movemask_epi8(in) == 0) {
+        // ASCII: only a sequence cut off by the previous block can fail.
+        c->error = _mm256_or_si256(c->error, c->incomplete);
+        c->prev = in;
+        return;
+    }
+    const __m256i nib = _mm256_set1_epi8(0x0F);
+    __m256i prev1 = PREV_AVX2(in, c->prev, 1);
+    __m256i sc = _mm256_and_si256(_mm256_and_si256(
+        lookup_avx2(UTF8_BYTE1_HIGH,
+                    _mm256_and_si256(_mm256_srli_epi16(prev1, 4), nib)),
+        lookup_avx2(UTF8_BYTE1_LOW, _mm256_and_si256(prev1, nib))),
+        lookup_avx2(UTF8_BYTE2_HIGH,
+                    _mm256_and_si256(_mm256_srli_epi16(in, 4), nib)));
+    // After a 3- or 4-byte lead, bytes 2 and 3 must be continuations.
+    __m256i third = _mm256_subs_epu8(PREV_AVX2(in, c->prev, 2),
+                                     _mm256_set1_epi8((char)(0xE0 - 0x80)));
+    __m256i fourth = _mm256_subs_epu8(PREV_AVX2(in, c->prev, 3),
+                                      _mm256_set1_epi8((char)(0xF0 - 0x80)));
+    __m256i must23 = _mm256_and_si256(_mm256_or_si256(third, fourth),
+                                      _mm256_set1_epi8((char)0x80));
+    c->error = _mm256_or_si256(c->error, _mm256_xor_si256(must23, sc));
+    // A lead in the last three bytes that still needs more of them.
+    const __m256i max = _mm256_setr_epi8(
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        (char)(0xF0 - 1), (char)(0xE0 - 1), (char)(0xC0 - 1));
+    c->incomplete = _mm256_subs_epu8(in, max);
+    c->prev = in;
+}
+
+/* Run the last partial block through the checker, padded with zeros, and
+   report whether anything failed. */
+AVX2_TARGET static inline int check_utf8_finish_avx2(utf8_check_avx2_t* c,
+                                                     const char* s,
+                                                     size_t len) {
+    for (size_t i = 0; i < len; i += 32) {
+        char pad[32] = { 0 };
+        memcpy(pad, s + i, len - i < 32 ? len - i : 32);
+        check_utf8_avx2(c, _mm256_loadu_si256((const __m256i*)pad));
+    }
+    __m256i e = _mm256_or_si256(c->error, c->incomplete);
+    return !_mm256_testz_si256(e, e);
+}
+
+AVX2_TARGET static inline void check_utf8_init_avx2(utf8_check_avx2_t* c) {
+    c->prev = _mm256_setzero_si256();
+    c->incomplete = _mm256_setzero_si256();
+    c->error = _mm256_setzero_si256();
+}
+
+AVX2_TARGET static size_t words_utf8_avx2(const char* s, size_t len) {
+    size_t words = 0;
+    uint32_t carry = 0;
+    uint64_t pending = 0;
+    size_t i = 0;
+    for (; i + 34 <= len; i += 32) {
+        uint32_t word = word_utf8_avx2(s + i, ~UINT32_C(0), &pending);
+        words += (size_t)__builtin_popcount(word & ~((word << 1) | carry));
+        carry = word >> 31;
+    }
+    if (i == len) return words;
+    char pad[UTF8_PAD_AVX2] = { 0 };
+    memcpy(pad, s + i, len - i);
+    for (size_t j = 0; j < len - i; j += 32) {
+        uint32_t word = word_utf8_avx2(pad + j, block_mask32(len - i - j),
+                                       &pending);
+        words += (size_t)__builtin_popcount(word & ~((word << 1) | carry));
+        carry = word >> 31;
+    }
+    return words;
+}
+
+AVX2_TARGET static size_t chars_utf8_avx2(const char* s, size_t len) {
+    const __m256i nl = _mm256_set1_epi8('\n');
+    size_t chars = 0;
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(s + i));
+        uint32_t m = leads_avx2(v)
+            & ~(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, nl));
+        chars += (size_t)__builtin_popcount(m);
+    }
+    if (i == len) return chars;
+    char pad[32] = { 0 };
+    memcpy(pad, s + i, len - i);
+    __m256i v = _mm256_loadu_si256((const __m256i*)pad);
+    uint32_t m = leads_avx2(v) & block_mask32(len - i)
+        & ~(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, nl));
+    return chars + (size_t)__builtin_popcount(m);
+}
+
+AVX2_TARGET static size_t invalid_utf8_avx2(const char* s, size_t len) {
+    utf8_check_avx2_t c;
+    check_utf8_init_avx2(&c);
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        check_utf8_avx2(&c, _mm256_loadu_si256((const __m256i*)(s + i)));
+    }
+    return check_utf8_finish_avx2(&c, s + i, len - i)
+        ? invalid_utf8_scalar(s, len) : 0;
+}
+
+/* One block of all_utf8_avx2(); bits outside `valid` are padding. */
+AVX2_TARGET static inline void all_block_utf8_avx2(const char* p,
+                                                   uint32_t valid,
+                                                   uint32_t* carry,
+                                                   uint64_t* pending,
+                                                   utf8_check_avx2_t* c,
+                                                   counts_t* acc) {
+    __m256i v = _mm256_loadu_si256((const __m256i*)p);
+    uint32_t word = word_utf8_avx2(p, valid, pending);
+    acc->words += (size_t)__builtin_popcount(word & ~((word << 1) | *carry));
+    *carry = word >> 31;
+    // Padding bytes are zero: not leads of anything counted below.
+    acc->chars += (size_t)__builtin_popcount(leads_avx2(v) & valid);
+    acc->lines += (size_t)__builtin_popcount((uint32_t)_mm256_movemask_epi8(
+        _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n'))));
+    acc->vowels += (size_t)__builtin_popcount(
+        (uint32_t)_mm256_movemask_epi8(vowel_avx2(v)));
+    check_utf8_avx2(c, v);
+}
+
+AVX2_TARGET static void all_utf8_avx2(const char* s, size_t len,
+                                      counts_t* out) {
+    counts_t acc = { 0, 0, 0, 0, 0 }; /* chars: leads, lines: newlines */
+    uint32_t carry = 0;
+    uint64_t pending = 0;
+    utf8_check_avx2_t c;
+    check_utf8_init_avx2(&c);
+    size_t i = 0;
+    for (; i + 34 <= len; i += 32) {
+        all_block_utf8_avx2(s + i, ~UINT32_C(0), &carry, &pending, &c, &acc);
+    }
+    if (i < len) {
+        char pad[UTF8_PAD_AVX2] = { 0 };
+        memcpy(pad, s + i, len - i);
+        for (size_t j = 0; j < len - i; j += 32) {
+            all_block_utf8_avx2(pad + j, block_mask32(len - i - j), &carry,
+                                &pending, &c, &acc);
+        }
+    }
+    size_t invalid = check_utf8_finish_avx2(&c, s + len, 0)
+        ? invalid_utf8_scalar(s, len) : 0;
+    finish_all_utf8(s, len, acc.words, acc.chars, acc.lines, acc.vowels,
+                    invalid, out);
+}
+
+static const count_kernels_t kernels_utf8_avx2 = {
+    "avx2-utf8", words_utf8_avx2, chars_utf8_avx2, vowels_avx2,
+    all_utf8_avx2, invalid_utf8_avx2
+};
+
+/* -- AVX-512BW: masked loads handle the end of the input, so short lines
+      never drop to the scalar tails. */
+
+/* Bytes [0, n) of a 64-byte block. */
+static inline uint64_t block_mask(size_t n) {
+    return n >= 64 ? ~UINT64_C(0) : (UINT64_C(1) << n) - 1;
+}
+
+AVX512_TARGET static inline void spaces_avx512(__m512i v, __m512i v1,
+                                               __m512i v2, uint64_t* two,
+                                               uint64_t* three) {
+    __mmask64 e2 = _mm512_cmpeq_epi8_mask(v, _mm512_set1_epi8((char)0xE2));
+    __mmask64 b1_80 = _mm512_cmpeq_epi8_mask(v1, _mm512_set1_epi8((char)0x80));
+    __mmask64 b2_80 = _mm512_cmpeq_epi8_mask(v2, _mm512_set1_epi8((char)0x80));
+    *two = _mm512_cmpeq_epi8_mask(v, _mm512_set1_epi8((char)0xC2))
+         & (_mm512_cmpeq_epi8_mask(v1, _mm512_set1_epi8((char)0x85))
+            | _mm512_cmpeq_epi8_mask(v1, _mm512_set1_epi8((char)0xA0)));
+    __mmask64 low = _mm512_cmple_epu8_mask(
+        _mm512_sub_epi8(v2, _mm512_set1_epi8((char)0x80)),
+        _mm512_set1_epi8(0x0A))
+        | _mm512_cmpeq_epi8_mask(v2, _mm512_set1_epi8((char)0xA8))
+        | _mm512_cmpeq_epi8_mask(v2, _mm512_set1_epi8((char)0xA9))
+        | _mm512_cmpeq_epi8_mask(v2, _mm512_set1_epi8((char)0xAF));
+    *three = (e2 & b1_80 & low)
+        | (e2 & _mm512_cmpeq_epi8_mask(v1, _mm512_set1_epi8((char)0x81))
+              & _mm512_cmpeq_epi8_mask(v2, _mm512_set1_epi8((char)0x9F)))
+        | (_mm512_cmpeq_epi8_mask(v, _mm512_set1_epi8((char)0xE1))
+              & _mm512_cmpeq_epi8_mask(v1, _mm512_set1_epi8((char)0x9A))
+              & b2_80)
+        | (_mm512_cmpeq_epi8_mask(v, _mm512_set1_epi8((char)0xE3))
+              & b1_80 & b2_80);
+}
+
+/* Load a block and the same block 1 and 2 bytes further on. Near the end
+   of the input masked loads stop at len, so there is no scalar tail; bytes
+   past the end read as zero and *valid has a bit for each real byte. */
+AVX512_TARGET static inline void load3_avx512(const char* p, size_t avail,
+                                              __m512i* v, __m512i* v1,
+                                              __m512i* v2, uint64_t* valid) {
+    if (avail >= 66) {
+        *v = _mm512_loadu_si512((const void*)p);
+        *v1 = _mm512_loadu_si512((const void*)(p + 1));
+        *v2 = _mm512_loadu_si512((const void*)(p + 2));
+        *valid = ~UINT64_C(0);
+        return;
+    }
+    *valid = block_mask(avail);
+    *v = _mm512_maskz_loadu_epi8(*valid, p);
+    *v1 = _mm512_maskz_loadu_epi8(block_mask(avail - 1), p + 1);
+    *v2 = _mm512_maskz_loadu_epi8(block_mask(avail > 1 ? avail - 2 : 0), p + 2);
+}
+
+/* Word bytes of a block loaded by load3_avx512(). */
+AVX512_TARGET static inline uint64_t word_utf8_avx512(__m512i v, __m512i v1,
+                                                      __m512i v2,
+                                                      uint64_t valid,
+                                                      uint64_t* pending) {
+    uint64_t space = space_avx512(v);
+    if (_mm512_movepi8_mask(v) != 0 || *pending != 0) {
+        uint64_t two, three;
+        spaces_avx512(v, v1, v2, &two, &three);
+        space |= spread_spaces(two, three, 64, pending);
+    }
+    return ~space & valid;
+}
+
+AVX512_TARGET static inline uint64_t leads_avx512(__m512i v) {
+    return _mm512_cmpge_epi8_mask(v, _mm512_set1_epi8((char)0xC0));
+}
+
+typedef struct {
+    __m512i prev;
+    __m512i incomplete;
+    __m512i error;
+} utf8_check_avx512_t;
+
+/* Previous 16 bytes of each 128-bit lane: the last lane of prev, then the
+   first three of in; alignr then shifts within lanes. */
+AVX512_TARGET static inline __m512i lanes_before_avx512(__m512i in,
+                                                        __m512i prev) {
+    return _mm512_permutex2var_epi64(
+        prev, _mm512_set_epi64(13, 12, 11, 10, 9, 8, 7, 6), in);
+}
+
+AVX512_TARGET static inline __m512i lookup_avx512(const uint8_t* table,
+                                                  __m512i nibbles) {
+    __m512i t = _mm512_broadcast_i32x4(_mm_loadu_si128((const __m128i*)table));
+    return _mm512_shuffle_epi8(t, nibbles);
+}
+
+AVX512_TARGET static inline void check_utf8_avx512(utf8_check_avx512_t* c,
+                                                   __m512i in) {
+    if (_mm512_movepi8_mask(in) == 0) {
+        c->error = _mm512_or_si512(c->error, c->incomplete);
+        c->prev = in;
+        return;
+    }
+    const __m512i nib = _mm512_set1_epi8(0x0F);
+    __m512i before = lanes_before_avx512(in, c->prev);
+    __m512i prev1 = _mm512_alignr_epi8(in, before, 15);
+    __m512i sc = _mm512_and_si512(_mm512_and_si512(
+        lookup_avx512(UTF8_BYTE1_HIGH,
+                      _mm512_and_si512(_mm512_srli_epi16(prev1, 4), nib)),
+        lookup_avx512(UTF8_BYTE1_LOW, _mm512_and_si512(prev1, nib))),
+        lookup_avx512(UTF8_BYTE2_HIGH,
+                      _mm512_and_si512(_mm512_srli_epi16(in, 4), nib)));
+    __m512i third = _mm512_subs_epu8(_mm512_alignr_epi8(in, before, 14),
+                                     _mm512_set1_epi8((char)(0xE0 - 0x80)));
+    __m512i fourth = _mm512_subs_epu8(_mm512_alignr_epi8(in, before, 13),
+                                      _mm512_set1_epi8((char)(0xF0 - 0x80)));
+    __m512i must23 = _mm512_and_si512(_mm512_or_si512(third, fourth),
+                                      _mm512_set1_epi8((char)0x80));
+    c->error = _mm512_or_si512(c->error, _mm512_xor_si512(must23, sc));
+    const __m512i max = _mm512_set_epi64(
+        (long long)UINT64_C(0xBFDFEFFFFFFFFFFF), -1, -1, -1, -1, -1, -1, -1);
+    c->incomplete = _mm512_subs_epu8(in, max);
+    c->prev = in;
+}
+
+AVX512_TARGET static inline int check_utf8_failed_avx512(
+        const utf8_check_avx512_t* c) {
+    __m512i e = _mm512_or_si512(c->error, c->incomplete);
+    return _mm512_test_epi64_mask(e, e) != 0;
+}
+
+/* Check the last len <= 64 bytes and report whether anything failed. */
+AVX512_TARGET static inline int check_utf8_finish_avx512(
+        utf8_check_avx512_t* c, const char* s, size_t len) {
+    // A masked load reads nothing past the end; the rest is zero (ASCII).
+    if (len > 0) {
+        check_utf8_avx512(c, _mm512_maskz_loadu_epi8(block_mask(len), s));
+    }
+    return check_utf8_failed_avx512(c);
+}
+
+AVX512_TARGET static inline void check_utf8_init_avx512(
+        utf8_check_avx512_t* c) {
+    c->prev = _mm512_setzero_si512();
+    c->incomplete = _mm512_setzero_si512();
+    c->error = _mm512_setzero_si512();
+}
+
+AVX512_TARGET static size_t words_utf8_avx512(const char* s, size_t len) {
+    size_t words = 0;
+    uint64_t carry = 0;
+    uint64_t pending = 0;
+    for (size_t i = 0; i < len; i += 64) {
+        __m512i v, v1, v2;
+        uint64_t valid;
+        load3_avx512(s + i, len - i, &v, &v1, &v2, &valid);
+        uint64_t word = word_utf8_avx512(v, v1, v2, valid, &pending);
+        words += (size_t)__builtin_popcountll(word & ~((word << 1) | carry));
+        carry = word >> 63;
+    }
+    return words;
+}
+
+AVX512_TARGET static size_t chars_utf8_avx512(const char* s, size_t len) {
+    const __m512i nl = _mm512_set1_epi8('\n');
+    size_t chars = 0;
+    for (size_t i = 0; i < len; i += 64) {
+        uint64_t valid = block_mask(len - i);
+        __m512i v = _mm512_maskz_loadu_epi8(valid, s + i);
+        chars += (size_t)__builtin_popcountll(
+            leads_avx512(v) & ~_mm512_cmpeq_epi8_mask(v, nl) & valid);
+    }
+    return chars;
+}
+
+AVX512_TARGET static size_t invalid_utf8_avx512(const char* s, size_t len) {
+    utf8_check_avx512_t c;
+    check_utf8_init_avx512(&c);
+    size_t i = 0;
+    for (; i + 64 <= len; i += 64) {
+        check_utf8_avx512(&c, _mm512_loadu_si512((const void*)(s + i)));
+    }
+    return check_utf8_finish_avx512(&c, s + i, len - i)
+        ? invalid_utf8_scalar(s, len) : 0;
+}
+
+AVX512_TARGET static void all_utf8_avx512(const char* s, size_t len,
+                                          counts_t* out) {
+    const __m512i nl = _mm512_set1_epi8('\n');
+    size_t words = 0, leads = 0, newlines = 0, vowels = 0;
+    uint64_t carry = 0;
+    uint64_t pending = 0;
+    utf8_check_avx512_t c;
+    check_utf8_init_avx512(&c);
+    for (size_t i = 0; i < len; i += 64) {
+        __m512i v, v1, v2;
+        uint64_t valid;
+        load3_avx512(s + i, len - i, &v, &v1, &v2, &valid);
+        uint64_t word = word_utf8_avx512(v, v1, v2, valid, &pending);
+        words += (size_t)__builtin_popcountll(word & ~((word << 1) | carry));
+        carry = word >> 63;
+        // Padding bytes are zero: not leads of anything counted below.
+        leads += (size_t)__builtin_popcountll(leads_avx512(v) & valid);
+        newlines += (size_t)__builtin_popcountll(_mm512_cmpeq_epi8_mask(v, nl));
+        vowels += (size_t)__builtin_popcountll(vowel_avx512(v));
+        check_utf8_avx512(&c, v);
+    }
+    finish_all_utf8(s, len, words, leads, newlines, vowels,
+                    check_utf8_failed_avx512(&c) ? invalid_utf8_scalar(s, len)
+                                                 : 0, out);
+}
+
+static const count_kernels_t kernels_utf8_avx512 = {
+    "avx512-utf8", words_utf8_avx512, chars_utf8_avx512, vowels_avx512,
+    all_utf8_avx512, invalid_utf8_avx512
+};
+
+#endif /* COUNT_KERNELS_X86 */
+
+/* ---- Dispatch ------------------------------------------------------------ */
+
+const count_kernels_t* count_kernels_scalar(void) {
+    return &kernels_scalar;
+}
+
+size_t count_kernels_available(const count_kernels_t** out, size_t max) {
+    size_t n = 0;
+    if (n < max) out[n++] = &kernels_scalar;
+#ifdef COUNT_KERNELS_X86
+    if (n < max) out[n++] = &kernels_sse2;
+    if (n < max && __builtin_cpu_supports("avx2")) out[n++] = &kernels_avx2;
+    if (n < max && __builtin_cpu_supports("avx512bw")) {
+        out[n++] = &kernels_avx512;
+    }
+#endif
+    return n;
+}
+
+const count_kernels_t* count_kernels_best(void) {
+    const count_kernels_t* all[4];
+    size_t n = count_kernels_available(all, sizeof(all) / sizeof(all[0]));
+    return all[n - 1]; /* listed from slowest to fastest */
+}
+
+const count_kernels_t* count_kernels_utf8(const count_kernels_t* kernels) {
+#ifdef COUNT_KERNELS_X86
+    if (kernels == &kernels_sse2) return &kernels_utf8_sse2;
+    if (kernels == &kernels_avx2) return &kernels_utf8_avx2;
+    if (kernels == &kernels_avx512) return &kernels_utf8_avx512;
+#endif
+    if (kernels == &kernels_scalar) return &kernels_utf8_scalar;
+    return kernels;
+}
+
+const count_kernels_t* count_kernels_by_name(const char* name) {
+    const count_kernels_t* all[4];
+    size_t n = count_kernels_available(all, sizeof(all) / sizeof(all[0]));
+    for (size_t i = 0; i < n; ++i) {
+        if (strcmp(all[i]->name, name) == 0) return all[i];
+    }
+    return NULL;
+}
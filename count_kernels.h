@@ -0,0 +1,56 @@
+#ifndef COUNT_KERNELS_H
+#define COUNT_KERNELS_H
+
+#include <stddef.h>
+
+/* Totals of a fused pass over a range of whole lines. */
+typedef struct {
+    unsigned long long words;
+    unsigned long long chars;
+    unsigned long long vowels;
+    unsigned long long lines;
+    unsigned long long invalid;  /* ill-formed UTF-8 sequences (UTF-8 mode) */
+} counts_t;
+
+/* One implementation of the three per-line counters. All of them take a
+   (pointer, length) view and follow the "C" locale: whitespace is
+   ' ', '\t', '\n', '\v', '\f', '\r'; vowels are a, e, i, o, u in either case;
+   chars are all bytes except '\n'.
+   all() computes the three counts plus the line count in one pass; s must
+   start at the beginning of a line, and a final line without '\n' counts.
+
+   The UTF-8 variants (count_kernels_utf8()) read the input as UTF-8
+   instead: chars are code points except '\n' (bytes that are not
+   continuation bytes, so each stray continuation byte counts as nothing),
+   whitespace is the Unicode White_Space set, and invalid() counts
+   ill-formed sequences, each maximal ill-formed subpart once as in U+FFFD
+   substitution. Vowels stay the ASCII ones. */
+typedef struct {
+    const char* name;
+    size_t (*words)(const char* s, size_t len);
+    size_t (*chars)(const char* s, size_t len);
+    size_t (*vowels)(const char* s, size_t len);
+    void (*all)(const char* s, size_t len, counts_t* out);
+    size_t (*invalid)(const char* s, size_t len);  /* NULL in byte mode */
+} count_kernels_t;
+
+/* The byte-at-a-time reference implementation (uses isspace/tolower). */
+const count_kernels_t* count_kernels_scalar(void);
+
+/* The fastest implementation this CPU supports, chosen once by CPUID:
+   AVX-512BW, then AVX2, then SSE2, then scalar. */
+const count_kernels_t* count_kernels_best(void);
+
+/* Look up an implementation by name ("scalar", "sse2", "avx2", "avx512").
+   Returns NULL if the name is unknown or the CPU lacks the instructions. */
+const count_kernels_t* count_kernels_by_name(const char* name);
+
+/* The UTF-8 variant of an implementation ("avx2" -> "avx2-utf8"); a UTF-8
+   variant maps to itself. */
+const count_kernels_t* count_kernels_utf8(const count_kernels_t* kernels);
+
+/* Fill out[] with every byte-mode implementation usable on this CPU,
+   scalar first. Returns the number written (at most max). */
+size_t count_kernels_available(const count_kernels_t** out, size_t max);
+
+#endif /* COUNT_KERNELS_H */
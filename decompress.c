@@ -0,0 +1,583 @@
+/*
+Decompression stage for gzip and zstd inputs.
+
+A decoder turns a compressed fd into a byte stream that the stream reader
+(stream_reader.c) reads in place of read(): the decoded data goes straight
+into the reader's line buffers and from there to the counting workers as
+views, on the reader's thread, so decoding overlaps with counting and no
+line is ever copied on its own.
+
+A single gzip member or zstd frame can only be decoded front to back. Files
+made of many independent members can do better: bgzip writes gzip members
+of at most 64 KB that record their compressed size (the BGZF "BC" extra
+field) and their decoded size (ISIZE), and pzstd writes independent
+zstd frames whose headers record both as well. For such a regular
+file the decoder maps it, lists the members, groups them into tasks of
+about 1 MB of output and decodes the tasks on a pool of threads. A member
+that claims more than that is not split up: the whole file is streamed. The
+reader takes the results in file order, one bulk copy per buffer, and at
+most two tasks per thread are decoded ahead of it, which bounds memory.
+*/
+
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef LC_HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef LC_HAVE_ZSTD
+#include <zstd.h>
+#endif
+#include "decompress.h"
+
+/* Compressed bytes read per refill when streaming. */
+#define DECODER_INPUT (256 * 1024)
+
+/* Decoded bytes per parallel task: large enough that a task costs far
+   more than handing it over, small enough to spread over the threads.
+   Also the most a single member may claim: anything bigger is streamed,
+   so a frame header is never trusted with a larger allocation. */
+#define DECODER_TASK_OUTPUT (1024 * 1024)
+
+/* Decoded size of a BGZF member by the spec; a larger ISIZE is not BGZF. */
+#define BGZF_MAX_OUTPUT (64 * 1024)
+
+/* How long decompress_probe() waits for the first bytes of a pipe:
+   PROBE_PIPE_TRIES times PROBE_PIPE_WAIT_NS, about 100 ms. */
+#define PROBE_PIPE_TRIES 100
+#define PROBE_PIPE_WAIT_NS (1000 * 1000)
+
+/* A run of whole members decoded by one task. */
+typedef struct {
+    size_t in_off;
+    size_t in_len;
+    size_t out_len;
+} decode_task_t;
+
+/* A decoded task waiting for the reader. */
+typedef struct {
+    char* data;
+    size_t len;
+    int ready;
+    int failed;
+} decode_slot_t;
+
+struct decoder {
+    compression_t format;
+    int fd;
+
+    /* Streaming: one member or frame after the other, on the caller. */
+    unsigned char* in;
+    size_t in_len;
+    size_t in_pos;
+    int in_eof;
+    int in_member;    /* inside a member, so the input may not end here */
+#ifdef LC_HAVE_ZLIB
+    z_stream z;
+    int z_ready;
+#endif
+#ifdef LC_HAVE_ZSTD
+    ZSTD_DStream* zs;
+#endif
+
+    /* Parallel: the whole file is mapped and split into tasks. */
+    const unsigned char* map;
+    size_t map_len;
+    decode_task_t* tasks;
+    size_t task_count;
+    decode_slot_t* slots;   /* task t lives in slots[t % window] */
+    size_t window;
+    size_t next_task;       /* next task for a decoding thread */
+    size_t next_out;        /* next task for the reader */
+    size_t out_pos;         /* bytes of it already read */
+    int stop;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t* threads;
+    size_t thread_count;
+};
+
+compression_t decompress_detect(const void* head, size_t len) {
+    const unsigned char* p = head;
+    if (len >= 4 && p[0] == 0x1f && p[1] == 0x8b && p[2] == 8) {
+        return COMPRESSION_GZIP;
+    }
+    if (len >= 4 && p[0] == 0x28 && p[1] == 0xb5 && p[2] == 0x2f
+        && p[3] == 0xfd) {
+        return COMPRESSION_ZSTD;
+    }
+    return COMPRESSION_NONE;
+}
+
+/* The first bytes waiting in the pipe fd, copied with tee(2) into a pipe
+   of our own so that they stay in fd for whoever reads it. A writer that
+   has not written 4 bytes yet gets a short while to do so. */
+static compression_t probe_pipe(int fd) {
+    int copy[2];
+    if (pipe2(copy, O_CLOEXEC) != 0) return COMPRESSION_NONE;
+    unsigned char head[4];
+    ssize_t got = 0;
+    for (int tries = 0; tries < PROBE_PIPE_TRIES; ++tries) {
+        ssize_t n = tee(fd, copy[1], sizeof(head), 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break; /* not a pipe, or the end of the data */
+        // tee() does not consume, so read back what it copied this time.
+        got = read(copy[0], head, (size_t)n);
+        if (got < 0 || (size_t)got >= sizeof(head)) break;
+        nanosleep(&(struct timespec){ 0, PROBE_PIPE_WAIT_NS }, NULL);
+    }
+    close(copy[0]);
+    close(copy[1]);
+    return got > 0 ? decompress_detect(head, (size_t)got) : COMPRESSION_NONE;
+}
+
+compression_t decompress_probe(int fd) {
+    struct stat st;
+    if (fstat(fd, &st) != 0) return COMPRESSION_NONE;
+    if (S_ISFIFO(st.st_mode)) return probe_pipe(fd);
+    if (!S_ISREG(st.st_mode)) return COMPRESSION_NONE;
+    off_t at = lseek(fd, 0, SEEK_CUR);
+    unsigned char head[4];
+    if (at < 0 || pread(fd, head, sizeof(head), at) != (ssize_t)sizeof(head)) {
+        return COMPRESSION_NONE;
+    }
+    return decompress_detect(head, sizeof(head));
+}
+
+const char* decompress_name(compression_t format) {
+    switch (format) {
+    case COMPRESSION_GZIP: return "gzip";
+    case COMPRESSION_ZSTD: return "zstd";
+    default: return "none";
+    }
+}
+
+int decompress_supported(compression_t format) {
+    switch (format) {
+    case COMPRESSION_NONE: return 1;
+#ifdef LC_HAVE_ZLIB
+    case COMPRESSION_GZIP: return 1;
+#endif
+#ifdef LC_HAVE_ZSTD
+    case COMPRESSION_ZSTD: return 1;
+#endif
+    default: return 0;
+    }
+}
+
+static uint32_t le32(const unsigned char* p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16
+         | (uint32_t)p[3] << 24;
+}
+
+/* Size of the BGZF member at p, or 0 if it is not one. */
+static size_t bgzf_member(const unsigned char* p, size_t avail) {
+    if (avail < 18 || p[0] != 0x1f || p[1] != 0x8b || p[2] != 8
+        || !(p[3] & 4 /* FEXTRA */)) {
+        return 0;
+    }
+    size_t xlen = (size_t)p[10] | (size_t)p[11] << 8;
+    if (12 + xlen > avail) return 0;
+    for (size_t i = 12; i + 4 <= 12 + xlen;) {
+        size_t slen = (size_t)p[i + 2] | (size_t)p[i + 3] << 8;
+        if (p[i] == 'B' && p[i + 1] == 'C' && slen == 2 && i + 6 <= 12 + xlen) {
+            size_t size = ((size_t)p[i + 4] | (size_t)p[i + 5] << 8) + 1;
+            return size <= avail && size >= 12 + xlen + 8 ? size : 0;
+        }
+        i += 4 + slen;
+    }
+    return 0;
+}
+
+/* Size of the member at p and its decoded size, or 0 if it cannot be
+   found without decoding it. */
+static size_t member_size(compression_t format, const unsigned char* p,
+                          size_t avail, size_t* out) {
+    if (format == COMPRESSION_GZIP) {
+        size_t size = bgzf_member(p, avail);
+        if (size) *out = le32(p + size - 4);
+        return size;
+    }
+#ifdef LC_HAVE_ZSTD
+    if (format == COMPRESSION_ZSTD) {
+        size_t size = ZSTD_findFrameCompressedSize(p, avail);
+        if (ZSTD_isError(size)) return 0;
+        unsigned long long content = ZSTD_getFrameContentSize(p, avail);
+        if (content == ZSTD_CONTENTSIZE_UNKNOWN
+            || content == ZSTD_CONTENTSIZE_ERROR) {
+            return 0;
+        }
+        *out = (size_t)content;
+        return size;
+    }
+#endif
+    return 0;
+}
+
+/* Group the members of map[from, map_len) into tasks. Returns the task
+   count, 0 if some member's sizes are not recorded, some member claims
+   more output than one task holds (or out of memory). */
+static size_t plan_tasks(decoder_t* d, size_t from) {
+    size_t cap = 64;
+    d->tasks = malloc(cap * sizeof(decode_task_t));
+    if (!d->tasks) return 0;
+    size_t n = 0;
+    size_t pos = from;
+    while (pos < d->map_len) {
+        size_t out;
+        size_t size = member_size(d->format, d->map + pos, d->map_len - pos,
+                                  &out);
+        size_t limit = d->format == COMPRESSION_GZIP ? BGZF_MAX_OUTPUT
+                                                     : DECODER_TASK_OUTPUT;
+        if (size == 0 || out > limit) {
+            n = 0;
+            break;
+        }
+        if (n > 0 && d->tasks[n - 1].out_len + out <= DECODER_TASK_OUTPUT) {
+            d->tasks[n - 1].in_len += size;
+            d->tasks[n - 1].out_len += out;
+        }
+        else {
+            if (n == cap) {
+                cap *= 2;
+                decode_task_t* grown = realloc(d->tasks,
+                                               cap * sizeof(decode_task_t));
+                if (!grown) {
+                    n = 0;
+                    break;
+                }
+                d->tasks = grown;
+            }
+            d->tasks[n].in_off = pos;
+            d->tasks[n].in_len = size;
+            d->tasks[n].out_len = out;
+            ++n;
+        }
+        pos += size;
+    }
+    if (n == 0) {
+        free(d->tasks);
+        d->tasks = NULL;
+    }
+    return n;
+}
+
+/* Decode the members of one task into out, which has exactly the size
+   they record. Returns 0, or -1 if the data does not match. */
+static int decode_task(decoder_t* d, const decode_task_t* t, char* out) {
+#ifdef LC_HAVE_ZLIB
+    if (d->format == COMPRESSION_GZIP) {
+        z_stream z;
+        memset(&z, 0, sizeof(z));
+        if (inflateInit2(&z, 16 + MAX_WBITS) != Z_OK) return -1;
+        z.next_in = (unsigned char*)d->map + t->in_off;
+        z.avail_in = (uInt)t->in_len;
+        z.next_out = (unsigned char*)out;
+        z.avail_out = (uInt)t->out_len;
+        int rc = Z_OK;
+        while (z.avail_in > 0) {
+            rc = inflate(&z, Z_FINISH);
+            if (rc != Z_STREAM_END) break;
+            inflateReset(&z);
+        }
+        inflateEnd(&z);
+        return (rc == Z_STREAM_END && z.avail_out == 0) ? 0 : -1;
+    }
+#endif
+#ifdef LC_HAVE_ZSTD
+    if (d->format == COMPRESSION_ZSTD) {
+        size_t n = ZSTD_decompress(out, t->out_len, d->map + t->in_off,
+                                   t->in_len);
+        return (!ZSTD_isError(n) && n == t->out_len) ? 0 : -1;
+    }
+#endif
+    (void)d;
+    (void)t;
+    (void)out;
+    return -1;
+}
+
+static void* decode_thread(void* arg) {
+    decoder_t* d = arg;
+    pthread_mutex_lock(&d->lock);
+    while (1) {
+        while (!d->stop && d->next_task < d->task_count
+               && d->next_task >= d->next_out + d->window) {
+            pthread_cond_wait(&d->cond, &d->lock);
+        }
+        if (d->stop || d->next_task >= d->task_count) break;
+        size_t t = d->next_task++;
+        pthread_mutex_unlock(&d->lock);
+
+        const decode_task_t* task = &d->tasks[t];
+        char* out = malloc(task->out_len ? task->out_len : 1);
+        int failed = !out || decode_task(d, task, out) != 0;
+
+        pthread_mutex_lock(&d->lock);
+        decode_slot_t* slot = &d->slots[t % d->window];
+        slot->data = out;
+        slot->len = task->out_len;
+        slot->failed = failed;
+        slot->ready = 1;
+        pthread_cond_broadcast(&d->cond);
+    }
+    pthread_mutex_unlock(&d->lock);
+    return NULL;
+}
+
+/* Map the file and start the decoding threads. Returns 0, or -1 if the
+   file is not made of independent members (d is left streaming), or -1
+   with d->map set and errno ENOMEM or EAGAIN if it is but the slots or
+   the threads could not be had. */
+static int start_parallel(decoder_t* d, size_t threads) {
+    struct stat st;
+    off_t at = lseek(d->fd, 0, SEEK_CUR);
+    if (at < 0 || fstat(d->fd, &st) != 0 || !S_ISREG(st.st_mode)
+        || st.st_size <= at) {
+        return -1;
+    }
+    void* p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, d->fd, 0);
+    if (p == MAP_FAILED) return -1;
+    d->map = p;
+    d->map_len = (size_t)st.st_size;
+    (void)madvise(p, d->map_len, MADV_SEQUENTIAL);
+    d->task_count = plan_tasks(d, (size_t)at);
+    if (d->task_count < 2) {
+        // One task is streaming with extra steps.
+        free(d->tasks);
+        d->tasks = NULL;
+        munmap(p, d->map_len);
+        d->map = NULL;
+        return -1;
+    }
+
+    d->window = 2 * threads;
+    d->slots = calloc(d->window, sizeof(decode_slot_t));
+    d->threads = calloc(threads, sizeof(pthread_t));
+    if (!d->slots || !d->threads) {
+        errno = ENOMEM;
+        return -1;
+    }
+    pthread_mutex_init(&d->lock, NULL);
+    pthread_cond_init(&d->cond, NULL);
+    for (; d->thread_count < threads; ++d->thread_count) {
+        if (pthread_create(&d->threads[d->thread_count], NULL, decode_thread,
+                           d) != 0) {
+            break;
+        }
+    }
+    if (d->thread_count == 0) {
+        errno = EAGAIN;
+        return -1;
+    }
+    return 0;
+}
+
+decoder_t* decoder_open(int fd, compression_t format, size_t threads) {
+    if (format == COMPRESSION_NONE || !decompress_supported(format)) {
+        errno = ENOTSUP;
+        return NULL;
+    }
+    decoder_t* d = calloc(1, sizeof(decoder_t));
+    if (!d) return NULL;
+    d->format = format;
+    d->fd = fd;
+    if (threads > 1 && start_parallel(d, threads) == 0) return d;
+    if (d->map) {
+        // Mapped and planned, but out of memory or no thread could start.
+        int saved = errno;
+        decoder_close(d);
+        errno = saved;
+        return NULL;
+    }
+
+    d->in = malloc(DECODER_INPUT);
+    int ok = d->in != NULL;
+#ifdef LC_HAVE_ZLIB
+    if (ok && format == COMPRESSION_GZIP) {
+        ok = inflateInit2(&d->z, 16 + MAX_WBITS) == Z_OK;
+        d->z_ready = ok;
+    }
+#endif
+#ifdef LC_HAVE_ZSTD
+    if (ok && format == COMPRESSION_ZSTD) {
+        d->zs = ZSTD_createDStream();
+        ok = d->zs && !ZSTD_isError(ZSTD_initDStream(d->zs));
+    }
+#endif
+    if (!ok) {
+        decoder_close(d);
+        errno = ENOMEM;
+        return NULL;
+    }
+    return d;
+}
+
+/* Read more compressed input. Returns 0, or -1 on a read error. */
+static int refill(decoder_t* d) {
+    while (1) {
+        ssize_t n = read(d->fd, d->in, DECODER_INPUT);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) return -1;
+        d->in_len = (size_t)n;
+        d->in_pos = 0;
+        d->in_eof = (n == 0);
+        return 0;
+    }
+}
+
+static ssize_t read_streaming(decoder_t* d, char* buf, size_t len) {
+    size_t produced = 0;
+    while (produced == 0 && len > 0) {
+        if (d->in_pos == d->in_len && !d->in_eof && refill(d) != 0) {
+            return -1;
+        }
+        if (d->in_pos == d->in_len) {
+            if (d->in_member) {
+                errno = EBADMSG; /* truncated */
+                return -1;
+            }
+            return 0;
+        }
+        if (!d->in_member) {
+            // Another member follows; gzip(1) ignores anything else there.
+            compression_t next = decompress_detect(d->in + d->in_pos,
+                                                   d->in_len - d->in_pos);
+            if (d->format == COMPRESSION_GZIP && next != COMPRESSION_GZIP
+                && d->in_len - d->in_pos >= 4) {
+                d->in_pos = d->in_len;
+                d->in_eof = 1;
+                return 0;
+            }
+            d->in_member = 1;
+        }
+#ifdef LC_HAVE_ZLIB
+        if (d->format == COMPRESSION_GZIP) {
+            d->z.next_in = d->in + d->in_pos;
+            d->z.avail_in = (uInt)(d->in_len - d->in_pos);
+            d->z.next_out = (unsigned char*)buf;
+            d->z.avail_out = (uInt)(len > UINT32_MAX ? UINT32_MAX : len);
+            uInt avail = d->z.avail_out;
+            int rc = inflate(&d->z, Z_NO_FLUSH);
+            d->in_pos = d->in_len - d->z.avail_in;
+            produced = avail - d->z.avail_out;
+            if (rc == Z_STREAM_END) {
+                inflateReset(&d->z);
+                d->in_member = 0;
+            }
+            else if (rc != Z_OK && rc != Z_BUF_ERROR) {
+                errno = EBADMSG;
+                return -1;
+            }
+            continue;
+        }
+#endif
+#ifdef LC_HAVE_ZSTD
+        if (d->format == COMPRESSION_ZSTD) {
+            ZSTD_inBuffer in = { d->in, d->in_len, d->in_pos };
+            ZSTD_outBuffer out = { buf, len, 0 };
+            size_t rc = ZSTD_decompressStream(d->zs, &out, &in);
+            if (ZSTD_isError(rc)) {
+                errno = EBADMSG;
+                return -1;
+            }
+            d->in_pos = in.pos;
+            produced = out.pos;
+            if (rc == 0) d->in_member = 0; /* frame complete */
+            continue;
+        }
+#endif
+        (void)buf;
+        errno = ENOTSUP;
+        return -1;
+    }
+    return (ssize_t)produced;
+}
+
+static ssize_t read_parallel(decoder_t* d, char* buf, size_t len) {
+    pthread_mutex_lock(&d->lock);
+    decode_slot_t* slot = NULL;
+    while (d->next_out < d->task_count) {
+        slot = &d->slots[d->next_out % d->window];
+        while (!slot->ready) pthread_cond_wait(&d->cond, &d->lock);
+        if (slot->failed || slot->len > 0) break;
+        // Nothing decoded (an empty member): move on.
+        free(slot->data);
+        slot->data = NULL;
+        slot->ready = 0;
+        ++d->next_out;
+        pthread_cond_broadcast(&d->cond);
+        slot = NULL;
+    }
+    pthread_mutex_unlock(&d->lock);
+    if (!slot) return 0;
+    if (slot->failed) {
+        errno = slot->data ? EBADMSG : ENOMEM;
+        return -1;
+    }
+
+    // The slot is the reader's until it moves next_out past it.
+    size_t n = slot->len - d->out_pos;
+    if (n > len) n = len;
+    memcpy(buf, slot->data + d->out_pos, n);
+    d->out_pos += n;
+    if (d->out_pos == slot->len) {
+        pthread_mutex_lock(&d->lock);
+        free(slot->data);
+        slot->data = NULL;
+        slot->ready = 0;
+        ++d->next_out;
+        d->out_pos = 0;
+        pthread_cond_broadcast(&d->cond);
+        pthread_mutex_unlock(&d->lock);
+    }
+    return (ssize_t)n;
+}
+
+ssize_t decoder_read(decoder_t* d, char* buf, size_t len) {
+    return d->thread_count ? read_parallel(d, buf, len)
+                           : read_streaming(d, buf, len);
+}
+
+size_t decoder_threads(const decoder_t* d) {
+    return d->thread_count;
+}
+
+void decoder_close(decoder_t* d) {
+    if (!d) return;
+    if (d->thread_count) {
+        pthread_mutex_lock(&d->lock);
+        d->stop = 1;
+        pthread_cond_broadcast(&d->cond);
+        pthread_mutex_unlock(&d->lock);
+        for (size_t i = 0; i < d->thread_count; ++i) {
+            pthread_join(d->threads[i], NULL);
+        }
+        pthread_mutex_destroy(&d->lock);
+        pthread_cond_destroy(&d->cond);
+    }
+    if (d->slots) {
+        for (size_t i = 0; i < d->window; ++i) free(d->slots[i].data);
+    }
+    free(d->slots);
+    free(d->threads);
+    free(d->tasks);
+    if (d->map) munmap((void*)d->map, d->map_len);
+#ifdef LC_HAVE_ZLIB
+    if (d->z_ready) inflateEnd(&d->z);
+#endif
+#ifdef LC_HAVE_ZSTD
+    if (d->zs) ZSTD_freeDStream(d->zs);
+#endif
+    free(d->in);
+    free(d);
+}
@@ -0,0 +1,48 @@
+#ifndef DECOMPRESS_H
+#define DECOMPRESS_H
+
+#include <sys/types.h>
+#include <stddef.h>
+
+/* Compressed inputs. gzip needs zlib (LC_HAVE_ZLIB), zstd needs libzstd
+   (LC_HAVE_ZSTD); a build without them still recognizes the formats and
+   reports them as unsupported. */
+typedef enum {
+    COMPRESSION_NONE,
+    COMPRESSION_GZIP,
+    COMPRESSION_ZSTD
+} compression_t;
+
+/* Identify a format by its first bytes (at least 4 for a match). */
+compression_t decompress_detect(const void* head, size_t len);
+
+/* Identify the format of an open file without moving its offset (pread),
+   or of a pipe without consuming its data (tee). Other unseekable inputs,
+   and a pipe whose writer is slow to send the first 4 bytes, report
+   COMPRESSION_NONE. */
+compression_t decompress_probe(int fd);
+
+const char* decompress_name(compression_t format);
+
+/* Whether this build can decode the format. */
+int decompress_supported(compression_t format);
+
+typedef struct decoder decoder_t;
+
+/* Decode fd (read from its current offset). A regular file made of many
+   independent members, as written by bgzip or pzstd, is mapped and its
+   members are decoded on `threads` threads in parallel; anything else is
+   decoded on the calling thread as it is read. Returns NULL with errno set
+   (ENOTSUP for a format this build cannot decode). fd stays open. */
+decoder_t* decoder_open(int fd, compression_t format, size_t threads);
+
+/* Up to len decoded bytes, in order. Returns 0 at the end of the data, or
+   -1 with errno set (EBADMSG for corrupt or truncated input). */
+ssize_t decoder_read(decoder_t* d, char* buf, size_t len);
+
+/* Number of threads decoding in parallel, 0 if decoding on the caller's. */
+size_t decoder_threads(const decoder_t* d);
+
+void decoder_close(decoder_t* d);
+
+#endif /* DECOMPRESS_H */
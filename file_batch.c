@@ -0,0 +1,206 @@
+/*
+Input lists for the batch mode: expand the command line into regular files
+and cut them into pieces for a fixed pool of workers.
+
+Rotated log directories mix a few large files with many small ones. Handing
+out whole files in command-line order lets one large file that comes last
+keep a single worker busy while the others idle, and handing them out one
+per thread start pays process and thread startup per file. Instead every
+file is split into pieces of a few MB, the pieces are sorted largest first
+and the workers take them from that list in order: the classic longest
+processing time first heuristic, which keeps the finish times of the
+workers within one piece of each other.
+
+gzip and zstd files (decompress.h) can only be decoded front to back, so
+each is a single task. It is placed by the size of its text, estimated from
+the compressed size, which usually puts it first: a large archive starts
+right away and the plain files are counted around it.
+*/
+
+#define _GNU_SOURCE /* scandir, alphasort */
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "file_batch.h"
+
+/* Typical text to gzip/zstd size ratio, used to weigh compressed files. */
+#define COMPRESSED_RATIO 8
+
+void file_batch_init(file_batch_t* b) {
+    b->files = NULL;
+    b->count = 0;
+    b->capacity = 0;
+    b->errors = 0;
+}
+
+void file_batch_free(file_batch_t* b) {
+    for (size_t i = 0; i < b->count; ++i) free(b->files[i].path);
+    free(b->files);
+    file_batch_init(b);
+}
+
+static int push_file(file_batch_t* b, const char* path, size_t size,
+                     int error) {
+    if (b->count == b->capacity) {
+        size_t cap = b->capacity ? b->capacity * 2 : 64;
+        batch_file_t* files = realloc(b->files, cap * sizeof(batch_file_t));
+        if (!files) return -1;
+        b->files = files;
+        b->capacity = cap;
+    }
+    char* copy = strdup(path);
+    if (!copy) return -1;
+    batch_file_t* f = &b->files[b->count++];
+    f->path = copy;
+    f->size = size;
+    f->compression = COMPRESSION_NONE;
+    memset(&f->counts, 0, sizeof(f->counts));
+    f->error = error;
+    if (error) ++b->errors;
+    return 0;
+}
+
+static int has_glob_chars(const char* s) {
+    return strpbrk(s, "*?[") != NULL;
+}
+
+int file_batch_is_batch_arg(const char* arg) {
+    struct stat st;
+    if (stat(arg, &st) == 0) return S_ISDIR(st.st_mode);
+    return has_glob_chars(arg);
+}
+
+/* Add path, which stat() describes; directories are walked. `top` is set
+   for command-line arguments, which may be links to directories. */
+static int add_path(file_batch_t* b, const char* path, int top) {
+    struct stat st;
+    if (stat(path, &st) != 0) return push_file(b, path, 0, errno);
+    if (!S_ISDIR(st.st_mode)) {
+        // Pipes and devices are listed too and fail when counted, so that
+        // the user hears about them.
+        if (push_file(b, path, (size_t)st.st_size,
+                      S_ISREG(st.st_mode) ? 0 : ENODEV) != 0) {
+            return -1;
+        }
+        int fd = S_ISREG(st.st_mode) ? open(path, O_RDONLY | O_CLOEXEC) : -1;
+        if (fd >= 0) {
+            b->files[b->count - 1].compression = decompress_probe(fd);
+            close(fd);
+        }
+        return 0;
+    }
+    if (!top) {
+        // A link to a directory inside a walk may point back up the tree.
+        struct stat lst;
+        if (lstat(path, &lst) == 0 && S_ISLNK(lst.st_mode)) return 0;
+    }
+
+    struct dirent** entries;
+    int n = scandir(path, &entries, NULL, alphasort);
+    if (n < 0) return push_file(b, path, 0, errno);
+    size_t dir_len = strlen(path);
+    int rc = 0;
+    for (int i = 0; i < n; ++i) {
+        const char* name = entries[i]->d_name;
+        if (rc == 0 && strcmp(name, ".") != 0 && strcmp(name, "..") != 0) {
+            size_t len = dir_len + 1 + strlen(name) + 1;
+            char* child = malloc(len);
+            if (!child) {
+                rc = -1;
+            }
+            else {
+                int slash = dir_len > 0 && path[dir_len - 1] == '/';
+                memcpy(child, path, dir_len);
+                if (!slash) child[dir_len] = '/';
+                strcpy(child + dir_len + !slash, name);
+                rc = add_path(b, child, 0);
+                free(child);
+            }
+        }
+        free(entries[i]);
+    }
+    free(entries);
+    return rc;
+}
+
+int file_batch_add(file_batch_t* b, const char* arg) {
+    struct stat st;
+    if (stat(arg, &st) == 0 || !has_glob_chars(arg)) return add_path(b, arg, 1);
+
+    // Patterns are expanded here when the shell did not (quoted, or too
+    // many matches for an argument list).
+    glob_t g;
+    int rc = glob(arg, 0, NULL, &g);
+    if (rc == GLOB_NOSPACE) return -1;
+    if (rc != 0) return push_file(b, arg, 0, ENOENT);
+    for (size_t i = 0; i < g.gl_pathc && rc == 0; ++i) {
+        rc = add_path(b, g.gl_pathv[i], 1);
+    }
+    globfree(&g);
+    return rc;
+}
+
+static int by_length_desc(const void* a, const void* b) {
+    const batch_task_t* x = a;
+    const batch_task_t* y = b;
+    if (x->cost != y->cost) return x->cost < y->cost ? 1 : -1;
+    // Same size: keep the command line order, which qsort does not.
+    if (x->file != y->file) return x->file < y->file ? -1 : 1;
+    return x->begin < y->begin ? -1 : (x->begin > y->begin);
+}
+
+batch_task_t* file_batch_plan(const file_batch_t* b, size_t grain,
+                              size_t* count) {
+    size_t n = 0;
+    for (size_t i = 0; i < b->count; ++i) {
+        if (b->files[i].error) continue;
+        if (b->files[i].compression != COMPRESSION_NONE) {
+            ++n;
+            continue;
+        }
+        n += b->files[i].size > grain ? (b->files[i].size + grain - 1) / grain
+                                      : 1;
+    }
+    *count = n;
+    if (n == 0) return NULL;
+    batch_task_t* tasks = calloc(n, sizeof(batch_task_t));
+    if (!tasks) return NULL;
+
+    size_t t = 0;
+    for (size_t i = 0; i < b->count; ++i) {
+        const batch_file_t* f = &b->files[i];
+        if (f->error) continue;
+        if (f->compression != COMPRESSION_NONE) {
+            tasks[t].file = i;
+            tasks[t].begin = 0;
+            tasks[t].end = f->size;
+            tasks[t].cost = f->size * COMPRESSED_RATIO;
+            ++t;
+            continue;
+        }
+        size_t begin = 0;
+        do {
+            tasks[t].file = i;
+            tasks[t].begin = begin;
+            begin = f->size - begin > grain ? begin + grain : f->size;
+            tasks[t].end = begin;
+            tasks[t].cost = tasks[t].end - tasks[t].begin;
+            ++t;
+        } while (begin < f->size);
+    }
+    // Sort on the planned sizes, then let the last piece of each file run
+    // to wherever the file ends when it is counted.
+    qsort(tasks, n, sizeof(batch_task_t), by_length_desc);
+    for (size_t i = 0; i < n; ++i) {
+        if (tasks[i].end == b->files[tasks[i].file].size) {
+            tasks[i].end = BATCH_TO_END;
+        }
+    }
+    return tasks;
+}
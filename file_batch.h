@@ -0,0 +1,62 @@
+#ifndef FILE_BATCH_H
+#define FILE_BATCH_H
+
+#include <stddef.h>
+#include "count_kernels.h"
+#include "decompress.h"
+
+/* One input file of a batch. */
+typedef struct {
+    char* path;
+    size_t size;     /* at collection time; the file may grow later */
+    compression_t compression; /* gzip and zstd files are decoded whole */
+    counts_t counts; /* summed over its pieces once counted */
+    int error;       /* errno if it could not be listed or read, else 0 */
+} batch_file_t;
+
+/* A piece of work: the lines of files[file] that start in [begin, end).
+   end == BATCH_TO_END stands for the end of the file at the time it is
+   counted, so a log that grew since it was listed is counted in full. */
+typedef struct {
+    size_t file;
+    size_t begin;
+    size_t end;
+    size_t cost;     /* bytes to count, for the ordering */
+    counts_t counts;
+    int error;
+} batch_task_t;
+
+#define BATCH_TO_END ((size_t)-1)
+
+typedef struct {
+    batch_file_t* files;
+    size_t count;
+    size_t capacity;
+    size_t errors;  /* files with error != 0 */
+} file_batch_t;
+
+void file_batch_init(file_batch_t* b);
+
+void file_batch_free(file_batch_t* b);
+
+/* Add an input given on the command line: a file, a directory (walked
+   recursively in name order; symbolic links to directories are not
+   followed) or a glob(3) pattern that does not name an existing file.
+   Paths that cannot be listed are added with their error set.
+   Returns 0, or -1 if out of memory. */
+int file_batch_add(file_batch_t* b, const char* arg);
+
+/* Cut the files into tasks of about `grain` bytes and order them
+   largest first, so that big files start early and the small ones fill
+   the gaps at the end (longest processing time first). A compressed file
+   cannot be cut and is one task, weighted by the text it likely decodes
+   to. Files with an error get no task. Returns the task array (free() it) and sets *count,
+   or NULL if out of memory or there is nothing to count. */
+batch_task_t* file_batch_plan(const file_batch_t* b, size_t grain,
+                              size_t* count);
+
+/* Whether an argument should be handled as a batch rather than a single
+   file: a directory, or a glob pattern that names no file. */
+int file_batch_is_batch_arg(const char* arg);
+
+#endif /* FILE_BATCH_H */
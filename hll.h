@@ -0,0 +1,48 @@
+#ifndef HLL_H
+#define HLL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* HyperLogLog distinct counter: 2^precision one-byte registers, each the
+   longest run of leading zeros seen among the hashes routed to it. The
+   relative standard error is 1.04 / sqrt(2^precision): 0.81% in 16 KB at
+   the default precision of 14. */
+typedef struct {
+    uint8_t* registers;
+    unsigned precision;
+} hll_t;
+
+#define HLL_DEFAULT_PRECISION 14
+#define HLL_MIN_PRECISION 4
+#define HLL_MAX_PRECISION 18
+
+/* Smallest precision whose standard error is at most `error` (a fraction,
+   e.g. 0.01), clamped to the supported range. */
+unsigned hll_precision_for(double error);
+
+/* Standard error of a precision, as a fraction. */
+double hll_error(unsigned precision);
+
+/* Returns 0, or -1 if out of memory. */
+int hll_init(hll_t* h, unsigned precision);
+
+void hll_free(hll_t* h);
+
+void hll_clear(hll_t* h);
+
+/* Add the words of text (split on ASCII whitespace, as in the "C"
+   locale). */
+void hll_add_text(hll_t* h, const char* text, size_t len);
+
+/* into |= from (register-wise maximum); both have the same precision. */
+void hll_merge(hll_t* into, const hll_t* from);
+
+/* Like hll_merge(), but `into` may be merged into by other threads at the
+   same time. */
+void hll_merge_shared(hll_t* into, const hll_t* from);
+
+/* Estimated number of distinct words added. */
+unsigned long long hll_estimate(const hll_t* h);
+
+#endif /* HLL_H */
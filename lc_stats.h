@@ -0,0 +1,59 @@
+#ifndef LC_STATS_H
+#define LC_STATS_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <time.h>
+
+/* Runtime counters for the round-robin pipeline (--stats).
+
+   Every counter has a single writer, so an update is a relaxed load and
+   store (a plain add on x86, no locked instruction), and a reader on
+   another thread, such as the SIGUSR1 dump, sees a recent value without a
+   data race. Updates sit on per-block or sleeping paths, never per line.
+
+   Build with -DLC_STATS=0 to compile the LC_STAT_* updates out. The park
+   counts behind -v use lc_stat_add() directly and are always kept. */
+#ifndef LC_STATS
+#define LC_STATS 1
+#endif
+
+typedef _Atomic unsigned long long lc_stat_t;
+
+static inline unsigned long long lc_stat_get(const lc_stat_t* c) {
+    return atomic_load_explicit((lc_stat_t*)c, memory_order_relaxed);
+}
+
+/* Only the counter's owner may call this. */
+static inline void lc_stat_add(lc_stat_t* c, unsigned long long n) {
+    atomic_store_explicit(c, atomic_load_explicit(c, memory_order_relaxed) + n,
+                          memory_order_relaxed);
+}
+
+static inline void lc_stat_max(lc_stat_t* c, unsigned long long v) {
+    if (v > atomic_load_explicit(c, memory_order_relaxed)) {
+        atomic_store_explicit(c, v, memory_order_relaxed);
+    }
+}
+
+static inline unsigned long long lc_stat_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL
+         + (unsigned long long)ts.tv_nsec;
+}
+
+#if LC_STATS
+#define LC_STAT_ADD(c, n) lc_stat_add(&(c), (n))
+#define LC_STAT_MAX(c, v) lc_stat_max(&(c), (v))
+/* Time a sleep: LC_STAT_START(t0); ...; LC_STAT_ELAPSED(counter, t0); */
+#define LC_STAT_START(t0) unsigned long long t0 = lc_stat_now_ns()
+#define LC_STAT_ELAPSED(c, t0) lc_stat_add(&(c), lc_stat_now_ns() - (t0))
+#else
+#define LC_STAT_ADD(c, n) ((void)0)
+#define LC_STAT_MAX(c, v) ((void)0)
+#define LC_STAT_START(t0) ((void)0)
+#define LC_STAT_ELAPSED(c, t0) ((void)0)
+#endif
+
+#endif /* LC_STATS_H */
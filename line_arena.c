@@ -0,0 +1,55 @@
+/*
+Reference-counted slabs for lines that are not mapped.
+
+Copying every line with strdup() on the reader thread and free() on a
+worker costs two allocator calls per line, and cross-thread frees are the
+worst case for malloc (arena lock contention, memory parked in the wrong
+arena). The stream reader (stream_reader.c) reads into large slabs instead;
+workers get views of the lines in them, and a slab is freed or recycled
+once, when the last of its lines has been counted.
+
+Reference counting without a per-line atomic on the reader side: a new slab
+starts with a large bias instead of zero. Workers subtract one per line they
+are done with (coalesced per block). When the reader retires the slab it
+subtracts bias - handed_out in one step. The count can only reach zero after
+both the retirement and the last release, whichever comes second frees it.
+*/
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include "line_arena.h"
+
+#define SLAB_BIAS ((size_t)1 << (sizeof(size_t) * 8 - 2))
+
+line_slab_t* line_slab_new(size_t size) {
+    // aligned_alloc wants a multiple of the alignment.
+    size_t bytes = (sizeof(line_slab_t) + size + 63) & ~(size_t)63;
+    line_slab_t* slab = aligned_alloc(64, bytes);
+    if (!slab) return NULL;
+    atomic_init(&slab->refs, SLAB_BIAS);
+    slab->size = size;
+    slab->used = 0;
+    slab->handed_out = 0;
+    slab->recycle = NULL;
+    slab->recycle_ctx = NULL;
+    return slab;
+}
+
+void line_slab_reset(line_slab_t* slab) {
+    atomic_store_explicit(&slab->refs, SLAB_BIAS, memory_order_relaxed);
+    slab->used = 0;
+    slab->handed_out = 0;
+}
+
+void line_slab_release(line_slab_t* slab, size_t count) {
+    if (atomic_fetch_sub_explicit(&slab->refs, count,
+                                  memory_order_acq_rel) == count) {
+        if (slab->recycle) slab->recycle(slab, slab->recycle_ctx);
+        else free(slab);
+    }
+}
+
+void line_slab_retire(line_slab_t* slab) {
+    line_slab_release(slab, SLAB_BIAS - slab->handed_out);
+}
@@ -0,0 +1,41 @@
+#ifndef LINE_ARENA_H
+#define LINE_ARENA_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+
+typedef struct line_slab line_slab_t;
+
+/* Called instead of free() when the last reference to a slab is dropped,
+   to put it back in a pool (see stream_reader.c). May run on any thread. */
+typedef void (*line_slab_recycle_fn)(line_slab_t* slab, void* ctx);
+
+/* A large buffer that many lines are carved out of. It is freed (or
+   recycled) in one piece when its owner has retired it and every line in
+   it was released. data is cache-line aligned. */
+struct line_slab {
+    _Atomic size_t refs;
+    size_t size;
+    size_t used;
+    size_t handed_out;  /* lines carved so far; touched by the owner only */
+    line_slab_recycle_fn recycle;  /* NULL: free() the slab */
+    void* recycle_ctx;
+    _Alignas(64) char data[];
+};
+
+/* Allocate a slab with room for `size` bytes. The caller owns it until it
+   calls line_slab_retire(); lines handed out meanwhile are counted in
+   handed_out. Returns NULL if out of memory. */
+line_slab_t* line_slab_new(size_t size);
+
+/* Make a recycled slab empty and owned by the caller again. */
+void line_slab_reset(line_slab_t* slab);
+
+/* Give up ownership of a slab that will receive no more lines. */
+void line_slab_retire(line_slab_t* slab);
+
+/* Drop `count` line references to a slab; frees it once its owner has
+   retired it and no references remain. Safe from any thread. */
+void line_slab_release(line_slab_t* slab, size_t count);
+
+#endif /* LINE_ARENA_H */
@@ -0,0 +1,89 @@
+/*
+Dispatch policies of the round-robin mode.
+
+Round-robin gives each queue a third of the lines, which is a third of the
+work only if lines are about the same length. One 10 MB line keeps a worker
+busy while the other two drain their queues and sleep. The byte-aware
+policies look at the bytes each queue still has to count: "least" sends a
+line to the queue with the fewest (ties in round-robin order), "p2c"
+compares only two queues picked at random, the power of two choices, which
+needs one load less per line and spreads the lines of a run of ties.
+
+Outstanding bytes include lines still in the reader's partial blocks and
+lines a worker has popped but not counted yet, since the worker publishes
+its progress once per block: the estimate lags by at most a block, which
+is small next to the lines that make the split uneven.
+*/
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <string.h>
+#include "line_dispatch.h"
+
+int line_dispatch_parse(const char* name, dispatch_policy_t* policy) {
+    if (strcmp(name, "rr") == 0) *policy = DISPATCH_ROUND_ROBIN;
+    else if (strcmp(name, "least") == 0) *policy = DISPATCH_LEAST_BYTES;
+    else if (strcmp(name, "p2c") == 0) *policy = DISPATCH_TWO_CHOICES;
+    else return -1;
+    return 0;
+}
+
+const char* line_dispatch_name(dispatch_policy_t policy) {
+    switch (policy) {
+    case DISPATCH_LEAST_BYTES: return "least";
+    case DISPATCH_TWO_CHOICES: return "p2c";
+    default: return "rr";
+    }
+}
+
+void line_dispatch_init(line_dispatch_t* d, dispatch_policy_t policy,
+                        size_t queues,
+                        const _Atomic unsigned long long* const* done) {
+    memset(d, 0, sizeof(*d));
+    d->policy = policy;
+    d->queues = queues < DISPATCH_MAX_QUEUES ? queues : DISPATCH_MAX_QUEUES;
+    d->seed = 0x9e3779b97f4a7c15ULL;
+    for (size_t i = 0; done && i < d->queues; ++i) d->done[i] = done[i];
+}
+
+static inline unsigned long long outstanding(const line_dispatch_t* d,
+                                             size_t i) {
+    return d->sent[i]
+        - atomic_load_explicit(d->done[i], memory_order_relaxed);
+}
+
+size_t line_dispatch_pick(line_dispatch_t* d, size_t len) {
+    size_t q = d->next;
+    if (d->policy == DISPATCH_LEAST_BYTES) {
+        unsigned long long best = outstanding(d, q);
+        for (size_t k = 1; k < d->queues && best; ++k) {
+            size_t i = (d->next + k) % d->queues;
+            unsigned long long load = outstanding(d, i);
+            if (load < best) {
+                best = load;
+                q = i;
+            }
+        }
+    }
+    else if (d->policy == DISPATCH_TWO_CHOICES && d->queues > 1) {
+        d->seed = d->seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        size_t a = (size_t)(d->seed >> 33) % d->queues;
+        size_t b = (a + 1 + (size_t)(d->seed >> 17) % (d->queues - 1))
+            % d->queues;
+        q = outstanding(d, b) < outstanding(d, a) ? b : a;
+    }
+    d->next = (q + 1) % d->queues;
+    d->sent[q] += len;
+    ++d->lines[q];
+    return q;
+}
+
+double line_dispatch_imbalance(const line_dispatch_t* d) {
+    unsigned long long total = 0, max = 0;
+    for (size_t i = 0; i < d->queues; ++i) {
+        total += d->sent[i];
+        if (d->sent[i] > max) max = d->sent[i];
+    }
+    if (total == 0) return 0.0;
+    return (double)max * (double)d->queues / (double)total - 1.0;
+}
@@ -0,0 +1,51 @@
+#ifndef LINE_DISPATCH_H
+#define LINE_DISPATCH_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* How the reader picks the queue of the next line. */
+typedef enum {
+    DISPATCH_ROUND_ROBIN, /* 0, 1, 2, 0, ... whatever the line length */
+    DISPATCH_LEAST_BYTES, /* the queue with the fewest bytes outstanding */
+    DISPATCH_TWO_CHOICES  /* the less loaded of two queues picked at random */
+} dispatch_policy_t;
+
+#define DISPATCH_MAX_QUEUES 8
+
+/* Reader side of a dispatch policy. The bytes outstanding on a queue are
+   those handed to it (sent) minus those its consumer reports as counted
+   (done), so a queue stuck on a long line stops receiving new ones until
+   the others have caught up. Only the reader calls line_dispatch_pick(). */
+typedef struct {
+    dispatch_policy_t policy;
+    size_t queues;
+    size_t next;   /* round-robin cursor; first candidate on ties */
+    uint64_t seed; /* two-choices */
+    unsigned long long sent[DISPATCH_MAX_QUEUES];
+    unsigned long long lines[DISPATCH_MAX_QUEUES];
+    /* Bytes counted by each consumer, published with relaxed stores;
+       NULL for round-robin, which never looks at them. */
+    const _Atomic unsigned long long* done[DISPATCH_MAX_QUEUES];
+} line_dispatch_t;
+
+/* "rr", "least" or "p2c"; returns 0, or -1 if the name is unknown. */
+int line_dispatch_parse(const char* name, dispatch_policy_t* policy);
+
+const char* line_dispatch_name(dispatch_policy_t policy);
+
+/* done[i] is the counter of queue i's consumer; done may be NULL for
+   round-robin. */
+void line_dispatch_init(line_dispatch_t* d, dispatch_policy_t policy,
+                        size_t queues,
+                        const _Atomic unsigned long long* const* done);
+
+/* Queue for a line of len bytes, which is charged to it. */
+size_t line_dispatch_pick(line_dispatch_t* d, size_t len);
+
+/* Largest share of the bytes sent to one queue over the mean share, minus
+   one: 0 is a perfect split, 2 (with three queues) one queue got all. */
+double line_dispatch_imbalance(const line_dispatch_t* d);
+
+#endif /* LINE_DISPATCH_H */
@@ -1,5 +1,6 @@
 #define _POSIX_C_SOURCE 200809L
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdatomic.h>
@@ -10,7 +11,7 @@
 #include "shared.h"
 
 /* Forward declarations for queues (defined in main.c). */
-extern Queue* queueA;
+extern NumberQueue* queueA;
 
 /*
  * SquareNumber: Calculate the square of a 32-bit integer.
@@ -29,7 +30,7 @@ static int64_t SquareNumber(int32_t number)
  * ConsumerAThread: Process even numbers and calculate their squares.
  *
  * Consumer A dequeues numbers from its queue, calculates the square of each,
- * and enqueues a ConsumerAMessage to the result queue. It continues until
+ * and enqueues a ConsumerAMessage to the result queue, a batch at a time. It continues until
  * the producer is finished and its queue is empty.
  *
  * Parameters:
@@ -41,41 +42,43 @@ void* ConsumerAThread(void* arg)
 {
     (void)arg;  /* Mark parameter as intentionally unused. */
 
-    while (1) {
-        /* Try to dequeue a number pointer from consumer A's queue. */
-        void* vp_number = NULL;
-        if (QueueDequeue(queueA, &vp_number)) {
-            int32_t number = *(int32_t*)vp_number;
-            free(vp_number);
+    int32_t numbers[QUEUE_BATCH];
+    ConsumerAMessage msgs[QUEUE_BATCH];
 
-            int64_t square = SquareNumber(number);
+    while (1) {
+        /*
+         * Read the flag before the queue: if the producer had finished and
+         * the queue is then empty, no number can arrive any more.
+         * Use memory_order_acquire to see all producer writes.
+         */
+        int finished = atomic_load_explicit(&producerState.producerFinished,
+                                            memory_order_acquire);
 
-            /* Create and enqueue a typed message for the main thread. */
-            ConsumerAMessage* msg = malloc(sizeof(ConsumerAMessage));
-            if (!msg) {
-                continue;
+        /* Try to dequeue a batch of numbers from consumer A's queue. */
+        size_t count = NumberQueueDequeueBatch(queueA, numbers, QUEUE_BATCH);
+        if (count > 0) {
+            /* Enqueue typed messages for the main thread; they are copied. */
+            for (size_t i = 0; i < count; ++i) {
+                msgs[i].number = numbers[i];
+                msgs[i].square = SquareNumber(numbers[i]);
+                /* Capture the time this message was created. */
+                clock_gettime(CLOCK_REALTIME, &msgs[i].sendTime);
+            }
+            if (!MessageQueueAEnqueueBatch(resultQueueA, msgs, count)) {
+                /* The main thread would wait for these results forever. */
+                fprintf(stderr, "Error: Out of memory for results\n");
+                exit(EXIT_FAILURE);
             }
-            msg->number = number;
-            msg->square = square;
-            /* Capture the time this message was created/sent. */
-            clock_gettime(CLOCK_REALTIME, &msg->sendTime);
-            QueueEnqueue(resultQueueA, msg);
 
-            /* Decrement in-flight count to mark this work item processed. */
-            extern _Atomic(int32_t) inFlightCount;
-            atomic_fetch_sub_explicit(&inFlightCount, 1, memory_order_acq_rel);
+            /* Decrement in-flight count to mark these work items processed. */
+            atomic_fetch_sub_explicit(&inFlightCount, (int32_t)count,
+                                      memory_order_acq_rel);
+        }
+        else if (finished) {
+            /* Producer finished and queue is empty, exit. */
+            break;
         }
         else {
-            /*
-             * Queue is empty. Check if producer is finished.
-             * Use memory_order_acquire to see all producer writes.
-             */
-            if (atomic_load_explicit(&producerState.producerFinished,
-                                     memory_order_acquire)) {
-                /* Producer finished and queue is empty, exit. */
-                break;
-            }
-
             /* Yield to reduce busy-waiting. */
             sched_yield();
         }
@@ -1,5 +1,6 @@
 #define _POSIX_C_SOURCE 200809L
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdatomic.h>
@@ -11,7 +12,7 @@
 #include "shared.h"
 
 /* Forward declarations for queues (defined in main.c). */
-extern Queue* queueB;
+extern NumberQueue* queueB;
 
 /*
  * IsPrime: Check whether a number is prime using trial division.
@@ -55,8 +56,8 @@ static int IsPrime(int32_t number)
  * ConsumerBThread: Process odd numbers and check if they are prime.
  *
  * Consumer B dequeues numbers from its queue, checks if each is prime,
- * and enqueues a ConsumerBMessage to the result queue. It continues until
- * the producer is finished and its queue is empty.
+ * and enqueues a ConsumerBMessage to the result queue, a batch at a time.
+ * It continues until the producer is finished and its queue is empty.
  *
  * Parameters:
  *   arg: Unused (NULL)
@@ -67,41 +68,43 @@ void* ConsumerBThread(void* arg)
 {
     (void)arg;  /* Mark parameter as intentionally unused. */
 
-    while (1) {
-        /* Try to dequeue a number pointer from consumer B's queue. */
-        void* vp = NULL;
-        if (QueueDequeue(queueB, &vp)) {
-            int32_t number = *(int32_t*)vp;
-            free(vp);
+    int32_t numbers[QUEUE_BATCH];
+    ConsumerBMessage msgs[QUEUE_BATCH];
 
-            int is_prime = IsPrime(number);
+    while (1) {
+        /*
+         * Read the flag before the queue: if the producer had finished and
+         * the queue is then empty, no number can arrive any more.
+         * Use memory_order_acquire to see all producer writes.
+         */
+        int finished = atomic_load_explicit(&producerState.producerFinished,
+                                            memory_order_acquire);
 
-            /* Create and enqueue a typed message for the main thread. */
-            ConsumerBMessage* msg = malloc(sizeof(ConsumerBMessage));
-            if (!msg) {
-                continue;
+        /* Try to dequeue a batch of numbers from consumer B's queue. */
+        size_t count = NumberQueueDequeueBatch(queueB, numbers, QUEUE_BATCH);
+        if (count > 0) {
+            /* Enqueue typed messages for the main thread; they are copied. */
+            for (size_t i = 0; i < count; ++i) {
+                msgs[i].number = numbers[i];
+                msgs[i].isPrime = IsPrime(numbers[i]);
+                /* Capture the time this message was created. */
+                clock_gettime(CLOCK_REALTIME, &msgs[i].sendTime);
+            }
+            if (!MessageQueueBEnqueueBatch(resultQueueB, msgs, count)) {
+                /* The main thread would wait for these results forever. */
+                fprintf(stderr, "Error: Out of memory for results\n");
+                exit(EXIT_FAILURE);
             }
-            msg->number = number;
-            msg->isPrime = is_prime;
-            /* Capture the time this message was created/sent. */
-            clock_gettime(CLOCK_REALTIME, &msg->sendTime);
-            QueueEnqueue(resultQueueB, msg);
 
-            /* Decrement in-flight count to mark this work item processed. */
-            extern _Atomic(int32_t) inFlightCount;
-            atomic_fetch_sub_explicit(&inFlightCount, 1, memory_order_acq_rel);
+            /* Decrement in-flight count to mark these work items processed. */
+            atomic_fetch_sub_explicit(&inFlightCount, (int32_t)count,
+                                      memory_order_acq_rel);
+        }
+        else if (finished) {
+            /* Producer finished and queue is empty, exit. */
+            break;
         }
         else {
-            /*
-             * Queue is empty. Check if producer is finished.
-             * Use memory_order_acquire to see all producer writes.
-             */
-            if (atomic_load_explicit(&producerState.producerFinished,
-                                     memory_order_acquire)) {
-                /* Producer finished and queue is empty, exit. */
-                break;
-            }
-
             /* Yield to reduce busy-waiting. */
             sched_yield();
         }
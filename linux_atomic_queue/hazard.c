@@ -0,0 +1,293 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+#include "hazard.h"
+
+/*
+ * Hazard pointers let any number of threads dequeue from the same queue.
+ *
+ * A dequeuer that has swung the head cannot free the old head right away:
+ * another thread may have loaded the same pointer a moment earlier and be
+ * about to read its next field. Worse, if the node were freed and malloc
+ * handed the same address to a new node, that thread's compare-and-swap
+ * could succeed on a pointer that now means something else (ABA).
+ *
+ * So before it dereferences a shared node, a thread publishes the pointer
+ * in one of its hazard slots and checks that the node is still reachable.
+ * A removed node is only retired to a per-thread list. Once the list holds
+ * HAZARD_BATCH + 2 * HAZARD_SLOTS * records nodes, twice as many as there
+ * are hazard slots in all plus a batch, the thread reads every slot once
+ * and reclaims the retired nodes nobody protects: at least HAZARD_BATCH
+ * of them, which amortizes the scan.
+ */
+
+/* A node waiting until no hazard pointer protects it. */
+typedef struct
+{
+    void* node;
+    HazardReclaimFn reclaim;
+} HazardRetired;
+
+/*
+ * Per-thread hazard pointers, kept in a global list that never shrinks.
+ * A record belongs to one thread at a time; a thread that exits releases
+ * it, with the nodes it still had retired, for the next thread to adopt.
+ */
+typedef struct HazardRecord
+{
+    _Atomic(void*) slots[HAZARD_SLOTS];
+    _Atomic(int) active;
+    struct HazardRecord* next;  /* set once, before the record is linked */
+
+    /* Owner only. */
+    HazardRetired* retired;
+    size_t retiredCount;
+    size_t retiredCapacity;
+} HazardRecord;
+
+/* All records ever created, newest first. */
+static _Atomic(HazardRecord*) recordList = NULL;
+static _Atomic(size_t) recordCount = 0;
+
+/* The record of the calling thread, claimed on first use. */
+static _Thread_local HazardRecord* localRecord = NULL;
+
+/* Its destructor releases the record when the thread exits. */
+static pthread_key_t releaseKey;
+static pthread_once_t releaseKeyOnce = PTHREAD_ONCE_INIT;
+
+/*
+ * ReleaseRecord: Give the record of an exiting thread back to the list.
+ *
+ * Its retired nodes stay with it: they may still be protected by other
+ * threads, and the next owner (or HazardDrain) reclaims them.
+ */
+static void ReleaseRecord(void* arg)
+{
+    HazardRecord* record = (HazardRecord*)arg;
+    for (int i = 0; i < HAZARD_SLOTS; ++i) {
+        atomic_store_explicit(&record->slots[i], NULL, memory_order_release);
+    }
+    atomic_store_explicit(&record->active, 0, memory_order_release);
+}
+
+static void CreateReleaseKey(void)
+{
+    pthread_key_create(&releaseKey, ReleaseRecord);
+}
+
+/*
+ * ClaimRecord: Take over a record that no thread owns, or NULL if none.
+ *
+ * The acquire on success pairs with the release in ReleaseRecord, so the
+ * retired list of the previous owner is complete when we take it.
+ */
+static HazardRecord* ClaimRecord(void)
+{
+    HazardRecord* record = atomic_load_explicit(&recordList, memory_order_acquire);
+    for (; record; record = record->next) {
+        int expected = 0;
+        if (atomic_load_explicit(&record->active, memory_order_relaxed) == 0
+            && atomic_compare_exchange_strong_explicit(
+                   &record->active, &expected, 1,
+                   memory_order_acquire, memory_order_relaxed)) {
+            return record;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * NewRecord: Allocate a record owned by the caller and push it on the list.
+ */
+static HazardRecord* NewRecord(void)
+{
+    HazardRecord* record = calloc(1, sizeof(HazardRecord));
+    if (!record) {
+        return NULL;
+    }
+    atomic_store_explicit(&record->active, 1, memory_order_relaxed);
+    HazardRecord* head = atomic_load_explicit(&recordList, memory_order_relaxed);
+    do {
+        record->next = head;
+    } while (!atomic_compare_exchange_weak_explicit(
+                 &recordList, &head, record,
+                 memory_order_release, memory_order_relaxed));
+    atomic_fetch_add_explicit(&recordCount, 1, memory_order_relaxed);
+    return record;
+}
+
+/*
+ * LocalRecord: The record of the calling thread.
+ *
+ * Without one a thread cannot touch a shared node safely, and there is no
+ * error path to report it on: running out of memory here aborts.
+ */
+static HazardRecord* LocalRecord(void)
+{
+    if (localRecord) {
+        return localRecord;
+    }
+    pthread_once(&releaseKeyOnce, CreateReleaseKey);
+    HazardRecord* record = ClaimRecord();
+    if (!record) {
+        record = NewRecord();
+    }
+    if (!record) {
+        abort();
+    }
+    pthread_setspecific(releaseKey, record);
+    localRecord = record;
+    return record;
+}
+
+void HazardProtect(int slot, void* node)
+{
+    /* seq_cst: the store must be visible before the caller re-reads the
+       shared pointer, which a release store would not guarantee. */
+    atomic_store_explicit(&LocalRecord()->slots[slot], node,
+                          memory_order_seq_cst);
+}
+
+void HazardClear(void)
+{
+    HazardRecord* record = LocalRecord();
+    for (int i = 0; i < HAZARD_SLOTS; ++i) {
+        atomic_store_explicit(&record->slots[i], NULL, memory_order_release);
+    }
+}
+
+static int ComparePointers(const void* a, const void* b)
+{
+    uintptr_t x = (uintptr_t)*(void* const*)a;
+    uintptr_t y = (uintptr_t)*(void* const*)b;
+    return (x > y) - (x < y);
+}
+
+/*
+ * CollectHazards: Every published hazard pointer, sorted for bsearch.
+ *
+ * Records pushed after the list head is loaded do not matter: a thread
+ * that protects a node only uses it once it has seen it still reachable,
+ * and retired nodes no longer are.
+ *
+ * Returns: A malloc'd array (count in *count), or NULL if out of memory.
+ */
+static void** CollectHazards(size_t* count)
+{
+    HazardRecord* head = atomic_load_explicit(&recordList, memory_order_acquire);
+    size_t records = 0;
+    for (HazardRecord* r = head; r; r = r->next) {
+        ++records;
+    }
+    void** hazards = malloc((records * HAZARD_SLOTS + 1) * sizeof(void*));
+    if (!hazards) {
+        return NULL;
+    }
+    size_t n = 0;
+    for (HazardRecord* r = head; r; r = r->next) {
+        for (int i = 0; i < HAZARD_SLOTS; ++i) {
+            void* p = atomic_load_explicit(&r->slots[i], memory_order_seq_cst);
+            if (p) {
+                hazards[n++] = p;
+            }
+        }
+    }
+    qsort(hazards, n, sizeof(void*), ComparePointers);
+    *count = n;
+    return hazards;
+}
+
+/*
+ * Scan: Reclaim the retired nodes of a record that no hazard protects,
+ * keeping the others for the next scan.
+ */
+static void Scan(HazardRecord* record)
+{
+    size_t count = 0;
+    void** hazards = CollectHazards(&count);
+    if (!hazards) {
+        return;  /* Try again at the next retire. */
+    }
+    size_t kept = 0;
+    for (size_t i = 0; i < record->retiredCount; ++i) {
+        HazardRetired r = record->retired[i];
+        if (bsearch(&r.node, hazards, count, sizeof(void*), ComparePointers)) {
+            record->retired[kept++] = r;
+        }
+        else {
+            r.reclaim(r.node);
+        }
+    }
+    record->retiredCount = kept;
+    free(hazards);
+}
+
+/*
+ * ReserveRetired: Make room for one more retired node.
+ *
+ * If the list cannot grow, scan until a node is reclaimed: hazards are
+ * only held for the length of one queue operation.
+ */
+static void ReserveRetired(HazardRecord* record)
+{
+    while (record->retiredCount == record->retiredCapacity) {
+        size_t capacity = record->retiredCapacity ? record->retiredCapacity * 2
+                                                  : 2 * HAZARD_BATCH;
+        HazardRetired* grown = realloc(record->retired,
+                                       capacity * sizeof(HazardRetired));
+        if (grown) {
+            record->retired = grown;
+            record->retiredCapacity = capacity;
+            return;
+        }
+        Scan(record);
+        sched_yield();
+    }
+}
+
+void HazardRetire(void* node, HazardReclaimFn reclaim)
+{
+    HazardRecord* record = LocalRecord();
+    ReserveRetired(record);
+    record->retired[record->retiredCount].node = node;
+    record->retired[record->retiredCount].reclaim = reclaim;
+    ++record->retiredCount;
+
+    size_t records = atomic_load_explicit(&recordCount, memory_order_relaxed);
+    if (record->retiredCount >= HAZARD_BATCH + 2 * HAZARD_SLOTS * records) {
+        Scan(record);
+    }
+}
+
+/*
+ * AdoptRetired: Move the retired nodes of every released record to own.
+ */
+static void AdoptRetired(HazardRecord* own)
+{
+    HazardRecord* r = atomic_load_explicit(&recordList, memory_order_acquire);
+    for (; r; r = r->next) {
+        int expected = 0;
+        if (r == own || !atomic_compare_exchange_strong_explicit(
+                            &r->active, &expected, 1,
+                            memory_order_acquire, memory_order_relaxed)) {
+            continue;
+        }
+        while (r->retiredCount > 0) {
+            ReserveRetired(own);
+            own->retired[own->retiredCount++] = r->retired[--r->retiredCount];
+        }
+        atomic_store_explicit(&r->active, 0, memory_order_release);
+    }
+}
+
+void HazardDrain(void)
+{
+    HazardRecord* record = LocalRecord();
+    AdoptRetired(record);
+    Scan(record);
+}
@@ -0,0 +1,34 @@
+#ifndef HAZARD_H
+#define HAZARD_H
+
+// See Maged M. Michael, "Hazard Pointers: Safe Memory Reclamation for
+// Lock-Free Objects", IEEE TPDS 15(6), 2004.
+
+/* Hazard pointers each thread may publish at the same time: a batch
+   dequeue holds the head and two nodes it walks through. */
+#define HAZARD_SLOTS 3
+
+/* A thread scans the hazard pointers once it has retired HAZARD_BATCH
+   nodes plus two per hazard slot of every record:
+   HAZARD_BATCH + 2 * HAZARD_SLOTS * records. */
+#define HAZARD_BATCH 64
+
+/* Called on a retired node once no thread can reach it any more. */
+typedef void (*HazardReclaimFn)(void* node);
+
+/* Publish node in slot i of the calling thread. The caller must then check
+   that node is still reachable before it dereferences it. */
+void HazardProtect(int slot, void* node);
+
+/* Clear all hazard pointers of the calling thread. */
+void HazardClear(void);
+
+/* Hand over a node that was unlinked and that no new reader can reach;
+   reclaim(node) runs once no hazard pointer protects it any more. */
+void HazardRetire(void* node, HazardReclaimFn reclaim);
+
+/* Reclaim every retired node that is not protected: those of the calling
+   thread and those left behind by threads that exited. */
+void HazardDrain(void);
+
+#endif /* HAZARD_H */
@@ -7,18 +7,23 @@
 #include <pthread.h>
 #include <unistd.h>
 #include <time.h>
+#include "node_pool.h"
 #include "queue.h"
 #include "shared.h"
 
 #include <inttypes.h>
 
+/* Numbers the producer may get ahead of each consumer: beyond that, it
+   waits for the consumer (see ProducerThread). */
+#define NUMBER_QUEUE_CAPACITY 1024
+
 /* Global queues for inter-thread communication. */
-Queue* queueA = NULL;
-Queue* queueB = NULL;
+NumberQueue* queueA = NULL;
+NumberQueue* queueB = NULL;
 
 /* Global result queues for consumer outputs. */
-Queue* resultQueueA = NULL;
-Queue* resultQueueB = NULL;
+MessageQueueA* resultQueueA = NULL;
+MessageQueueB* resultQueueB = NULL;
 
 /* Global producer state. */
 ProducerState producerState = {
@@ -78,50 +83,46 @@ static void FormatNow(char *tsbuf, size_t size) {
  * Uses a merge algorithm: keep track of the next message from each queue and
  * always print whichever has the earlienanosleepst timestamp. This ensures results appear
  * in the order they were generated, not the order they happen to be dequeued.
+ *
+ * Messages are dequeued QUEUE_BATCH at a time; the next batch from a queue
+ * is fetched once the last one is printed.
  */
 static void PrintResultsLive(void)
 {
     int printedFinished = 0;
-    ConsumerAMessage* msgA = NULL;
-    ConsumerBMessage* msgB = NULL;
-    int hasA = 0, hasB = 0;
+    ConsumerAMessage msgsA[QUEUE_BATCH];
+    ConsumerBMessage msgsB[QUEUE_BATCH];
+    size_t countA = 0, countB = 0;  /* Messages in the last batch. */
+    size_t nextA = 0, nextB = 0;    /* Next one of them to print. */
 
     for (;;) {
         int didWork = 0;
 
-        /* Try to fetch next message from A if we don't have one. */
-        if (!hasA) {
-            void* vp = NULL;
-            if (QueueDequeue(resultQueueA, &vp)) {
-                msgA = (ConsumerAMessage*)vp;
-                if (msgA) {
-                    hasA = 1;
-                }
-                didWork = 1;
-            }
+        /* Try to fetch more messages from A if we printed all we had. */
+        if (nextA == countA) {
+            countA = MessageQueueADequeueBatch(resultQueueA, msgsA, QUEUE_BATCH);
+            nextA = 0;
+            didWork |= countA > 0;
         }
 
-        /* Try to fetch next message from B if we don't have one. */
-        if (!hasB) {
-            void* vp = NULL;
-            if (QueueDequeue(resultQueueB, &vp)) {
-                msgB = (ConsumerBMessage*)vp;
-                if (msgB) {
-                    hasB = 1;
-                }
-                didWork = 1;
-            }
+        /* Try to fetch more messages from B if we printed all we had. */
+        if (nextB == countB) {
+            countB = MessageQueueBDequeueBatch(resultQueueB, msgsB, QUEUE_BATCH);
+            nextB = 0;
+            didWork |= countB > 0;
         }
 
+        int hasA = nextA < countA, hasB = nextB < countB;
+        const ConsumerAMessage* msgA = &msgsA[nextA];
+        const ConsumerBMessage* msgB = &msgsB[nextB];
+
         /* Merge: print whichever message has the earlier timestamp. */
         if (hasA && hasB) {
             if (TimestampCmp(msgA->sendTime, msgB->sendTime) <= 0) {
                 char tsbuf[64];
                 FormatTimestamp(msgA->sendTime, tsbuf, sizeof(tsbuf));
                 printf("[%s] %d x %d = %" PRId64 "\n", tsbuf, msgA->number, msgA->number, msgA->square);
-                free(msgA);
-                msgA = NULL;
-                hasA = 0;
+                ++nextA;
             }
             else {
                 char tsbuf[64];
@@ -132,18 +133,14 @@ static void PrintResultsLive(void)
                 else {
                     printf("[%s] %d is not prime\n", tsbuf, msgB->number);
                 }
-                free(msgB);
-                msgB = NULL;
-                hasB = 0;
+                ++nextB;
             }
         }
         else if (hasA) {
             char tsbuf[64];
             FormatTimestamp(msgA->sendTime, tsbuf, sizeof(tsbuf));
             printf("[%s] %d x %d = %" PRId64 "\n", tsbuf, msgA->number, msgA->number, msgA->square);
-            free(msgA);
-            msgA = NULL;
-            hasA = 0;
+            ++nextA;
         }
         else if (hasB) {
             char tsbuf[64];
@@ -154,16 +151,14 @@ static void PrintResultsLive(void)
             else {
                 printf("[%s] %d is not prime\n", tsbuf, msgB->number);
             }
-            free(msgB);
-            msgB = NULL;
-            hasB = 0;
+            ++nextB;
         }
 
         /* Print producer finished message after all messages are printed. */
         if (!printedFinished && atomic_load_explicit(&producerState.producerFinished, memory_order_acquire)
             && atomic_load_explicit(&inFlightCount, memory_order_acquire) == 0
-            && !hasA && !hasB
-            && QueueIsEmpty(resultQueueA) && QueueIsEmpty(resultQueueB)) {
+            && nextA == countA && nextB == countB
+            && MessageQueueAIsEmpty(resultQueueA) && MessageQueueBIsEmpty(resultQueueB)) {
             char tsbuf[64];
 			FormatNow(tsbuf, sizeof(tsbuf));
             int32_t total_count = atomic_load(&producerState.totalCount);
@@ -175,8 +170,8 @@ static void PrintResultsLive(void)
         if (printedFinished
             && atomic_load_explicit(&producerState.producerFinished, memory_order_acquire)
             && atomic_load_explicit(&inFlightCount, memory_order_acquire) == 0
-            && !hasA && !hasB
-            && QueueIsEmpty(resultQueueA) && QueueIsEmpty(resultQueueB)) {
+            && nextA == countA && nextB == countB
+            && MessageQueueAIsEmpty(resultQueueA) && MessageQueueBIsEmpty(resultQueueB)) {
             break;
         }
 
@@ -187,6 +182,21 @@ static void PrintResultsLive(void)
     }
 }
 
+#ifdef DEBUG
+/*
+ * PrintPoolStats: Report how often the queue nodes came from a thread's own
+ * cache, from the shared free list, or from fresh slabs (debug builds).
+ */
+static void PrintPoolStats(void)
+{
+    NodePoolStats stats;
+    NodePoolGetStats(&stats);
+    fprintf(stderr, "Node pool: %" PRIu64 " hits, %" PRIu64 " refills, %" PRIu64
+            " misses, %" PRIu64 " releases, %" PRIu64 " slabs\n",
+            stats.hits, stats.refills, stats.misses, stats.releases, stats.slabs);
+}
+#endif
+
 /*
  * Main: Initialize threads, coordinate execution, and display results.
  *
@@ -208,10 +218,10 @@ int main(int argc, char* argv[])
     }
 
     /* Initialize the queues. */
-    queueA = QueueCreate();
-    queueB = QueueCreate();
-    resultQueueA = QueueCreate();
-    resultQueueB = QueueCreate();
+    queueA = NumberQueueCreateBounded(NUMBER_QUEUE_CAPACITY);
+    queueB = NumberQueueCreateBounded(NUMBER_QUEUE_CAPACITY);
+    resultQueueA = MessageQueueACreate();
+    resultQueueB = MessageQueueBCreate();
 
     if (!queueA || !queueB || !resultQueueA || !resultQueueB) {
         fprintf(stderr, "Error: Failed to create queues\n");
@@ -248,10 +258,13 @@ int main(int argc, char* argv[])
     pthread_join(producer_tid, NULL);
 
     /* Clean up allocated resources. */
-    QueueDestroy(queueA);
-    QueueDestroy(queueB);
-    QueueDestroy(resultQueueA);
-    QueueDestroy(resultQueueB);
+    NumberQueueDestroy(queueA);
+    NumberQueueDestroy(queueB);
+    MessageQueueADestroy(resultQueueA);
+    MessageQueueBDestroy(resultQueueB);
+#ifdef DEBUG
+    PrintPoolStats();
+#endif
 
     return EXIT_SUCCESS;
 }
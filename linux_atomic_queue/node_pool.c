@@ -0,0 +1,274 @@
+#define _GNU_SOURCE  /* madvise, MADV_HUGEPAGE */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include "node_pool.h"
+
+/*
+ * A pool of QueueNodes, so that enqueue and dequeue do not call malloc and
+ * free for every item.
+ *
+ * Every thread keeps a cache of free nodes, linked through their next
+ * field, that only it touches. Nodes are mostly allocated on one thread
+ * (the one that enqueues) and freed on another (the one that dequeues,
+ * once the hazard pointers let it), so the caches drift apart: a thread
+ * whose cache grows past two batches gives one batch of NODE_POOL_BATCH
+ * nodes to a shared free list, and a thread whose cache is empty takes a
+ * whole batch back. Only those batch moves touch shared memory.
+ *
+ * The shared list is a stack of batches linked through the value field of
+ * their first node. Pushing uses a CAS, which is safe; popping a single
+ * batch with a CAS would not be, since the batch under the top may have
+ * been taken and put back meanwhile (ABA). So a thread takes the whole
+ * stack with one exchange and pushes back what it does not need.
+ *
+ * When the list is empty, the thread carves a batch out of its current
+ * slab. Slabs are 2 MB and aligned to it, and on Linux we ask for them to
+ * be backed by transparent huge pages: all nodes then share one TLB entry.
+ * Nodes are never returned to the system; slabs stay linked in slabList
+ * until the program exits.
+ */
+
+/* The start of a slab; the nodes follow. */
+typedef struct Slab
+{
+    struct Slab* next;
+} Slab;
+
+/* The node cache of a thread. */
+typedef struct
+{
+    QueueNode* nodes;  /* linked through next */
+    size_t count;
+    char* slabCursor;  /* next node to carve from the thread's slab */
+    char* slabEnd;
+    uint64_t hits;     /* not yet added to hitCount */
+    int registered;    /* flushKey is set, so the cache is flushed at exit */
+} NodeCache;
+
+static _Thread_local NodeCache cache;
+
+/* Full batches given back by threads, linked through value. */
+static _Atomic(QueueNode*) freeBatches = NULL;
+static _Atomic(Slab*) slabList = NULL;
+
+static _Atomic(uint64_t) hitCount = 0;
+static _Atomic(uint64_t) refillCount = 0;
+static _Atomic(uint64_t) missCount = 0;
+static _Atomic(uint64_t) releaseCount = 0;
+static _Atomic(uint64_t) slabCount = 0;
+
+static pthread_key_t flushKey;
+static pthread_once_t flushKeyOnce = PTHREAD_ONCE_INIT;
+
+static QueueNode* NextNode(QueueNode* node)
+{
+    return atomic_load_explicit(&node->next, memory_order_relaxed);
+}
+
+static void SetNextNode(QueueNode* node, QueueNode* next)
+{
+    atomic_store_explicit(&node->next, next, memory_order_relaxed);
+}
+
+/*
+ * PushBatches: Put a chain of batches, from first to last, on the shared
+ * list. The release makes the links within the batches visible to the
+ * thread that takes them.
+ */
+static void PushBatches(QueueNode* first, QueueNode* last)
+{
+    QueueNode* top = atomic_load_explicit(&freeBatches, memory_order_relaxed);
+    do {
+        last->value = top;
+    } while (!atomic_compare_exchange_weak_explicit(
+                 &freeBatches, &top, first,
+                 memory_order_release, memory_order_relaxed));
+}
+
+/*
+ * TakeBatch: Take one batch from the shared list, or NULL if it is empty.
+ */
+static QueueNode* TakeBatch(void)
+{
+    QueueNode* batch = atomic_exchange_explicit(&freeBatches, NULL,
+                                                memory_order_acquire);
+    if (!batch) {
+        return NULL;
+    }
+    QueueNode* rest = batch->value;
+    if (rest) {
+        QueueNode* last = rest;
+        while (last->value) {
+            last = last->value;
+        }
+        PushBatches(rest, last);
+    }
+    return batch;
+}
+
+/*
+ * NewSlab: Allocate a slab and make it the thread's current one.
+ *
+ * Returns: 1 on success, 0 if out of memory.
+ */
+static int NewSlab(void)
+{
+    Slab* slab = aligned_alloc(NODE_POOL_SLAB_BYTES, NODE_POOL_SLAB_BYTES);
+    if (!slab) {
+        return 0;
+    }
+#ifdef MADV_HUGEPAGE
+    madvise(slab, NODE_POOL_SLAB_BYTES, MADV_HUGEPAGE);  /* only a hint */
+#endif
+    slab->next = atomic_load_explicit(&slabList, memory_order_relaxed);
+    while (!atomic_compare_exchange_weak_explicit(
+               &slabList, &slab->next, slab,
+               memory_order_release, memory_order_relaxed)) {
+    }
+    atomic_fetch_add_explicit(&slabCount, 1, memory_order_relaxed);
+    /* Nodes start one node past the header: at multiples of
+       sizeof(QueueNode) from the slab, they keep _Alignof(QueueNode). */
+    cache.slabCursor = (char*)slab + sizeof(QueueNode);
+    cache.slabEnd = (char*)slab + NODE_POOL_SLAB_BYTES;
+    return 1;
+}
+
+/*
+ * CarveBatch: Link NODE_POOL_BATCH fresh nodes from the thread's slab.
+ *
+ * Returns: The first node, or NULL if out of memory.
+ */
+static QueueNode* CarveBatch(void)
+{
+    size_t bytes = NODE_POOL_BATCH * sizeof(QueueNode);
+    if ((size_t)(cache.slabEnd - cache.slabCursor) < bytes && !NewSlab()) {
+        return NULL;
+    }
+    QueueNode* first = (QueueNode*)cache.slabCursor;
+    for (size_t i = 0; i + 1 < NODE_POOL_BATCH; ++i) {
+        SetNextNode(&first[i], &first[i + 1]);
+    }
+    SetNextNode(&first[NODE_POOL_BATCH - 1], NULL);
+    cache.slabCursor += bytes;
+    return first;
+}
+
+/*
+ * ReleaseBatch: Give the first NODE_POOL_BATCH nodes of a cache, which
+ * must hold that many, to the shared list.
+ */
+static void ReleaseBatch(NodeCache* c)
+{
+    QueueNode* first = c->nodes;
+    QueueNode* last = first;
+    for (size_t i = 1; i < NODE_POOL_BATCH; ++i) {
+        last = NextNode(last);
+    }
+    c->nodes = NextNode(last);
+    c->count -= NODE_POOL_BATCH;
+    SetNextNode(last, NULL);
+    PushBatches(first, first);
+    atomic_fetch_add_explicit(&releaseCount, 1, memory_order_relaxed);
+}
+
+/*
+ * FlushCache: Pass the full batches of an exiting thread's cache on to
+ * the shared list, and its hits to the counters. The nodes of a last,
+ * partial batch stay unused.
+ */
+static void FlushCache(void* arg)
+{
+    NodeCache* c = (NodeCache*)arg;
+    while (c->count >= NODE_POOL_BATCH) {
+        ReleaseBatch(c);
+    }
+    atomic_fetch_add_explicit(&hitCount, c->hits, memory_order_relaxed);
+    c->hits = 0;
+}
+
+static void CreateFlushKey(void)
+{
+    pthread_key_create(&flushKey, FlushCache);
+}
+
+/*
+ * Register: Have the cache flushed when the calling thread exits.
+ */
+static void Register(void)
+{
+    pthread_once(&flushKeyOnce, CreateFlushKey);
+    pthread_setspecific(flushKey, &cache);
+    cache.registered = 1;
+}
+
+/*
+ * Refill: Fill the empty cache with a shared batch, or else a fresh one.
+ *
+ * Returns: 1 on success, 0 if out of memory.
+ */
+static int Refill(void)
+{
+    if (!cache.registered) {
+        Register();
+    }
+    QueueNode* batch = TakeBatch();
+    if (batch) {
+        atomic_fetch_add_explicit(&refillCount, 1, memory_order_relaxed);
+    }
+    else {
+        batch = CarveBatch();
+        if (!batch) {
+            return 0;
+        }
+        atomic_fetch_add_explicit(&missCount, 1, memory_order_relaxed);
+    }
+    cache.nodes = batch;
+    cache.count = NODE_POOL_BATCH;
+    atomic_fetch_add_explicit(&hitCount, cache.hits, memory_order_relaxed);
+    cache.hits = 0;
+    return 1;
+}
+
+QueueNode* NodePoolAlloc(void)
+{
+    if (cache.nodes) {
+        ++cache.hits;
+    }
+    else if (!Refill()) {
+        return NULL;
+    }
+    QueueNode* node = cache.nodes;
+    cache.nodes = NextNode(node);
+    --cache.count;
+    return node;
+}
+
+void NodePoolFree(void* node)
+{
+    if (!cache.registered) {
+        Register();
+    }
+    QueueNode* n = (QueueNode*)node;
+    SetNextNode(n, cache.nodes);
+    cache.nodes = n;
+    ++cache.count;
+    if (cache.count >= 2 * NODE_POOL_BATCH) {
+        /* Keep one batch for the next allocations, give the other away. */
+        ReleaseBatch(&cache);
+    }
+}
+
+void NodePoolGetStats(NodePoolStats* stats)
+{
+    atomic_fetch_add_explicit(&hitCount, cache.hits, memory_order_relaxed);
+    cache.hits = 0;
+    stats->hits = atomic_load_explicit(&hitCount, memory_order_relaxed);
+    stats->refills = atomic_load_explicit(&refillCount, memory_order_relaxed);
+    stats->misses = atomic_load_explicit(&missCount, memory_order_relaxed);
+    stats->releases = atomic_load_explicit(&releaseCount, memory_order_relaxed);
+    stats->slabs = atomic_load_explicit(&slabCount, memory_order_relaxed);
+}
@@ -0,0 +1,35 @@
+#ifndef NODE_POOL_H
+#define NODE_POOL_H
+
+#include <stdint.h>
+#include "queue.h"
+
+/* Nodes moved between a thread's cache and the shared free list at once. */
+#define NODE_POOL_BATCH 256
+
+/* Nodes are carved out of slabs of this size, aligned to it so that the
+   kernel can back each with one transparent huge page. */
+#define NODE_POOL_SLAB_BYTES (2 * 1024 * 1024)
+
+/* Counters of the node pool, summed over all threads. */
+typedef struct
+{
+    uint64_t hits;      /* allocations served by the thread's own cache */
+    uint64_t refills;   /* batches a thread took from the shared free list */
+    uint64_t misses;    /* batches carved from a slab: fresh memory */
+    uint64_t releases;  /* batches a thread gave to the shared free list */
+    uint64_t slabs;     /* slabs allocated */
+} NodePoolStats;
+
+/* Take a node from the calling thread's cache. Returns NULL if out of memory. */
+QueueNode* NodePoolAlloc(void);
+
+/* Give a node back to the calling thread's cache. Takes void* so that it
+   can be handed to HazardRetire(). */
+void NodePoolFree(void* node);
+
+/* Read the counters. Those of running threads other than the caller lag
+   by up to one batch of hits. */
+void NodePoolGetStats(NodePoolStats* stats);
+
+#endif /* NODE_POOL_H */
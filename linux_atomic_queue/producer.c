@@ -7,8 +7,33 @@
 #include "shared.h"
 
 /* Forward declarations for queues (defined in main.c). */
-extern Queue* queueA;
-extern Queue* queueB;
+extern NumberQueue* queueA;
+extern NumberQueue* queueB;
+
+/* Numbers read for one consumer and not sent yet. */
+typedef struct
+{
+    NumberQueue* queue;
+    int32_t numbers[QUEUE_BATCH];
+    size_t count;
+} NumberBatch;
+
+/*
+ * SendBatch: Enqueue the pending numbers of a consumer at once.
+ *
+ * They are counted in flight first, so the count never drops below zero
+ * when the consumer is quick to process them.
+ */
+static void SendBatch(NumberBatch* batch)
+{
+    if (batch->count == 0) {
+        return;
+    }
+    atomic_fetch_add_explicit(&inFlightCount, (int32_t)batch->count,
+                              memory_order_acq_rel);
+    NumberQueueEnqueueBatch(batch->queue, batch->numbers, batch->count);
+    batch->count = 0;
+}
 
 /*
  * ProducerThread: Read integers from file and distribute to consumer queues.
@@ -17,6 +42,11 @@ extern Queue* queueB;
  * consumer A's queue, odd numbers to consumer B's queue. After reading all
  * numbers, it atomically updates the shared state and signals consumers to exit.
  *
+ * Numbers are sent QUEUE_BATCH at a time, which costs one CAS per batch
+ * instead of one per number. The consumer queues are bounded: when one is
+ * full, enqueuing waits until its consumer has caught up, so the producer
+ * never runs far ahead.
+ *
  * Parameters:
  *   arg: Pointer to filename string (const char*)
  *
@@ -34,32 +64,21 @@ void* ProducerThread(void* arg)
 
     int32_t number = 0;
     int32_t count = 0;
+    NumberBatch even = { .queue = queueA, .count = 0 };
+    NumberBatch odd = { .queue = queueB, .count = 0 };
 
     /* Read integers from file and distribute based on even/odd. */
     while (fscanf(file, "%d", &number) == 1) {
-        int32_t* p_number = malloc(sizeof(int32_t));
-        if (!p_number) {
-            break;
+        /* Even numbers go to consumer A, odd ones to consumer B. */
+        NumberBatch* batch = (number % 2 == 0) ? &even : &odd;
+        batch->numbers[batch->count++] = number;
+        if (batch->count == QUEUE_BATCH) {
+            SendBatch(batch);
         }
-        *p_number = number;
-
-        if (number % 2 == 0) {
-            /* Even number: send to consumer A. */
-            QueueEnqueue(queueA, p_number);
-        }
-        else {
-            /* Odd number: send to consumer B. */
-            QueueEnqueue(queueB, p_number);
-        }
-
-        /* Increment global in-flight counter to indicate work outstanding. */
-        extern _Atomic(int32_t) inFlightCount;
-        atomic_fetch_add_explicit(&inFlightCount, 1, memory_order_acq_rel);
         count++;
-        
-        /* Yield to allow other threads to work. */
-        sched_yield();
     }
+    SendBatch(&even);
+    SendBatch(&odd);
 
     fclose(file);
 
@@ -1,6 +1,12 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdint.h>
 #include <stdlib.h>
 #include <stdatomic.h>
 #include <string.h>
+#include <sched.h>
+#include "hazard.h"
+#include "node_pool.h"
 #include "queue.h"
 
 /*
@@ -14,18 +20,22 @@
  */
 Queue* QueueCreate(void)
 {
-    Queue *queue = malloc(sizeof(Queue));
+    /* Aligned for the ring positions, which have cache lines of their own. */
+    Queue *queue = aligned_alloc(QUEUE_CACHE_LINE, sizeof(Queue));
     if (!queue) {
         return NULL;
     }
+    queue->slots = NULL;
+    queue->mask = 0;
+    atomic_init(&queue->enqueuePos, 0);
+    atomic_init(&queue->dequeuePos, 0);
 
-    QueueNode *sentinel = malloc(sizeof(QueueNode));
+    QueueNode *sentinel = NodePoolAlloc();
     if (!sentinel) {
         free(queue);
         return NULL;
     }
 
-    sentinel->value = NULL;
     atomic_store_explicit(&sentinel->next, NULL, memory_order_relaxed);
     atomic_store_explicit(&queue->head, sentinel, memory_order_relaxed);
     atomic_store_explicit(&queue->tail, sentinel, memory_order_release);
@@ -33,59 +43,110 @@ Queue* QueueCreate(void)
     return queue;
 }
 
+/* A slot of a bounded queue. */
+typedef struct QueueSlot
+{
+    _Atomic(size_t) sequence;
+    unsigned char data[QUEUE_INLINE_BYTES];
+} QueueSlot;
+
+/*
+ * QueueCreateBounded: Initialize a queue backed by a ring of slots.
+ *
+ * Slot i starts with sequence i: free for the enqueuer at position i.
+ * Enqueuing at position p sets it to p + 1, full for the dequeuer at p;
+ * dequeuing sets it to p + capacity, free for the enqueuer one lap later.
+ *
+ * Returns: Pointer to newly allocated queue, or NULL on allocation failure
+ * or if capacity is too large to round up and allocate.
+ */
+Queue* QueueCreateBounded(size_t capacity)
+{
+    /* Rounding up must neither wrap size to 0 nor overflow the slot bytes. */
+    if (capacity > SIZE_MAX / 2 / sizeof(QueueSlot)) {
+        return NULL;
+    }
+    size_t size = 2;
+    while (size < capacity) {
+        size *= 2;
+    }
+    Queue *queue = aligned_alloc(QUEUE_CACHE_LINE, sizeof(Queue));
+    QueueSlot *slots = malloc(size * sizeof(QueueSlot));
+    if (!queue || !slots) {
+        free(queue);
+        free(slots);
+        return NULL;
+    }
+    for (size_t i = 0; i < size; ++i) {
+        atomic_init(&slots[i].sequence, i);
+    }
+    atomic_init(&queue->head, NULL);
+    atomic_init(&queue->tail, NULL);
+    queue->slots = slots;
+    queue->mask = size - 1;
+    atomic_init(&queue->enqueuePos, 0);
+    atomic_init(&queue->dequeuePos, 0);
+    return queue;
+}
+
 /*
- * QueueEnqueue: Add a value to the queue using Michael-Scott algorithm.
+ * ListLink: Add a chain of nodes, from first to last, to the queue using
+ * Michael-Scott algorithm.
  *
  * The Michael-Scott algorithm is a lock-free queue that uses atomic
  * compare-and-swap (CAS) operations to safely link nodes. This function:
- *   1. Allocates a new node with the value.
- *   2. Atomically tries to link it at the tail.
- *   3. Helps advance the tail pointer if needed.
- *   4. Retries on CAS failure (spin-loop).
+ *   1. Atomically tries to link the chain at the tail.
+ *   2. Helps advance the tail pointer if needed.
+ *   3. Retries on CAS failure (spin-loop).
+ *
+ * The chain is linked in one CAS, however long it is. Swinging the tail to
+ * its last node may fail if another thread helped it to an earlier one;
+ * the tail then lags behind, which later operations already cope with.
  *
  * Memory ordering:
  *   - Use acquire_release to ensure visibility across threads.
  *   - Use release on tail swing to guarantee other threads see the new node.
  *
+ * The tail is protected by a hazard pointer before tail->next is read: a
+ * dequeuer on another thread may have removed it meanwhile, and only the
+ * hazard pointer keeps it from being freed under us.
+ *
  * Parameters:
  *   queue: Pointer to the queue
- *   value: Pointer value to enqueue (void*)
+ *   first: The first node of the chain
+ *   last: Its last node, whose next is NULL
  */
-void QueueEnqueue(Queue *queue, void *value)
+static void ListLink(Queue *queue, QueueNode *first, QueueNode *last)
 {
-	/* Put the value in a new node */
-    QueueNode *new_node = malloc(sizeof(QueueNode));
-    new_node->value = value;
-    // This could be overkill, since no code outside this function has access to new_node.
-    atomic_store_explicit(&new_node->next, NULL, memory_order_relaxed);
-
-    /* Atomically add the node to the queue. */
+    /* Atomically add the chain to the queue. */
     while (1) {
         QueueNode *tail = atomic_load_explicit(&queue->tail, memory_order_acquire);
-        QueueNode *next = atomic_load_explicit(&tail->next, memory_order_acquire);
+        HazardProtect(0, tail);
 
-        /* Re-check tail hasn't changed (avoid ABA). */
-        QueueNode *tail_check = atomic_load_explicit(&queue->tail, memory_order_acquire);
-        if (tail != tail_check) {
+        /* Re-check tail hasn't changed: if it has, it may be freed already. */
+        if (tail != atomic_load_explicit(&queue->tail, memory_order_seq_cst)) {
             continue;  /* Tail changed, retry. */
         }
+        QueueNode *next = atomic_load_explicit(&tail->next, memory_order_acquire);
 
         if (next == NULL) {
-            /* Try to link new_node at the end of the list. */
+            /* Try to link the chain at the end of the list. */
             if (atomic_compare_exchange_strong_explicit(
-                    &tail->next, &next, new_node,
+                    &tail->next, &next, first,
                     memory_order_release, memory_order_acquire)) {
-                /* Success: now swing tail to new_node. */
+                /* Success: now swing tail to the last node. */
                 atomic_compare_exchange_strong_explicit(
-                    &queue->tail, &tail, new_node,
+                    &queue->tail, &tail, last,
                     memory_order_release, memory_order_acquire);
+                HazardClear();
                 return;
             }
             /* CAS failed; tail->next changed, retry. */
         }
         else {
             /* Tail is lagging behind; help advance it. */
-        	// tail == tail_check && tail->next != NULL, some other thread is enqueueing.
+        	// tail was still the queue tail when re-checked, but tail->next != NULL:
+        	// another thread linked a node and has not swung the tail yet.
             atomic_compare_exchange_strong_explicit(
                 &queue->tail, &tail, next,
                 memory_order_release, memory_order_acquire);
@@ -94,15 +155,227 @@ void QueueEnqueue(Queue *queue, void *value)
 }
 
 /*
- * QueueDequeue: Remove and return the value at the front of the queue.
+ * ListEnqueue: Add a value to the queue in a new node, from this thread's
+ * node pool cache (node_pool.c), which calls malloc only once per slab.
+ *
+ * Returns: 1 if the value was enqueued, 0 if no node could be allocated.
+ */
+static int ListEnqueue(Queue *queue, const void *data, size_t size)
+{
+    QueueNode *new_node = NodePoolAlloc();
+    if (!new_node) {
+        return 0;
+    }
+    memcpy(new_node->data, data, size);
+    atomic_store_explicit(&new_node->next, NULL, memory_order_relaxed);
+    ListLink(queue, new_node, new_node);
+    return 1;
+}
+
+/*
+ * ListEnqueueBatch: Link count values into a chain of new nodes, which no
+ * other thread can see yet, and add the chain to the queue at once.
+ *
+ * Returns: 1 if the values were enqueued, 0 if not all nodes could be
+ * allocated; those already taken then go back to the pool and none of
+ * the values is enqueued.
+ */
+static int ListEnqueueBatch(Queue *queue, const unsigned char *data,
+                            size_t count, size_t size)
+{
+    QueueNode *first = NodePoolAlloc();
+    if (!first) {
+        return 0;
+    }
+    QueueNode *last = first;
+    memcpy(first->data, data, size);
+    for (size_t i = 1; i < count; ++i) {
+        QueueNode *node = NodePoolAlloc();
+        if (!node) {
+            atomic_store_explicit(&last->next, NULL, memory_order_relaxed);
+            while (first) {
+                QueueNode *next = atomic_load_explicit(&first->next,
+                                                       memory_order_relaxed);
+                NodePoolFree(first);
+                first = next;
+            }
+            return 0;
+        }
+        memcpy(node->data, data + i * size, size);
+        atomic_store_explicit(&last->next, node, memory_order_relaxed);
+        last = node;
+    }
+    atomic_store_explicit(&last->next, NULL, memory_order_relaxed);
+    ListLink(queue, first, last);
+    return 1;
+}
+
+/*
+ * RingClaim: Claim up to max consecutive slots from *position, the enqueue
+ * or dequeue position, with one CAS.
+ *
+ * A slot is ready for position p when its sequence is p + offset: offset
+ * 0 means free for an enqueuer, 1 full for a dequeuer. A first slot that
+ * is behind that is not ready yet: the queue is full or empty. One that is
+ * ahead was claimed by another thread, so we reload the position and try
+ * again.
+ *
+ * Returns: The number of slots claimed, 0 if none is ready; the first
+ * position claimed in *first.
+ */
+static size_t RingClaim(Queue *queue, _Atomic(size_t) *position,
+                        size_t offset, size_t max, size_t *first)
+{
+    size_t pos = atomic_load_explicit(position, memory_order_relaxed);
+    for (;;) {
+        size_t count = 0;
+        intptr_t diff = 0;
+        while (count < max && diff == 0) {
+            QueueSlot *slot = &queue->slots[(pos + count) & queue->mask];
+            size_t seq = atomic_load_explicit(&slot->sequence,
+                                              memory_order_acquire);
+            diff = (intptr_t)seq - (intptr_t)(pos + count + offset);
+            count += (diff == 0);
+        }
+        if (count == 0 && diff < 0) {
+            return 0;
+        }
+        if (count == 0) {
+            pos = atomic_load_explicit(position, memory_order_relaxed);
+        }
+        else if (atomic_compare_exchange_weak_explicit(
+                     position, &pos, pos + count,
+                     memory_order_relaxed, memory_order_relaxed)) {
+            *first = pos;
+            return count;
+        }
+    }
+}
+
+/*
+ * RingEnqueue: Fill as many free slots as there are, up to count.
+ *
+ * Returns: The number of values enqueued, 0 if the queue is full.
+ */
+static size_t RingEnqueue(Queue *queue, const unsigned char *data,
+                          size_t count, size_t size)
+{
+    size_t pos;
+    size_t claimed = RingClaim(queue, &queue->enqueuePos, 0, count, &pos);
+    for (size_t i = 0; i < claimed; ++i) {
+        QueueSlot *slot = &queue->slots[(pos + i) & queue->mask];
+        memcpy(slot->data, data + i * size, size);
+        /* Release: the dequeuer that sees the sequence sees the data. */
+        atomic_store_explicit(&slot->sequence, pos + i + 1,
+                              memory_order_release);
+    }
+    return claimed;
+}
+
+/*
+ * QueueTryEnqueueBytes: Add a value to the queue unless it is bounded and
+ * full. An unbounded queue always has room, unless memory runs out.
+ *
+ * Returns: 1 if the value was enqueued, 0 if the queue is full or out of
+ * memory.
+ */
+int QueueTryEnqueueBytes(Queue *queue, const void *data, size_t size)
+{
+    if (!queue->slots) {
+        return ListEnqueue(queue, data, size);
+    }
+    return RingEnqueue(queue, data, 1, size) != 0;
+}
+
+/*
+ * QueueEnqueueBytes: Add a value to the queue. A bounded queue that is
+ * full makes the caller yield until a dequeuer has made room.
+ *
+ * Returns: 1 if the value was enqueued, 0 if an unbounded queue could not
+ * allocate a node. A bounded queue needs no memory and always returns 1.
+ */
+int QueueEnqueueBytes(Queue *queue, const void *data, size_t size)
+{
+    if (!queue->slots) {
+        return ListEnqueue(queue, data, size);
+    }
+    while (RingEnqueue(queue, data, 1, size) == 0) {
+        sched_yield();
+    }
+    return 1;
+}
+
+/*
+ * QueueEnqueueBatchBytes: Add count values, stored one after the other at
+ * data, to the queue.
+ *
+ * An unbounded queue links them all with one CAS on the tail. A bounded
+ * one claims as many free slots as there are with one CAS on the enqueue
+ * position, and yields while it is full until all are enqueued.
+ *
+ * Returns: 1 if the values were enqueued, 0 if an unbounded queue could
+ * not allocate their nodes; then none of them is.
+ */
+int QueueEnqueueBatchBytes(Queue *queue, const void *data, size_t count,
+                           size_t size)
+{
+    const unsigned char *bytes = data;
+    if (count == 0) {
+        return 1;
+    }
+    if (!queue->slots) {
+        return ListEnqueueBatch(queue, bytes, count, size);
+    }
+    while (count > 0) {
+        size_t done = RingEnqueue(queue, bytes, count, size);
+        if (done == 0) {
+            sched_yield();
+        }
+        bytes += done * size;
+        count -= done;
+    }
+    return 1;
+}
+
+/*
+ * QueueEnqueue: Add a pointer to the queue.
+ */
+int QueueEnqueue(Queue *queue, void *value)
+{
+    return QueueEnqueueBytes(queue, &value, sizeof(value));
+}
+
+/*
+ * QueueTryEnqueue: Add a pointer to the queue unless it is full.
+ */
+int QueueTryEnqueue(Queue *queue, void *value)
+{
+    return QueueTryEnqueueBytes(queue, &value, sizeof(value));
+}
+
+/*
+ * QueueEnqueueBatch: Add count pointers to the queue at once.
+ */
+int QueueEnqueueBatch(Queue *queue, void *const *values, size_t count)
+{
+    return QueueEnqueueBatchBytes(queue, values, count, sizeof(*values));
+}
+
+/*
+ * ListDequeue: Remove and return the value at the front of the queue.
  *
  * Uses the Michael-Scott algorithm with safe memory reclamation:
- *   1. Load head and next pointers.
- *   2. Check head hasn't changed (avoid ABA).
- *   3. If queue is empty, return 0.
- *   4. Extract value before CAS (avoid use-after-free).
- *   5. Atomically swing head to next node.
- *   6. Free the old head (was either sentinel or previous node).
+ *   1. Load head and protect it with a hazard pointer.
+ *   2. Check head hasn't changed, so it was not freed before (1).
+ *   3. Load next and protect it too, then re-check head.
+ *   4. If queue is empty, return 0.
+ *   5. Copy the value out before CAS (next may become the head of
+ *      another dequeuer, which retires it).
+ *   6. Atomically swing head to next node.
+ *   7. Retire the old head (was either sentinel or previous node). It is
+ *      pooled once no hazard pointer holds it, so any number of threads may
+ *      dequeue at the same time, and no node is reused while a CAS may
+ *      still compare against it (no ABA).
  *
  * Memory ordering:
  *   - Use acquire_release to ensure correct visibility.
@@ -110,26 +383,32 @@ void QueueEnqueue(Queue *queue, void *value)
  *
  * Parameters:
  *   queue: Pointer to the queue
- *   out_value: Pointer to store the dequeued value
+ *   out: Where to store the dequeued value
+ *   size: Its size, as enqueued
  *
  * Returns: 1 if dequeue was successful, 0 if queue is empty.
  */
-int QueueDequeue(Queue *queue, void **out_value)
+static int ListDequeue(Queue *queue, void *out, size_t size)
 {
     while (1) {
         QueueNode *head = atomic_load_explicit(&queue->head, memory_order_acquire);
+        HazardProtect(0, head);
+        if (head != atomic_load_explicit(&queue->head, memory_order_seq_cst)) {
+            continue;  /* Head changed, retry. */
+        }
         QueueNode *tail = atomic_load_explicit(&queue->tail, memory_order_acquire);
         QueueNode *next = atomic_load_explicit(&head->next, memory_order_acquire);
+        HazardProtect(1, next);
 
-        /* Re-check head hasn't changed. */
-        QueueNode *head_check = atomic_load_explicit(&queue->head, memory_order_acquire);
-        if (head != head_check) {
+        /* Re-check head hasn't changed, so next was still linked. */
+        if (head != atomic_load_explicit(&queue->head, memory_order_seq_cst)) {
             continue;  /* Head changed, retry. */
         }
 
         if (head == tail) {
             if (next == NULL) {
                 /* Queue is empty. */
+                HazardClear();
                 return 0;
             }
             /* Tail is lagging behind; help advance it. */
@@ -139,15 +418,17 @@ int QueueDequeue(Queue *queue, void **out_value)
         }
         else {
             /* Read value BEFORE CAS (critical to avoid use-after-free). */
-            void *value = next->value;
+            unsigned char value[QUEUE_INLINE_BYTES];
+            memcpy(value, next->data, size);
 
             /* Try to swing head to next node. */
             if (atomic_compare_exchange_strong_explicit(
                     &queue->head, &head, next,
                     memory_order_release, memory_order_acquire)) {
-                /* Success: free old head and return value. */
-                free(head);
-                *out_value = value;
+                /* Success: retire old head and return value. */
+                HazardClear();
+                HazardRetire(head, NodePoolFree);
+                memcpy(out, value, size);
                 return 1;
             }
             /* CAS failed; head changed, retry. */
@@ -155,21 +436,213 @@ int QueueDequeue(Queue *queue, void **out_value)
     }
 }
 
+/*
+ * ListCollect: Copy the values of up to max nodes after head, stopping at
+ * tail, into out.
+ *
+ * The caller protects head in slot 0. Each node is protected before it is
+ * read, and then head re-checked: while head has not moved, no node after
+ * it was removed, let alone reclaimed. Nodes take slots 1 and 2 in turn,
+ * so the node whose next field we read stays protected while we protect
+ * the next one; head keeps slot 0 for the final CAS.
+ *
+ * Returns: The number of values copied, and the node of the last one in
+ * *last; 0 if head moved.
+ */
+static size_t ListCollect(Queue *queue, QueueNode *head, QueueNode *tail,
+                          unsigned char *out, size_t max, size_t size,
+                          QueueNode **last)
+{
+    QueueNode *node = head;
+    size_t count = 0;
+    while (count < max && node != tail) {
+        QueueNode *next = atomic_load_explicit(&node->next,
+                                               memory_order_acquire);
+        HazardProtect(1 + (int)(count % 2), next);
+        if (head != atomic_load_explicit(&queue->head, memory_order_seq_cst)) {
+            return 0;
+        }
+        memcpy(out + count * size, next->data, size);
+        ++count;
+        node = next;
+    }
+    *last = node;
+    return count;
+}
+
+/*
+ * ListDequeueBatch: Remove up to max values from the front of the queue,
+ * swinging head past all of them with one CAS.
+ *
+ * As in ListDequeue, head is re-checked once protected, before anything
+ * is read through it, and again after the tail is read: the tail was then
+ * read while head had not moved, so it is not behind head; values are only taken up to it, so
+ * head never passes the tail. Once the CAS succeeds the nodes between the
+ * old head and the new one are ours alone, and are retired.
+ *
+ * Returns: The number of values dequeued, 0 if the queue is empty.
+ */
+static size_t ListDequeueBatch(Queue *queue, unsigned char *out, size_t max,
+                               size_t size)
+{
+    while (1) {
+        QueueNode *head = atomic_load_explicit(&queue->head, memory_order_acquire);
+        HazardProtect(0, head);
+        if (head != atomic_load_explicit(&queue->head, memory_order_seq_cst)) {
+            continue;  /* Head changed, it may be reclaimed already; retry. */
+        }
+        QueueNode *tail = atomic_load_explicit(&queue->tail, memory_order_acquire);
+        QueueNode *next = atomic_load_explicit(&head->next, memory_order_acquire);
+        if (head != atomic_load_explicit(&queue->head, memory_order_seq_cst)) {
+            continue;  /* Head changed, retry. */
+        }
+        if (head == tail) {
+            if (next == NULL) {
+                HazardClear();
+                return 0;
+            }
+            atomic_compare_exchange_strong_explicit(
+                &queue->tail, &tail, next,
+                memory_order_release, memory_order_acquire);
+            continue;
+        }
+        QueueNode *last = NULL;
+        size_t count = ListCollect(queue, head, tail, out, max, size, &last);
+        if (count > 0 && atomic_compare_exchange_strong_explicit(
+                             &queue->head, &head, last,
+                             memory_order_release, memory_order_acquire)) {
+            HazardClear();
+            for (QueueNode *node = head; node != last; node = next) {
+                next = atomic_load_explicit(&node->next, memory_order_relaxed);
+                HazardRetire(node, NodePoolFree);
+            }
+            return count;
+        }
+    }
+}
+
+/*
+ * RingDequeue: Empty as many full slots as there are, up to max.
+ *
+ * Returns: The number of values dequeued, 0 if the queue is empty.
+ */
+static size_t RingDequeue(Queue *queue, unsigned char *out, size_t max,
+                          size_t size)
+{
+    size_t pos;
+    size_t claimed = RingClaim(queue, &queue->dequeuePos, 1, max, &pos);
+    for (size_t i = 0; i < claimed; ++i) {
+        QueueSlot *slot = &queue->slots[(pos + i) & queue->mask];
+        memcpy(out + i * size, slot->data, size);
+        /* Release: the enqueuer of the next lap sees that we are done. */
+        atomic_store_explicit(&slot->sequence, pos + i + queue->mask + 1,
+                              memory_order_release);
+    }
+    return claimed;
+}
+
+/*
+ * QueueDequeueBytes: Remove the value at the front of either kind of queue.
+ *
+ * Returns: 1 if dequeue was successful, 0 if queue is empty.
+ */
+int QueueDequeueBytes(Queue *queue, void *out, size_t size)
+{
+    return queue->slots ? RingDequeue(queue, out, 1, size) != 0
+                        : ListDequeue(queue, out, size);
+}
+
+/*
+ * QueueDequeueBatchBytes: Remove up to max values from the front of the
+ * queue into out, one after the other, in one CAS on the head or on the
+ * dequeue position.
+ *
+ * Returns: The number of values dequeued, 0 if the queue is empty.
+ */
+size_t QueueDequeueBatchBytes(Queue *queue, void *out, size_t max, size_t size)
+{
+    if (max == 0) {
+        return 0;
+    }
+    return queue->slots ? RingDequeue(queue, out, max, size)
+                        : ListDequeueBatch(queue, out, max, size);
+}
+
+/*
+ * QueueDequeueWaitBytes: Remove the value at the front of the queue,
+ * yielding while the queue is empty.
+ */
+void QueueDequeueWaitBytes(Queue *queue, void *out, size_t size)
+{
+    while (!QueueDequeueBytes(queue, out, size)) {
+        sched_yield();
+    }
+}
+
+/*
+ * QueueDequeue: Remove and return the pointer at the front of the queue.
+ *
+ * Returns: 1 if dequeue was successful, 0 if queue is empty.
+ */
+int QueueDequeue(Queue *queue, void **out_value)
+{
+    return QueueDequeueBytes(queue, out_value, sizeof(*out_value));
+}
+
+/*
+ * QueueDequeueWait: Remove the pointer at the front of the queue, waiting
+ * for one if needed.
+ */
+void QueueDequeueWait(Queue *queue, void **out_value)
+{
+    QueueDequeueWaitBytes(queue, out_value, sizeof(*out_value));
+}
+
+/*
+ * QueueDequeueBatch: Remove up to max pointers from the queue at once.
+ *
+ * Returns: The number of pointers dequeued, 0 if the queue is empty.
+ */
+size_t QueueDequeueBatch(Queue *queue, void **out_values, size_t max)
+{
+    return QueueDequeueBatchBytes(queue, out_values, max, sizeof(*out_values));
+}
+
 /*
  * QueueIsEmpty: Check if the queue is empty without removing elements.
  *
+ * A bounded queue is empty when the slot at the dequeue position is not
+ * full for it yet, as in RingClaim.
+ *
  * Returns: 1 if empty, 0 if not empty.
  */
 int QueueIsEmpty(Queue *queue)
 {
-    QueueNode *head = atomic_load_explicit(&queue->head, memory_order_acquire);
+    if (queue->slots) {
+        size_t pos = atomic_load_explicit(&queue->dequeuePos,
+                                          memory_order_relaxed);
+        size_t seq = atomic_load_explicit(
+            &queue->slots[pos & queue->mask].sequence, memory_order_acquire);
+        return (intptr_t)seq - (intptr_t)(pos + 1) < 0;
+    }
+
+    QueueNode *head;
+    do {
+        head = atomic_load_explicit(&queue->head, memory_order_acquire);
+        HazardProtect(0, head);
+    } while (head != atomic_load_explicit(&queue->head, memory_order_seq_cst));
     QueueNode *next = atomic_load_explicit(&head->next, memory_order_acquire);
+    HazardClear();
     return next == NULL;
 }
 
 /*
  * QueueDestroy: Free all allocated memory for the queue.
  *
+ * No other thread may use the queue any more. Nodes it retired earlier are
+ * reclaimed too, together with those of other queues that no thread
+ * protects.
+ *
  * Parameters:
  *   queue: Pointer to the queue to destroy
  */
@@ -184,9 +657,11 @@ void QueueDestroy(Queue *queue)
     while (current) {
         QueueNode *next = atomic_load_explicit(&current->next,
                                                memory_order_relaxed);
-        free(current);
+        NodePoolFree(current);
         current = next;
     }
 
+    free(queue->slots);
     free(queue);
+    HazardDrain();
 }
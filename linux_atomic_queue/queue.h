@@ -1,39 +1,168 @@
 #ifndef QUEUE_H
 #define QUEUE_H
 
+#include <stddef.h>
 #include <stdint.h>
 #include <stdatomic.h>
 
 // See https://www.cs.rochester.edu/u/scott/papers/1996_PODC_queues.pdf
 // for the Michael Scott and Maged M. Michael lock-free queue algorithm.
+// The bounded queue is Dmitry Vyukov's bounded MPMC queue.
 
-/* Lock-free queue node structure for holding integer data. */
+/* Bytes a node holds inline: enough for the consumer messages in shared.h. */
+#define QUEUE_INLINE_BYTES 32
+
+/* Lock-free queue node structure. The value is copied into the node, so
+   small values need no allocation of their own. */
 typedef struct QueueNode
 {
-    void* value;
+    union {
+        void* value;                             /* QueueEnqueue */
+        unsigned char data[QUEUE_INLINE_BYTES];  /* QueueEnqueueBytes */
+    };
     _Atomic(struct QueueNode*) next;
 } QueueNode;
 
-/* Lock-free queue structure using atomic operations for synchronization. */
+/* Assumed size of a cache line, to keep the ring positions apart. */
+#define QUEUE_CACHE_LINE 64
+
+/* Lock-free queue structure using atomic operations for synchronization.
+   Any number of threads may enqueue and dequeue at the same time.
+
+   An unbounded queue is a linked list of nodes; removed nodes are
+   reclaimed through hazard pointers (hazard.c). A bounded queue is a ring
+   of slots, each with a sequence number that says whether it is free for
+   the enqueuer at a position or full for the dequeuer at it. */
 typedef struct
 {
+    /* Unbounded queue. */
     _Atomic(QueueNode*) head;
     _Atomic(QueueNode*) tail;
+
+    /* Bounded queue; slots is NULL for an unbounded one. */
+    struct QueueSlot* slots;
+    size_t mask;  /* capacity - 1 */
+    _Alignas(QUEUE_CACHE_LINE) _Atomic(size_t) enqueuePos;
+    _Alignas(QUEUE_CACHE_LINE) _Atomic(size_t) dequeuePos;
 } Queue;
 
-/* Initialize a lock-free queue. */
+/* Initialize an unbounded lock-free queue. */
 Queue* QueueCreate(void);
 
-/* Enqueue a value into the queue atomically. */
-void QueueEnqueue(Queue* queue, void* value);
+/* Initialize a bounded lock-free queue that holds up to capacity values,
+   rounded up to a power of two. Returns NULL if out of memory or if
+   capacity exceeds SIZE_MAX / 2 / sizeof(QueueSlot). */
+Queue* QueueCreateBounded(size_t capacity);
+
+/* Enqueue a value into the queue atomically. Waits while the queue is full.
+   Returns 1 if successful, 0 if an unbounded queue is out of memory. */
+int QueueEnqueue(Queue* queue, void* value);
+
+/* Enqueue a value if there is room. Returns 1 if successful, 0 if full or
+   out of memory. */
+int QueueTryEnqueue(Queue* queue, void* value);
 
 /* Dequeue a value from the queue atomically. Returns 1 if successful, 0 if empty. */
 int QueueDequeue(Queue* queue, void** out_value);
 
+/* Dequeue a value, waiting while the queue is empty. */
+void QueueDequeueWait(Queue* queue, void** out_value);
+
+/* Enqueue a copy of size bytes at data; size is at most QUEUE_INLINE_BYTES.
+   Waits while the queue is full. Returns 1 if successful, 0 if an
+   unbounded queue is out of memory; a bounded one never is. */
+int QueueEnqueueBytes(Queue* queue, const void* data, size_t size);
+
+/* As QueueEnqueueBytes, but returns 0 at once if the queue is full, 1 if
+   the value was enqueued. */
+int QueueTryEnqueueBytes(Queue* queue, const void* data, size_t size);
+
+/* Dequeue size bytes into out. Returns 1 if successful, 0 if empty. The
+   size must be the one the value was enqueued with. */
+int QueueDequeueBytes(Queue* queue, void* out, size_t size);
+
+/* As QueueDequeueBytes, but waits while the queue is empty. */
+void QueueDequeueWaitBytes(Queue* queue, void* out, size_t size);
+
+/* Enqueue count values, stored one after the other at data, at once: one
+   CAS links them all to an unbounded queue, and one claims as many slots
+   of a bounded queue as are free. Waits while the queue is full. Returns 1
+   if successful, 0 if an unbounded queue is out of memory, in which case
+   none of the values is enqueued. */
+int QueueEnqueueBatchBytes(Queue* queue, const void* data, size_t count,
+                           size_t size);
+
+/* Dequeue up to max values into out, one after the other, at once.
+   Returns the number dequeued, 0 if the queue is empty. */
+size_t QueueDequeueBatchBytes(Queue* queue, void* out, size_t max, size_t size);
+
+/* QueueEnqueueBatchBytes and QueueDequeueBatchBytes for pointers. */
+int QueueEnqueueBatch(Queue* queue, void* const* values, size_t count);
+size_t QueueDequeueBatch(Queue* queue, void** out_values, size_t max);
+
 /* Check if queue is empty. */
 int QueueIsEmpty(Queue* queue);
 
 /* Free the queue and all nodes. */
 void QueueDestroy(Queue* queue);
 
+/*
+ * QUEUE_DEFINE_TYPED: Define Name, a queue of Type values stored inline in
+ * the nodes or slots, with NameCreate, NameCreateBounded, NameEnqueue,
+ * NameTryEnqueue, NameEnqueueBatch, NameDequeue, NameDequeueWait,
+ * NameDequeueBatch, NameIsEmpty and NameDestroy. For example, QUEUE_DEFINE_TYPED(NumberQueue, int32_t) gives
+ * NumberQueueEnqueue(NumberQueue* queue, int32_t value).
+ *
+ * Name is an opaque handle to a Queue; the compiler keeps queues of
+ * different types apart, and Type must fit in QUEUE_INLINE_BYTES.
+ */
+#define QUEUE_DEFINE_TYPED(Name, Type)                                      \
+    _Static_assert(sizeof(Type) <= QUEUE_INLINE_BYTES,                      \
+                   #Type " does not fit in a queue node");                  \
+    typedef struct Name Name;                                               \
+    static inline Name* Name##Create(void)                                  \
+    {                                                                       \
+        return (Name*)QueueCreate();                                        \
+    }                                                                       \
+    static inline Name* Name##CreateBounded(size_t capacity)                \
+    {                                                                       \
+        return (Name*)QueueCreateBounded(capacity);                         \
+    }                                                                       \
+    static inline int Name##Enqueue(Name* queue, Type value)                \
+    {                                                                       \
+        return QueueEnqueueBytes((Queue*)queue, &value, sizeof(Type));      \
+    }                                                                       \
+    static inline int Name##TryEnqueue(Name* queue, Type value)             \
+    {                                                                       \
+        return QueueTryEnqueueBytes((Queue*)queue, &value, sizeof(Type));   \
+    }                                                                       \
+    static inline int Name##EnqueueBatch(Name* queue, const Type* values,   \
+                                         size_t count)                      \
+    {                                                                       \
+        return QueueEnqueueBatchBytes((Queue*)queue, values, count,         \
+                                      sizeof(Type));                        \
+    }                                                                       \
+    static inline int Name##Dequeue(Name* queue, Type* out_value)           \
+    {                                                                       \
+        return QueueDequeueBytes((Queue*)queue, out_value, sizeof(Type));   \
+    }                                                                       \
+    static inline void Name##DequeueWait(Name* queue, Type* out_value)      \
+    {                                                                       \
+        QueueDequeueWaitBytes((Queue*)queue, out_value, sizeof(Type));      \
+    }                                                                       \
+    static inline size_t Name##DequeueBatch(Name* queue, Type* out_values,  \
+                                            size_t max)                     \
+    {                                                                       \
+        return QueueDequeueBatchBytes((Queue*)queue, out_values, max,       \
+                                      sizeof(Type));                        \
+    }                                                                       \
+    static inline int Name##IsEmpty(Name* queue)                            \
+    {                                                                       \
+        return QueueIsEmpty((Queue*)queue);                                 \
+    }                                                                       \
+    static inline void Name##Destroy(Name* queue)                           \
+    {                                                                       \
+        QueueDestroy((Queue*)queue);                                        \
+    }
+
 #endif /* QUEUE_H */
@@ -13,6 +13,12 @@ typedef struct
     _Atomic(int) producerFinished;  /* Flag: producer has finished */
 } ProducerState;
 
+/* Most values a thread sends or takes from a queue at once. */
+#define QUEUE_BATCH 64
+
+/* Queue of the numbers the producer sends to each consumer. */
+QUEUE_DEFINE_TYPED(NumberQueue, int32_t)
+
 /* Atomic counter tracking numbers enqueued but not yet processed by consumers. */
 extern _Atomic(int32_t) inFlightCount;
 
@@ -32,11 +38,15 @@ typedef struct ConsumerBMessage
     struct timespec sendTime;  /* Time when message was created. */
 } ConsumerBMessage;
 
+/* Queues of consumer messages, copied into the queue nodes. */
+QUEUE_DEFINE_TYPED(MessageQueueA, ConsumerAMessage)
+QUEUE_DEFINE_TYPED(MessageQueueB, ConsumerBMessage)
+
 /* Shared result queue for consumer A messages. */
-extern Queue* resultQueueA;
+extern MessageQueueA* resultQueueA;
 
 /* Shared result queue for consumer B messages. */
-extern Queue* resultQueueB;
+extern MessageQueueB* resultQueueB;
 
 /* Shared producer state. */
 extern ProducerState producerState;
@@ -0,0 +1,252 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+#include "queue.h"
+
+/*
+ * Stress test of the queue with several producers and consumers, using the
+ * batch and the single-value operations on both kinds of queue.
+ *
+ * Two phases per queue:
+ *   - Recirculate: every thread dequeues a batch of tokens and enqueues it
+ *     again, many times over. With few tokens the same nodes are removed,
+ *     retired, pooled and reused all the time, which is what hazard
+ *     pointers must survive. Afterwards every token must be there once.
+ *   - Transfer: producers enqueue increasing numbers, consumers dequeue
+ *     them; each number must arrive once, and in order per producer.
+ */
+
+QUEUE_DEFINE_TYPED(TokenQueue, int64_t)
+
+#define THREADS 4
+#define TOKENS 6
+#define ROUNDS 50000
+#define TRANSFER_COUNT 100000
+#define MAX_BATCH 8
+#define RING_CAPACITY 16
+
+static TokenQueue* queue;
+static _Atomic(int) producersLeft;
+static _Atomic(int64_t) received;
+static _Atomic(int) failed;
+
+/*
+ * NextRandom: A small xorshift generator, one state per thread.
+ */
+static uint32_t NextRandom(uint32_t* state)
+{
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+/*
+ * Take: Dequeue up to max tokens, one at a time or as a batch.
+ *
+ * Returns: The number of tokens dequeued.
+ */
+static size_t Take(int64_t* tokens, size_t max, uint32_t* seed)
+{
+    if (max == 1 || NextRandom(seed) % 4 == 0) {
+        return (size_t)TokenQueueDequeue(queue, tokens);
+    }
+    return TokenQueueDequeueBatch(queue, tokens, max);
+}
+
+/*
+ * OutOfMemory: Give up; a lost value would fail the checks anyway.
+ */
+static void OutOfMemory(void)
+{
+    fprintf(stderr, "Error: Out of memory for queue nodes\n");
+    exit(EXIT_FAILURE);
+}
+
+/*
+ * Give: Enqueue tokens, one at a time or as a batch.
+ */
+static void Give(const int64_t* tokens, size_t count, uint32_t* seed)
+{
+    if (NextRandom(seed) % 4 == 0) {
+        for (size_t i = 0; i < count; ++i) {
+            if (!TokenQueueEnqueue(queue, tokens[i])) {
+                OutOfMemory();
+            }
+        }
+    }
+    else if (!TokenQueueEnqueueBatch(queue, tokens, count)) {
+        OutOfMemory();
+    }
+}
+
+static void* RecirculateThread(void* arg)
+{
+    uint32_t seed = (uint32_t)(uintptr_t)arg * 2654435761u + 1;
+    int64_t tokens[MAX_BATCH];
+    for (int round = 0; round < ROUNDS; ++round) {
+        size_t max = 1 + NextRandom(&seed) % MAX_BATCH;
+        size_t count = Take(tokens, max, &seed);
+        if (count == 0) {
+            sched_yield();
+            continue;
+        }
+        Give(tokens, count, &seed);
+    }
+    return NULL;
+}
+
+/*
+ * CheckTokens: Drain the queue and check every token is there once.
+ */
+static int CheckTokens(void)
+{
+    int seen[TOKENS] = { 0 };
+    int64_t token;
+    while (TokenQueueDequeue(queue, &token)) {
+        if (token < 0 || token >= TOKENS || seen[token]++) {
+            fprintf(stderr, "Token %lld lost or duplicated\n", (long long)token);
+            return 0;
+        }
+    }
+    for (int i = 0; i < TOKENS; ++i) {
+        if (!seen[i]) {
+            fprintf(stderr, "Token %d lost\n", i);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void* ProducerThread(void* arg)
+{
+    int64_t producer = (int64_t)(intptr_t)arg;
+    uint32_t seed = (uint32_t)producer * 40503u + 7;
+    int64_t values[MAX_BATCH];
+    int64_t next = 0;
+    while (next < TRANSFER_COUNT) {
+        size_t count = 1 + NextRandom(&seed) % MAX_BATCH;
+        size_t n = 0;
+        for (; n < count && next < TRANSFER_COUNT; ++n, ++next) {
+            values[n] = producer * TRANSFER_COUNT + next;
+        }
+        Give(values, n, &seed);
+    }
+    atomic_fetch_sub(&producersLeft, 1);
+    return NULL;
+}
+
+/*
+ * ConsumerThread: Check that the values of each producer arrive in order.
+ */
+static void* ConsumerThread(void* arg)
+{
+    uint32_t seed = (uint32_t)(uintptr_t)arg * 69069u + 3;
+    int64_t last[THREADS];
+    for (int i = 0; i < THREADS; ++i) {
+        last[i] = -1;
+    }
+    int64_t values[MAX_BATCH];
+    for (;;) {
+        int done = atomic_load(&producersLeft) == 0;
+        size_t count = Take(values, 1 + NextRandom(&seed) % MAX_BATCH, &seed);
+        if (count == 0) {
+            if (done) {
+                break;
+            }
+            sched_yield();
+        }
+        for (size_t i = 0; i < count; ++i) {
+            int64_t producer = values[i] / TRANSFER_COUNT;
+            int64_t index = values[i] % TRANSFER_COUNT;
+            if (producer < 0 || producer >= THREADS || index <= last[producer]) {
+                atomic_store(&failed, 1);
+            }
+            else {
+                last[producer] = index;
+            }
+        }
+        atomic_fetch_add(&received, (int64_t)count);
+    }
+    return NULL;
+}
+
+/*
+ * RunThreads: Start count threads on entry, numbered from first.
+ */
+static void RunThreads(void* (*entry)(void*), int first, int count,
+                       pthread_t* threads)
+{
+    for (int i = 0; i < count; ++i) {
+        if (pthread_create(&threads[i], NULL, entry,
+                           (void*)(intptr_t)(first + i)) != 0) {
+            perror("Error creating thread");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+static int RunQueue(const char* name)
+{
+    pthread_t threads[THREADS];
+
+    for (int64_t i = 0; i < TOKENS; ++i) {
+        if (!TokenQueueEnqueue(queue, i)) {
+            OutOfMemory();
+        }
+    }
+    RunThreads(RecirculateThread, 0, THREADS, threads);
+    for (int i = 0; i < THREADS; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+    int ok = CheckTokens();
+
+    atomic_store(&producersLeft, THREADS / 2);
+    atomic_store(&received, 0);
+    atomic_store(&failed, 0);
+    RunThreads(ProducerThread, 0, THREADS / 2, threads);
+    RunThreads(ConsumerThread, 0, THREADS / 2, threads + THREADS / 2);
+    for (int i = 0; i < THREADS; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+    int64_t expected = (int64_t)(THREADS / 2) * TRANSFER_COUNT;
+    if (atomic_load(&failed) || atomic_load(&received) != expected
+        || !TokenQueueIsEmpty(queue)) {
+        fprintf(stderr, "%s: %lld of %lld values received, in order: %s\n",
+                name, (long long)atomic_load(&received), (long long)expected,
+                atomic_load(&failed) ? "no" : "yes");
+        ok = 0;
+    }
+    printf("%s: %s\n", name, ok ? "ok" : "FAILED");
+    return ok;
+}
+
+int main(void)
+{
+    int ok = 1;
+
+    queue = TokenQueueCreate();
+    if (!queue) {
+        fprintf(stderr, "Error: Failed to create queue\n");
+        return EXIT_FAILURE;
+    }
+    ok &= RunQueue("unbounded");
+    TokenQueueDestroy(queue);
+
+    queue = TokenQueueCreateBounded(RING_CAPACITY);
+    if (!queue) {
+        fprintf(stderr, "Error: Failed to create queue\n");
+        return EXIT_FAILURE;
+    }
+    ok &= RunQueue("bounded");
+    TokenQueueDestroy(queue);
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
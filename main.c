@@ -1,221 +1,1770 @@
 /*
 A multithreaded C program that:
-- Reads a text file specified on the command line
+- Reads a text file specified on the command line, or standard input for "-"
 - Distributes lines to three per-thread queues in round-robin order
 - Thread 1 counts words, Thread 2 counts characters, Thread 3 counts vowels (1/3 of lines each)
 - Prints totals for each at the end
 
+Regular files are memory-mapped and the workers receive (pointer, length)
+views into the mapping, so no line is copied. Inputs that cannot be mapped
+(pipes, devices, "-") are read by a dedicated thread into a small pool of
+large buffers (stream_reader.c, --read-size) while the previous buffer is
+being split and counted; workers get views into those buffers too, and a
+buffer goes back to the pool once all its lines are counted.
+
+The counters run on SSE2/AVX2/AVX-512 kernels picked at startup by CPUID
+(see count_kernels.c); --kernel forces one, and --self-check compares every
+kernel against the scalar reference on the given input. By default text is
+bytes in the "C" locale; --utf8 counts code points instead of bytes, splits
+words on Unicode whitespace and reports ill-formed UTF-8 sequences, on the
+same vector kernels.
+
+With -j N the fixed three-thread design is replaced by a data-parallel one:
+the mapped file is cut into N byte ranges aligned to line starts, each of N
+threads counts words, chars, vowels and lines of its range in one fused pass,
+and the partial totals are summed. Workers keep halving their range and
+push the upper halves onto their own Chase-Lev deque (ws_deque.c); a worker
+that runs out of work steals from the others, so a range that is slow to
+count (cold pages, a busy core) does not leave the rest idle. -v reports
+each worker's busy and idle time. Unlike the round-robin mode, where each
+metric covers a third of the lines, -j reports totals over the whole file
+(-j 1 is the sequential baseline).
+
+Given several inputs, a directory (counted recursively) or a quoted glob
+pattern, the program counts them all as a batch (file_batch.c): one pool of
+-j threads (one per CPU by default) lives for the whole batch, files are cut
+into 4 MB pieces handed out largest first, so that small files fill in
+around the large ones, and every file gets -j style totals, followed by the
+grand totals.
+
+--top K also ranks the words of the file (word_freq.c): every -j worker
+counts the words of its ranges into its own hash table, the tables are
+merged shard by shard on all threads and the K most frequent words are
+printed after the totals. Past --top-memory the tables turn into count-min
+sketches that keep only the likely top words by name, and the counts
+printed become estimates with an error bound.
+
+--distinct estimates the number of different words with HyperLogLog
+(hll.c), in the -j and batch modes: every worker adds the words it scans
+to its own sketch of 2^p one-byte registers (16 KB by default, for a 0.81%
+standard error; --distinct=PCT picks the size for another error), and the
+sketches are merged at the end. Batch mode reports it per file.
+
+--patterns FILE counts every fixed string of FILE (one per line, e.g. error
+codes or host names) in the same pass, so the file is not read again by
+grep (pattern_set.c): the -j and batch workers scan each range for all
+patterns right after counting it, with the Teddy SIMD prefilter for up to
+64 patterns and an Aho-Corasick DFA for more. Overlapping occurrences
+count, and batch mode reports totals over all files.
+
+--index keeps the counts of every 16 MB chunk of the file in a sidecar
+<file>.lcidx (count_index.c), keyed by inode, size and mtime and with a hash
+per chunk. The next run reuses the chunks that did not change and counts
+only the rest, so recounting an append-only log costs about as much as
+counting what was appended. Totals are whole-file, as with -j.
+
+--follow keeps the three workers and their queues running on a file that
+keeps growing, like tail -f: the reader thread waits with inotify for
+appends, reads only the new bytes, holds back a partial last line until it
+is complete, and starts over when the file is truncated or the path is
+rotated. Running totals are printed every --interval seconds, the final
+ones on SIGINT or SIGTERM.
+
+gzip and zstd input (.gz, .zst, or anything starting with their magic
+bytes, also a pipe on stdin) is decoded on the fly (decompress.c) and fed to the round-robin
+workers through the stream reader, so decoding overlaps with counting.
+bgzip and pzstd files, made of many independent members that record their
+sizes, are decoded on one thread per CPU in parallel; other files, and
+those with a member too large for a parallel task, on the reader thread. In batch mode every compressed file is one task, decoded
+and counted by the worker that takes it.
+
+--stats writes a JSON line about the round-robin pipeline at exit and on
+every SIGUSR1: per queue the enqueues, maximum and average depth and the
+time either side slept; per worker the lines and bytes counted and the rate
+while busy; for pipes the read buffer pool waits and lock contention. The
+counters are single-writer relaxed atomics updated per block or per sleep;
+build with -DLC_STATS=0 to compile them out (lc_stats.h).
+
+A line that does not fit the stream reader's headroom normally gets a
+buffer of its own, so a 4 GB line in a pipe costs several GB. --bounded
+hands it to its worker in pieces instead, cut where no UTF-8 sequence is
+split; the worker carries the word that runs across each cut to the next
+piece, so the counts are the same and memory stays within the read
+buffers and the queues of views, whatever the line length. Mapped files
+never copy a line and need no such mode.
+
+--dispatch picks the queue of each line in the round-robin mode
+(line_dispatch.c): rr cycles through them whatever the line length; least
+sends a line to the worker with the fewest bytes still to count and p2c to
+the less loaded of two picked at random, so that one very long line does
+not leave a worker behind while the others idle. -v and --stats report the bytes each worker
+got and the imbalance (largest share over the mean, minus one). The
+metrics still cover the lines their worker got, which with least and p2c
+depend on timing.
+
+In the round-robin mode the reader batches lines into blocks (1024 lines or
+64 KB by default, see --block-lines/--block-bytes) and each queue operation
+moves a whole block. The queues are bounded lock-free SPSC rings
+(spsc_ring.c) of --queue-depth blocks: when a worker falls behind the reader
+sleeps instead of buffering the rest of the file. -v reports the queue
+operations saved by batching and how often each side had to sleep.
+
 Compile:
-  gcc -std=gnu11 -pthread -o line_counters main.c
+  gcc -std=gnu11 -O2 -pthread -o line_counters main.c mapped_file.c \
+      count_kernels.c spsc_ring.c line_arena.c line_dispatch.c \
+      stream_reader.c ws_deque.c \
+      file_batch.c count_index.c decompress.c word_freq.c hll.c pattern_set.c -lm \
+      -DLC_HAVE_ZLIB -lz
+  (add -DLC_HAVE_ZSTD -lzstd for zstd input)
 Run:
   ./line_counters input.txt
+  ./line_counters --kernel scalar input.txt
+  ./line_counters --self-check input.txt
+  ./line_counters --dispatch least -v input.txt
+  ./line_counters -j 8 input.txt
+  ./line_counters --top 20 app.log
+  ./line_counters --distinct=0.5 /var/log/app
+  ./line_counters --patterns codes.txt -j 8 app.log
+  ./line_counters --index app.log
+  ./line_counters --follow --interval 10 app.log
+  ./line_counters /var/log/app 'archive/app.*.log'
+  ./line_counters input.txt.gz
+  zcat input.txt.gz | ./line_counters -
+  zcat dump.json.gz | ./line_counters --bounded -
 */
 
+#define _GNU_SOURCE /* memrchr */
 #include <sys/types.h>
+#include <sys/signalfd.h>
+#include <sys/stat.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdatomic.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <pthread.h> // E:\Users\User\vcpkg\packages\pthreads_x64-windows\include
-#include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <unistd.h>
+#include "count_index.h"
+#include "count_kernels.h"
+#include "decompress.h"
+#include "lc_stats.h"
+#include "file_batch.h"
+#include "hll.h"
+#include "line_arena.h"
+#include "line_dispatch.h"
+#include "mapped_file.h"
+#include "pattern_set.h"
+#include "spsc_ring.h"
+#include "stream_reader.h"
+#include "word_freq.h"
+#include "ws_deque.h"
+
+/* A line handed to a worker: a view into the mapped input or into one of
+   the stream reader's buffers. */
+typedef struct {
+    const char* data;
+    size_t len;          /* bytes, including the trailing '\n' if present */
+    line_slab_t* slab;   /* buffer to release once counted, NULL if mapped */
+    unsigned piece;      /* LINE_* flags if this is not a whole line */
+} line_t;
 
-/* Simple linked queue holding char* lines (NULL line is sentinel) */
-typedef struct node {
-	// To make it generic, we could have void* data.
-    char* line;
-    struct node* next;
-} node_t;
+/* --bounded: a line too long for the read buffers comes in pieces, all
+   sent to the same worker one after the other. */
+#define LINE_CONTINUES 1u  /* the line goes on in the next view */
+#define LINE_CONTINUED 2u  /* continues the worker's previous view */
 
-// Function main() adds nodes to the queue, worker_thread() removes them.
-// As a result, we need to ensure thread safety with mutexes and condition variables.
+/* A batch of lines moved through a queue with a single operation.
+   A block with count == 0 is the end-of-stream sentinel. */
 typedef struct {
-    node_t* head;
-    node_t* tail;
-    pthread_mutex_t mutex;
-	// A pthread condition variable is roughly similar to a Windows event object.
-    pthread_cond_t cond_input_is_available;
-} queue_t;
-
-// In C we don't have constructors/destructors, so we need init/destroy functions.
-// We also use static functions to limit their scope to this file and avoid name clashes.
-static void queue_init(queue_t* q) {
-    q->head = q->tail = NULL;
-    // Default attributes are fine.
-    pthread_mutex_init(&q->mutex, NULL);
-    pthread_cond_init(&q->cond_input_is_available, NULL);
-}
-
-static void queue_destroy(queue_t* q) {
-    pthread_mutex_destroy(&q->mutex);
-    pthread_cond_destroy(&q->cond_input_is_available);
-}
-
-/* Enqueue a line (can be NULL as end-of-stream sentinel) */
-static int queue_enqueue(queue_t* q, char* line) {
-	// Allocate new node and initialize it
-    node_t* n = malloc(sizeof(node_t));
-    if (!n) return -1;
-    n->line = line;
-    n->next = NULL;
-
-	// Thread-safe enqueue operation (add to tail)
-    pthread_mutex_lock(&q->mutex);
-    if (q->tail) {
-        q->tail->next = n;
-        q->tail = n;
+    size_t count;
+    size_t bytes;     /* sum of lines[i].len, to cap the block size */
+    line_t lines[];   /* room for the configured lines per block */
+} line_block_t;
+
+// Function main() pushes blocks into each worker's ring, worker_thread() pops
+// them. Each ring has exactly one producer and one consumer, which is what
+// lets spsc_ring_t work without a mutex.
+#define DEFAULT_QUEUE_DEPTH 16
+
+/* Thread argument */
+typedef struct {
+    spsc_ring_t* queue;
+	// Mode could be a function pointer, but this is simpler
+    int mode; /* 1 = words, 2 = chars, 3 = vowels */
+    const count_kernels_t* kernels;
+    unsigned long long invalid; /* ill-formed UTF-8 in this worker's lines */
+    // Published after every block for the running totals of --follow.
+    _Atomic unsigned long long progress; /* this worker's metric so far */
+    _Atomic unsigned long long lines;    /* lines counted so far */
+    _Atomic unsigned long long done;     /* bytes counted so far, for the
+                                            byte-aware --dispatch */
+    // --stats: throughput; busy time is the run time minus the pops that
+    // slept (queue->pop_wait_ns).
+    lc_stat_t bytes;
+    lc_stat_t start_ns;
+    lc_stat_t end_ns;   /* 0 while running */
+} worker_arg_t;
+
+/* --bounded: 1 if a word runs across the cut between two pieces of a line,
+   so that it was counted in both. tail is the last code point of the first
+   piece (its last byte in byte mode) and s the second piece; as pieces are
+   never cut inside a UTF-8 sequence, counting the words of tail, of the
+   first code point of s and of both together tells. */
+static size_t word_across(const count_kernels_t* k, const char* tail,
+                          size_t tailLen, const char* s, size_t len) {
+    size_t head = 1;
+    while (head < len && head < 4 && ((unsigned char)s[head] & 0xc0) == 0x80) {
+        ++head;
     }
-    else {
-        q->head = q->tail = n;
+    char both[8];
+    memcpy(both, tail, tailLen);
+    memcpy(both + tailLen, s, head);
+    return k->words(tail, tailLen) + k->words(s, head)
+        - k->words(both, tailLen + head);
+}
+
+static void* worker_thread(void* arg) {
+    worker_arg_t* w = (worker_arg_t*)arg;
+    unsigned long long total = 0ULL;
+    char tail[4];        /* --bounded: end of the previous piece */
+    size_t tail_len = 0;
+    LC_STAT_ADD(w->start_ns, lc_stat_now_ns());
+
+    while (1) {
+        line_block_t* block;
+        spsc_ring_pop(w->queue, &block);
+        if (block->count == 0) { /* sentinel => no more data */
+            free(block);
+            break;
+        }
+
+        // Consecutive lines usually share a slab: release them in one step.
+        line_slab_t* slab = NULL;
+        size_t slab_lines = 0;
+        size_t lines = 0;
+        for (size_t i = 0; i < block->count; ++i) {
+            const line_t* line = &block->lines[i];
+            size_t c = 0;
+            if (w->mode == 1) {
+                c = w->kernels->words(line->data, line->len);
+                if (line->piece & LINE_CONTINUED) {
+                    c -= word_across(w->kernels, tail, tail_len, line->data,
+                                     line->len);
+                }
+                if (line->piece & LINE_CONTINUES) {
+                    // Its last code point: from the last byte that is not
+                    // a continuation byte, if one is among the last four.
+                    tail_len = 1;
+                    for (size_t k = 1; k <= 4 && k <= line->len; ++k) {
+                        if (((unsigned char)line->data[line->len - k] & 0xc0)
+                            != 0x80) {
+                            tail_len = k;
+                            break;
+                        }
+                    }
+                    memcpy(tail, line->data + line->len - tail_len, tail_len);
+                }
+            }
+            else if (w->mode == 2) c = w->kernels->chars(line->data, line->len);
+            else if (w->mode == 3) c = w->kernels->vowels(line->data, line->len);
+            if (w->kernels->invalid) {
+                w->invalid += w->kernels->invalid(line->data, line->len);
+            }
+
+            total += c;
+            lines += !(line->piece & LINE_CONTINUED);
+            if (line->slab != slab) {
+                if (slab) line_slab_release(slab, slab_lines);
+                slab = line->slab;
+                slab_lines = 0;
+            }
+            ++slab_lines;
+        }
+        if (slab) line_slab_release(slab, slab_lines);
+        atomic_store_explicit(&w->progress, total, memory_order_relaxed);
+        atomic_fetch_add_explicit(&w->lines, lines, memory_order_relaxed);
+        atomic_fetch_add_explicit(&w->done, block->bytes,
+                                  memory_order_relaxed);
+        LC_STAT_ADD(w->bytes, block->bytes);
+        free(block);
     }
-	pthread_cond_signal(&q->cond_input_is_available); // Notify consumer thread
-    pthread_mutex_unlock(&q->mutex);
+    LC_STAT_ADD(w->end_ns, lc_stat_now_ns());
+
+    unsigned long long* ret = malloc(sizeof(unsigned long long));
+    if (!ret) pthread_exit(NULL);
+    *ret = total;
+    return ret;
+}
+
+/* Default batch limits: a block is handed over when either is reached. */
+#define DEFAULT_BLOCK_LINES 1024
+#define DEFAULT_BLOCK_BYTES (64 * 1024)
+
+/* Reader side of the round-robin mode: one partly filled block per queue. */
+typedef struct {
+    spsc_ring_t* queues;
+    line_block_t* pending[3];
+    line_block_t* sentinels[3]; /* end-of-stream blocks, allocated up front */
+    size_t block_lines;
+    size_t block_bytes;
+    line_dispatch_t route;      /* --dispatch: picks the queue of each line */
+    int last;                   /* queue of the previous line */
+    unsigned long long lines;
+    unsigned long long pieces;  /* --bounded: views that continue a line */
+    unsigned long long batches; /* blocks pushed */
+    lc_stat_t lines_out;        /* --stats: lines and bytes in pushed blocks */
+    lc_stat_t bytes_out;
+} dispatcher_t;
+
+static line_block_t* block_new(size_t capacity) {
+    line_block_t* b = malloc(sizeof(line_block_t) + capacity * sizeof(line_t));
+    if (!b) return NULL;
+    b->count = 0;
+    b->bytes = 0;
+    return b;
+}
+
+/* Returns 0, or -1 if the end-of-stream blocks cannot be allocated. They
+   are allocated first so that the workers can always be stopped, even
+   once memory has run out. */
+static int dispatcher_init(dispatcher_t* d, spsc_ring_t* queues,
+                           worker_arg_t* workers, dispatch_policy_t policy,
+                           size_t blockLines, size_t blockBytes) {
+    d->queues = queues;
+    const _Atomic unsigned long long* done[3];
+    for (int i = 0; i < 3; ++i) {
+        d->pending[i] = NULL;
+        d->sentinels[i] = block_new(0);
+        done[i] = &workers[i].done;
+    }
+    if (!d->sentinels[0] || !d->sentinels[1] || !d->sentinels[2]) {
+        for (int i = 0; i < 3; ++i) free(d->sentinels[i]);
+        return -1;
+    }
+    d->block_lines = blockLines;
+    d->block_bytes = blockBytes;
+    line_dispatch_init(&d->route, policy, 3, done);
+    d->last = 0;
+    d->pieces = 0;
+    d->lines = 0;
+    d->batches = 0;
+    atomic_init(&d->lines_out, 0);
+    atomic_init(&d->bytes_out, 0);
+    return 0;
+}
+
+/* Hand queue i its pending block, if any; waits while the ring is full. */
+static void dispatch_flush(dispatcher_t* d, int i) {
+    if (!d->pending[i]) return;
+    LC_STAT_ADD(d->lines_out, d->pending[i]->count);
+    LC_STAT_ADD(d->bytes_out, d->pending[i]->bytes);
+    spsc_ring_push(&d->queues[i], &d->pending[i]);
+    d->pending[i] = NULL;
+    ++d->batches;
+}
+
+/* Append a line to the pending block of the queue the --dispatch policy
+   picks, or of the queue of its first piece if it continues a line; the
+   block is enqueued once it is full. Returns 0, or -1 if a block cannot be
+   allocated. */
+static int dispatch_line(dispatcher_t* d, line_t line) {
+    int i = d->last;
+    if (line.piece & LINE_CONTINUED) d->route.sent[i] += line.len;
+    else i = (int)line_dispatch_pick(&d->route, line.len);
+    d->last = i;
+    line_block_t* b = d->pending[i];
+    if (!b) {
+        b = block_new(d->block_lines);
+        if (!b) return -1;
+        d->pending[i] = b;
+    }
+    b->lines[b->count++] = line;
+    b->bytes += line.len;
+    if (b->count == d->block_lines || b->bytes >= d->block_bytes) {
+        dispatch_flush(d, i);
+    }
+    if (line.piece & LINE_CONTINUED) ++d->pieces;
+    else ++d->lines;
     return 0;
 }
 
-/* Dequeue a line; blocks until an item is available.
-   Caller takes ownership of returned char* (may be NULL sentinel). */
-static char* queue_dequeue(queue_t* q) {
-	// Wait for an item to be available
-    pthread_mutex_lock(&q->mutex);
-    while (q->head == NULL) {
-		// pthread_cond_wait must always be in a loop to avoid spurious wakeups
-        pthread_cond_wait(&q->cond_input_is_available, &q->mutex);
-    }
-	// Remove from head, while keeping the queue consistent
-    node_t* n = q->head;
-    q->head = n->next;
-    if (q->head == NULL) q->tail = NULL;
-    pthread_mutex_unlock(&q->mutex);
-	// We got the node, extract the line and free the node
-    char* line = n->line;
-    free(n);
-    return line;
-}
-
-/* Counting helpers */
-static size_t count_words(const char* s) {
-    size_t words = 0;
-    int in_word = 0;
-    for (; *s; ++s) {
-        if (!isspace((unsigned char)*s)) {
-            if (!in_word) { in_word = 1; ++words; }
+/* Flush the partial blocks and send each worker the end-of-stream block.
+   Also after a failure: the workers need it to stop. */
+static void dispatch_finish(dispatcher_t* d) {
+    for (int i = 0; i < 3; ++i) {
+        dispatch_flush(d, i);
+        spsc_ring_push(&d->queues[i], &d->sentinels[i]);
+        d->sentinels[i] = NULL;
+    }
+}
+
+/* Distribute the lines of [data, data + size) as views, each holding a
+   reference to slab if there is one. With --bounded the first view may
+   continue the last line of the previous range (continued) and the last
+   one go on in the next (open). Returns 0, or -1 if a line cannot be
+   queued. */
+static int distribute_range(dispatcher_t* d, const char* data, size_t size,
+                            line_slab_t* slab, int continued, int open) {
+    const char* p = data;
+    const char* const end = p + size;
+    unsigned piece = continued ? LINE_CONTINUED : 0;
+    while (p < end) {
+        const char* nl = memchr(p, '\n', (size_t)(end - p));
+        size_t len = nl ? (size_t)(nl - p) + 1 : (size_t)(end - p);
+        if (open && !nl) piece |= LINE_CONTINUES;
+        line_t line = { p, len, slab, piece };
+        piece = 0;
+        if (dispatch_line(d, line) != 0) {
+            fprintf(stderr, "Failed to enqueue line\n");
+            return -1;
         }
-        else {
-            in_word = 0;
+        p += len;
+    }
+    return 0;
+}
+
+/* Inputs that cannot be mapped: split each buffer filled by the reader
+   thread into lines. Returns 0, or -1 on error. */
+static int distribute_stream(dispatcher_t* d, stream_reader_t* reader) {
+    stream_chunk_t chunk;
+    int continued = 0;
+    while (stream_reader_next(reader, &chunk)) {
+        unsigned long long before = d->lines + d->pieces;
+        int rc = distribute_range(d, chunk.data, chunk.len, chunk.slab,
+                                  continued, chunk.open);
+        continued = chunk.open;
+        chunk.slab->handed_out = (size_t)(d->lines + d->pieces - before);
+        line_slab_retire(chunk.slab);
+        if (rc != 0) {
+            stream_reader_cancel(reader);
+            return -1;
         }
+        // The reader needs this buffer back eventually, and lines waiting in
+        // a partial block would pin it: hand every partial block over now.
+        for (int i = 0; i < 3; ++i) dispatch_flush(d, i);
+    }
+    if (reader->error != 0) {
+        fprintf(stderr, "Read failed: %s\n", strerror(reader->error));
+        return -1;
     }
-    return words;
+    return 0;
 }
 
-static size_t count_chars(const char* s) {
-    size_t chars = 0;
-    for (; *s; ++s) {
-        if (*s != '\n') ++chars; /* exclude newline from character count */
+/* Compare one kernel with the scalar reference on a single view.
+   Prints the first difference and returns 1 if they disagree. */
+static int check_view(const count_kernels_t* ref, const count_kernels_t* k,
+                      const char* s, size_t len, long long lineNo) {
+    size_t rw = ref->words(s, len), kw = k->words(s, len);
+    size_t rc = ref->chars(s, len), kc = k->chars(s, len);
+    size_t rv = ref->vowels(s, len), kv = k->vowels(s, len);
+    size_t ri = ref->invalid ? ref->invalid(s, len) : 0;
+    size_t ki = k->invalid ? k->invalid(s, len) : 0;
+    counts_t ra, ka;
+    ref->all(s, len, &ra);
+    k->all(s, len, &ka);
+    if (rw == kw && rc == kc && rv == kv && ri == ki
+        && memcmp(&ra, &ka, sizeof(ra)) == 0) {
+        return 0;
     }
-    return chars;
+    fprintf(stderr, "%s differs from %s at %s %lld: "
+            "words %zu/%zu chars %zu/%zu vowels %zu/%zu invalid %zu/%zu\n",
+            k->name, ref->name, lineNo < 0 ? "whole input" : "line",
+            lineNo < 0 ? 0 : lineNo, kw, rw, kc, rc, kv, rv, ki, ri);
+    return 1;
 }
 
-static size_t count_vowels(const char* s) {
-    size_t v = 0;
-    for (; *s; ++s) {
-        char c = tolower((unsigned char)*s);
-        if (c == 'a' || c == 'e' || c == 'i' || c == 'o' || c == 'u') ++v;
+/* --self-check: run every kernel this CPU supports over each line and over
+   the whole input, comparing with the scalar reference.
+   Returns EXIT_SUCCESS if all of them agree everywhere. */
+static int run_self_check(const char* path, int utf8) {
+    mapped_file_t mf;
+    if (mapped_file_open(&mf, path) != 0) {
+        fprintf(stderr, "Self-check needs a regular file '%s': %s\n",
+                path, strerror(errno));
+        return EXIT_FAILURE;
+    }
+    const count_kernels_t* all[4];
+    size_t n = count_kernels_available(all, sizeof(all) / sizeof(all[0]));
+    const count_kernels_t* ref = count_kernels_scalar();
+    if (utf8) {
+        ref = count_kernels_utf8(ref);
+        for (size_t k = 0; k < n; ++k) all[k] = count_kernels_utf8(all[k]);
     }
-    return v;
+    int failed = 0;
+    for (size_t k = 1; k < n; ++k) {
+        size_t mismatches = check_view(ref, all[k], mf.data, mf.size, -1);
+        long long line_no = 0;
+        const char* p = mf.data;
+        const char* const end = p + mf.size;
+        while (p < end) {
+            const char* nl = memchr(p, '\n', (size_t)(end - p));
+            size_t len = nl ? (size_t)(nl - p) + 1 : (size_t)(end - p);
+            // Report only the first bad line; count the rest.
+            if (check_view(ref, all[k], p, len, ++line_no)) {
+                if (++mismatches > 1) fprintf(stderr, "...\n");
+            }
+            p += len;
+        }
+        printf("Self-check %-11s: %lld lines, %zu mismatches\n",
+               all[k]->name, line_no, mismatches);
+        failed |= (mismatches != 0);
+    }
+    mapped_file_close(&mf);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
 }
 
-/* Thread argument */
+/* Upper bound for -j; far above any core count we run on. */
+#define MAX_JOBS 1024
+
+/* -j workers split their ranges in halves down to this size, so that an
+   idle worker always finds something to steal near the end; one steal per
+   256 KB is noise next to counting it. */
+#define STEAL_GRAIN (256 * 1024)
+#define STEAL_DEQUE_DEPTH 256
+
+/* State shared by the -j workers. */
 typedef struct {
-    queue_t* queue;
-	// Mode could be a function pointer, but this is simpler
-    int mode; /* 1 = words, 2 = chars, 3 = vowels */
-} worker_arg_t;
+    const char* data;
+    const count_kernels_t* kernels;
+    const pattern_set_t* patterns; /* --patterns, else NULL */
+    ws_deque_t* deques;       /* one per worker */
+    size_t jobs;
+    _Atomic size_t remaining; /* bytes not counted yet */
+} steal_pool_t;
 
-static void* worker_thread(void* arg) {
-    worker_arg_t* w = (worker_arg_t*)arg;
-    unsigned long long total = 0ULL;
+/* One -j worker: its initial range, partial totals and where its time went. */
+typedef struct {
+    steal_pool_t* pool;
+    size_t id;
+    ws_range_t first;
+    counts_t counts;
+    double busy;   /* seconds spent counting */
+    double idle;   /* seconds spent looking for work */
+    unsigned long long ranges;
+    unsigned long long stolen;
+    word_freq_t* words;  /* --top: this worker's word counts, else NULL */
+    int words_failed;    /* out of memory counting words */
+    hll_t* distinct;     /* --distinct: this worker's sketch, else NULL */
+    unsigned long long* matches; /* --patterns: count per pattern */
+} chunk_arg_t;
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+/* Move a split point forward to the start of the next line, so that no line
+   is cut between two chunks. */
+static size_t align_to_line(const char* data, size_t size, size_t pos) {
+    if (pos >= size) return size;
+    if (pos == 0 || data[pos - 1] == '\n') return pos;
+    const char* nl = memchr(data + pos, '\n', size - pos);
+    return nl ? (size_t)(nl - data) + 1 : size;
+}
+
+/* Try every other worker's deque once, starting at a random one so that
+   thieves spread out. Returns 1 with *range set, or 0. */
+static int steal_range(chunk_arg_t* c, uint64_t* seed, ws_range_t* range) {
+    steal_pool_t* p = c->pool;
+    *seed = *seed * 6364136223846793005ULL + 1442695040888963407ULL;
+    size_t start = (size_t)(*seed >> 33) % p->jobs;
+    for (size_t k = 0; k < p->jobs; ++k) {
+        size_t victim = (start + k) % p->jobs;
+        if (victim == c->id) continue;
+        int rc;
+        while ((rc = ws_deque_steal(&p->deques[victim], range)) < 0) {
+            // Lost a race: the deque is busy, so it is worth another try.
+        }
+        if (rc == 1) return 1;
+    }
+    return 0;
+}
+
+static void* chunk_worker(void* arg) {
+    chunk_arg_t* c = (chunk_arg_t*)arg;
+    steal_pool_t* p = c->pool;
+    ws_deque_t* own = &p->deques[c->id];
+    uint64_t seed = c->id + 1;
+    ws_range_t r = c->first;
+    int have = r.begin < r.end;
 
     while (1) {
-        char* line = queue_dequeue(w->queue);
-        if (line == NULL) break; /* sentinel => no more data */
+        if (!have) have = ws_deque_take(own, &r);
+        if (!have) {
+            double t0 = now_seconds();
+            while (!(have = steal_range(c, &seed, &r))
+                   && atomic_load_explicit(&p->remaining,
+                                           memory_order_acquire) != 0) {
+                sched_yield();
+            }
+            c->idle += now_seconds() - t0;
+            if (!have) break; /* everything has been counted */
+            ++c->stolen;
+        }
 
-        size_t c = 0;
-        if (w->mode == 1) c = count_words(line);
-        else if (w->mode == 2) c = count_chars(line);
-        else if (w->mode == 3) c = count_vowels(line);
+        // Keep the lower half and leave the upper one for whoever is idle,
+        // until the range is small enough to count in one go.
+        while (r.end - r.begin > STEAL_GRAIN) {
+            size_t mid = r.begin + align_to_line(p->data + r.begin,
+                                                 r.end - r.begin,
+                                                 (r.end - r.begin) / 2);
+            if (mid >= r.end) break; /* one long line */
+            ws_range_t upper = { mid, r.end };
+            if (!ws_deque_push(own, &upper)) break;
+            r.end = mid;
+        }
 
-        total += c;
-        free(line);
+        double t0 = now_seconds();
+        counts_t part;
+        p->kernels->all(p->data + r.begin, r.end - r.begin, &part);
+        if (c->words && !c->words_failed
+            && word_freq_add_text(c->words, p->data + r.begin,
+                                  r.end - r.begin) != 0) {
+            c->words_failed = 1;
+        }
+        if (c->distinct) {
+            hll_add_text(c->distinct, p->data + r.begin, r.end - r.begin);
+        }
+        if (c->matches) {
+            pattern_set_scan(p->patterns, p->data + r.begin, r.end - r.begin,
+                             c->matches);
+        }
+        c->busy += now_seconds() - t0;
+        c->counts.words += part.words;
+        c->counts.chars += part.chars;
+        c->counts.vowels += part.vowels;
+        c->counts.lines += part.lines;
+        c->counts.invalid += part.invalid;
+        ++c->ranges;
+        atomic_fetch_sub_explicit(&p->remaining, r.end - r.begin,
+                                  memory_order_release);
+        have = 0;
     }
+    return NULL;
+}
 
-    unsigned long long* ret = malloc(sizeof(unsigned long long));
-    if (!ret) pthread_exit(NULL);
-    *ret = total;
-    return ret;
+/* --top: merge the workers' word tables and print the k most frequent
+   words. Returns 0, or -1 if out of memory. */
+static int print_top_words(word_freq_t* tables, size_t jobs, size_t k,
+                           int verbose) {
+    size_t sketched = 0;
+    for (size_t i = 0; i < jobs; ++i) sketched += (tables[i].sketch.cells != NULL);
+    word_count_t* top;
+    int approximate;
+    unsigned long long error, distinct;
+    double t0 = now_seconds();
+    long n = word_freq_top(tables, jobs, k, jobs, &top, &approximate, &error,
+                           &distinct);
+    if (n < 0) return -1;
+    if (approximate) {
+        printf("Top words     : approximate, counts may be up to %llu "
+               "too high\n", error);
+    }
+    else {
+        printf("Distinct words: %llu\n", distinct);
+    }
+    for (long i = 0; i < n; ++i) {
+        printf("%12llu  %.*s\n", top[i].count, (int)top[i].len, top[i].word);
+    }
+    if (verbose) {
+        fprintf(stderr, "Word tables   : merged in %.3f s, %zu of %zu fell "
+                "back to a count-min sketch\n", now_seconds() - t0, sketched,
+                jobs);
+    }
+    free(top);
+    return 0;
 }
 
-int main(int argc, char** argv) {
-    if (argc != 2) {
-        fprintf(stderr, "Usage: %s <input-file>\n", argv[0]);
+static void print_distinct(const hll_t* h) {
+    printf("Distinct (HLL): ~%llu (error %.2f%%)\n", hll_estimate(h),
+           100.0 * hll_error(h->precision));
+}
+
+/* --patterns: the occurrences of every pattern, in the order of the
+   pattern file. */
+static void print_pattern_counts(const pattern_set_t* ps,
+                                 const unsigned long long* counts,
+                                 int verbose) {
+    size_t n = pattern_set_size(ps);
+    printf("Patterns      : %zu\n", n);
+    for (size_t i = 0; i < n; ++i) {
+        size_t len;
+        const char* pattern = pattern_set_pattern(ps, i, &len);
+        printf("%12llu  %.*s\n", counts[i], (int)len, pattern);
+    }
+    if (verbose) {
+        fprintf(stderr, "Matcher       : %s\n", pattern_set_matcher(ps));
+    }
+}
+
+/* -j N: count the whole file with N threads. Each starts on an equal,
+   line-aligned share of the file and splits it as it goes; a worker that
+   runs out steals from the others, so a slow share does not hold up the
+   result. With --top (top > 0) every worker also counts the words of its
+   ranges into its own table, within topMemory bytes for all of them; with
+   --distinct (distinctPrecision > 0) it adds them to its own HyperLogLog
+   sketch, and with --patterns (patterns != NULL) it counts the patterns in
+   them. */
+static int run_chunked(const char* path, size_t jobs, int verbose,
+                       const count_kernels_t* kernels, size_t top,
+                       size_t topMemory, unsigned distinctPrecision,
+                       const pattern_set_t* patterns) {
+    mapped_file_t mf;
+    if (mapped_file_open(&mf, path) != 0) {
+        fprintf(stderr, "-j needs a regular file '%s': %s\n",
+                path, strerror(errno));
+        return EXIT_FAILURE;
+    }
+    chunk_arg_t* chunks = calloc(jobs, sizeof(chunk_arg_t));
+    pthread_t* threads = calloc(jobs, sizeof(pthread_t));
+    ws_deque_t* deques = calloc(jobs, sizeof(ws_deque_t));
+    word_freq_t* words = top ? calloc(jobs, sizeof(word_freq_t)) : NULL;
+    hll_t* sketches = distinctPrecision ? calloc(jobs, sizeof(hll_t)) : NULL;
+    size_t pattern_count = patterns ? pattern_set_size(patterns) : 0;
+    unsigned long long* matches = patterns
+        ? calloc(jobs * pattern_count, sizeof(unsigned long long)) : NULL;
+    size_t sketches_ready = 0;
+    while (sketches && sketches_ready < jobs
+           && hll_init(&sketches[sketches_ready], distinctPrecision) == 0) {
+        ++sketches_ready;
+    }
+    size_t deques_ready = 0;
+    while (deques && deques_ready < jobs
+           && ws_deque_init(&deques[deques_ready], STEAL_DEQUE_DEPTH) == 0) {
+        ++deques_ready;
+    }
+    if (!chunks || !threads || deques_ready < jobs || (top && !words)
+        || (distinctPrecision && sketches_ready < jobs)
+        || (patterns && !matches)) {
+        fprintf(stderr, "Out of memory\n");
+        for (size_t i = 0; i < deques_ready; ++i) ws_deque_destroy(&deques[i]);
+        for (size_t i = 0; i < sketches_ready; ++i) hll_free(&sketches[i]);
+        free(deques);
+        free(chunks);
+        free(threads);
+        free(words);
+        free(sketches);
+        free(matches);
+        mapped_file_close(&mf);
+        return EXIT_FAILURE;
+    }
+
+    steal_pool_t pool;
+    pool.data = mf.data;
+    pool.kernels = kernels;
+    pool.patterns = patterns;
+    pool.deques = deques;
+    pool.jobs = jobs;
+    atomic_init(&pool.remaining, mf.size);
+
+    size_t start = 0;
+    size_t started = 0;
+    int failed = 0;
+    for (size_t i = 0; i < jobs; ++i) {
+        size_t end = (i + 1 == jobs) ? mf.size
+            : align_to_line(mf.data, mf.size, mf.size / jobs * (i + 1));
+        chunks[i].pool = &pool;
+        chunks[i].id = i;
+        if (top) {
+            word_freq_init(&words[i], topMemory / jobs, top);
+            chunks[i].words = &words[i];
+        }
+        if (distinctPrecision) chunks[i].distinct = &sketches[i];
+        if (patterns) chunks[i].matches = &matches[i * pattern_count];
+        chunks[i].first.begin = start;
+        chunks[i].first.end = end;
+        start = end;
+    }
+    for (size_t i = 0; i + 1 < jobs; ++i) {
+        // The last worker runs on this thread instead of idling in join.
+        if (pthread_create(&threads[i], NULL, chunk_worker, &chunks[i]) != 0) {
+            fprintf(stderr, "Failed to create thread %zu\n", i);
+            failed = 1;
+            break;
+        }
+        ++started;
+    }
+    if (!failed) {
+        chunk_worker(&chunks[jobs - 1]);
+    }
+    else {
+        // Nobody will count the shares of the workers that did not start;
+        // stop the others from waiting for them.
+        for (size_t i = started; i < jobs; ++i) {
+            atomic_fetch_sub(&pool.remaining,
+                             chunks[i].first.end - chunks[i].first.begin);
+        }
+    }
+
+    counts_t total = { 0, 0, 0, 0, 0 };
+    int words_failed = 0;
+    for (size_t i = 0; i < started; ++i) pthread_join(threads[i], NULL);
+    for (size_t i = 0; i < jobs; ++i) {
+        total.words += chunks[i].counts.words;
+        total.chars += chunks[i].counts.chars;
+        total.vowels += chunks[i].counts.vowels;
+        total.lines += chunks[i].counts.lines;
+        total.invalid += chunks[i].counts.invalid;
+        words_failed |= chunks[i].words_failed;
+    }
+    if (words_failed) {
+        fprintf(stderr, "Out of memory counting words\n");
+        failed = 1;
+    }
+    if (verbose && !failed) {
+        for (size_t i = 0; i < jobs; ++i) {
+            fprintf(stderr, "Worker %-7zu: busy %.3f s, idle %.3f s, "
+                    "%llu ranges (%llu stolen)\n", i, chunks[i].busy,
+                    chunks[i].idle, chunks[i].ranges, chunks[i].stolen);
+        }
+    }
+    for (size_t i = 0; i < jobs; ++i) ws_deque_destroy(&deques[i]);
+    free(deques);
+    free(threads);
+    free(chunks);
+
+    if (!failed) {
+        printf("Total words   : %llu\n", total.words);
+        printf("Total chars   : %llu\n", total.chars);
+        printf("Total vowels  : %llu\n", total.vowels);
+        printf("Total lines   : %llu\n", total.lines);
+        if (kernels->invalid) printf("Invalid UTF-8 : %llu\n", total.invalid);
+        if (distinctPrecision) {
+            for (size_t i = 1; i < jobs; ++i) hll_merge(&sketches[0], &sketches[i]);
+            print_distinct(&sketches[0]);
+        }
+        if (patterns) {
+            for (size_t i = 1; i < jobs; ++i) {
+                for (size_t k = 0; k < pattern_count; ++k) {
+                    matches[k] += matches[i * pattern_count + k];
+                }
+            }
+            print_pattern_counts(patterns, matches, verbose);
+        }
+        // The words are views into the mapping: print them before closing it.
+        if (top && print_top_words(words, jobs, top, verbose) != 0) {
+            fprintf(stderr, "Out of memory\n");
+            failed = 1;
+        }
+    }
+    if (top) {
+        for (size_t i = 0; i < jobs; ++i) word_freq_free(&words[i]);
+        free(words);
+    }
+    for (size_t i = 0; i < sketches_ready; ++i) hll_free(&sketches[i]);
+    free(sketches);
+    free(matches);
+    mapped_file_close(&mf);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/* Batch mode: files are cut into pieces of this size so that one large
+   file does not keep a single worker busy after the others ran dry. */
+#define BATCH_GRAIN (4 * 1024 * 1024)
+
+/* State shared by the batch workers. */
+typedef struct {
+    const file_batch_t* batch;
+    batch_task_t* tasks;      /* largest first */
+    size_t count;
+    const count_kernels_t* kernels;
+    _Atomic size_t next;      /* first task nobody has taken */
+    unsigned precision;       /* --distinct: HyperLogLog precision, or 0 */
+    hll_t* shared;            /* per file; registers only for files cut
+                                 into several pieces */
+    unsigned long long* distinct; /* per file estimate */
+    const pattern_set_t* patterns; /* --patterns, else NULL */
+} batch_pool_t;
+
+/* Decoded bytes counted at a time for a compressed file in a batch. */
+#define BATCH_DECODE_BUFFER (1024 * 1024)
+
+static void add_counts(counts_t* to, const counts_t* c) {
+    to->words += c->words;
+    to->chars += c->chars;
+    to->vowels += c->vowels;
+    to->lines += c->lines;
+    to->invalid += c->invalid;
+}
+
+/* Decode a compressed file on this thread and count the whole lines of
+   each buffer, carrying a partial last line over to the next one. Words
+   also go into `distinct` unless it is NULL, and pattern occurrences into
+   `matches` unless patterns is NULL. Returns 0, or an errno. */
+static int count_compressed(const batch_file_t* f,
+                            const count_kernels_t* kernels, counts_t* counts,
+                            hll_t* distinct, const pattern_set_t* patterns,
+                            unsigned long long* matches,
+                            unsigned long long* bytes) {
+    int fd = open(f->path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return errno;
+    decoder_t* dec = decoder_open(fd, f->compression, 1);
+    if (!dec) {
+        int error = errno;
+        close(fd);
+        return error;
+    }
+    size_t cap = BATCH_DECODE_BUFFER;
+    char* buf = malloc(cap);
+    size_t carry = 0;
+    int error = buf ? 0 : ENOMEM;
+    while (!error) {
+        if (carry == cap) {
+            // One line fills the buffer: grow it.
+            char* grown = realloc(buf, cap * 2);
+            if (!grown) {
+                error = ENOMEM;
+                break;
+            }
+            buf = grown;
+            cap *= 2;
+        }
+        ssize_t n = decoder_read(dec, buf + carry, cap - carry);
+        if (n < 0) {
+            error = errno;
+            break;
+        }
+        // At the end an unterminated last line is whole too.
+        size_t total = carry + (size_t)n;
+        const char* nl = n == 0 ? NULL : memrchr(buf, '\n', total);
+        size_t whole = n == 0 ? total : nl ? (size_t)(nl - buf) + 1 : 0;
+        if (whole > 0) {
+            counts_t c;
+            kernels->all(buf, whole, &c);
+            add_counts(counts, &c);
+            if (distinct) hll_add_text(distinct, buf, whole);
+            if (patterns) pattern_set_scan(patterns, buf, whole, matches);
+            *bytes += whole;
+        }
+        if (n == 0) break;
+        carry = total - whole;
+        memmove(buf, buf + whole, carry);
+    }
+    free(buf);
+    decoder_close(dec);
+    close(fd);
+    return error;
+}
+
+/* One batch worker and where its time went. */
+typedef struct {
+    batch_pool_t* pool;
+    double busy;
+    unsigned long long pieces;
+    unsigned long long bytes;
+    hll_t piece;   /* --distinct: words of the current piece */
+    hll_t all;     /* --distinct: words of all its pieces */
+    unsigned long long* matches; /* --patterns: count per pattern */
+} batch_worker_t;
+
+/* --distinct: hand the sketch of a finished piece over to its file. */
+static void finish_piece_distinct(batch_worker_t* w, const batch_task_t* t) {
+    batch_pool_t* p = w->pool;
+    hll_merge(&w->all, &w->piece);
+    if (p->shared[t->file].registers) {
+        hll_merge_shared(&p->shared[t->file], &w->piece);
+    }
+    else {
+        p->distinct[t->file] = hll_estimate(&w->piece); /* the whole file */
+    }
+    hll_clear(&w->piece);
+}
+
+static void* batch_worker(void* arg) {
+    batch_worker_t* w = (batch_worker_t*)arg;
+    batch_pool_t* p = w->pool;
+    size_t i;
+    while ((i = atomic_fetch_add_explicit(&p->next, 1, memory_order_relaxed))
+           < p->count) {
+        batch_task_t* t = &p->tasks[i];
+        const batch_file_t* f = &p->batch->files[t->file];
+        double t0 = now_seconds();
+        hll_t* distinct = p->precision ? &w->piece : NULL;
+        if (f->compression != COMPRESSION_NONE) {
+            t->error = count_compressed(f, p->kernels, &t->counts, distinct,
+                                        p->patterns, w->matches, &w->bytes);
+            if (distinct) finish_piece_distinct(w, t);
+            w->busy += now_seconds() - t0;
+            ++w->pieces;
+            continue;
+        }
+        // Every piece maps the file on its own, which keeps the pieces
+        // independent, but without the whole-file readahead hints of
+        // mapped_file_open(): only the piece's own range is advised.
+        mapped_file_t mf;
+        if (mapped_file_open_sparse(&mf, f->path) != 0) {
+            t->error = errno;
+            continue;
+        }
+        size_t end = (t->end < mf.size) ? t->end : mf.size;
+        size_t begin = align_to_line(mf.data, mf.size, t->begin);
+        end = align_to_line(mf.data, mf.size, end);
+        if (begin < end) {
+            mapped_file_advise(&mf, begin, end);
+            p->kernels->all(mf.data + begin, end - begin, &t->counts);
+            if (distinct) hll_add_text(distinct, mf.data + begin, end - begin);
+            if (p->patterns) {
+                pattern_set_scan(p->patterns, mf.data + begin, end - begin,
+                                 w->matches);
+            }
+            w->bytes += end - begin;
+        }
+        if (distinct) finish_piece_distinct(w, t);
+        mapped_file_close(&mf);
+        w->busy += now_seconds() - t0;
+        ++w->pieces;
+    }
+    return NULL;
+}
+
+/* --distinct in batch mode: a sketch per worker for the piece at hand and
+   one for everything it counted, and a shared one per file that is cut
+   into several pieces; a file counted in one piece is estimated from the
+   piece's sketch. Memory is 2^precision bytes per worker and per such
+   file. Returns 0, or -1 if out of memory. */
+static int batch_distinct_init(batch_pool_t* pool, batch_worker_t* workers,
+                               size_t jobs, unsigned precision) {
+    size_t files = pool->batch->count;
+    pool->precision = precision;
+    pool->shared = calloc(files ? files : 1, sizeof(hll_t));
+    pool->distinct = calloc(files ? files : 1, sizeof(unsigned long long));
+    if (!pool->shared || !pool->distinct) return -1;
+    for (size_t i = 0; i < pool->count; ++i) {
+        const batch_task_t* t = &pool->tasks[i];
+        int whole = (t->begin == 0 && t->end == BATCH_TO_END);
+        if (!whole && !pool->shared[t->file].registers
+            && hll_init(&pool->shared[t->file], precision) != 0) {
+            return -1;
+        }
+    }
+    for (size_t i = 0; i < jobs; ++i) {
+        if (hll_init(&workers[i].piece, precision) != 0
+            || hll_init(&workers[i].all, precision) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void batch_distinct_free(batch_pool_t* pool, batch_worker_t* workers,
+                                size_t jobs) {
+    if (pool->shared) {
+        for (size_t i = 0; i < pool->batch->count; ++i) {
+            hll_free(&pool->shared[i]);
+        }
+    }
+    for (size_t i = 0; i < jobs; ++i) {
+        hll_free(&workers[i].piece);
+        hll_free(&workers[i].all);
+    }
+    free(pool->shared);
+    free(pool->distinct);
+}
+
+/* Many files, directories or patterns: one pool of threads counts all of
+   them, and every file is reported like -j would report it. --patterns
+   counts are totals over the batch. */
+static int run_batch(file_batch_t* batch, size_t jobs, int verbose,
+                     const count_kernels_t* kernels,
+                     unsigned distinctPrecision,
+                     const pattern_set_t* patterns) {
+    size_t count;
+    batch_task_t* tasks = file_batch_plan(batch, BATCH_GRAIN, &count);
+    if (!tasks && count > 0) {
+        fprintf(stderr, "Out of memory\n");
+        return EXIT_FAILURE;
+    }
+    if (jobs > count) jobs = count ? count : 1;
+    batch_worker_t* workers = calloc(jobs, sizeof(batch_worker_t));
+    pthread_t* threads = calloc(jobs, sizeof(pthread_t));
+    size_t pattern_count = patterns ? pattern_set_size(patterns) : 0;
+    unsigned long long* matches = patterns
+        ? calloc(jobs * pattern_count, sizeof(unsigned long long)) : NULL;
+    if (!workers || !threads || (patterns && !matches)) {
+        fprintf(stderr, "Out of memory\n");
+        free(workers);
+        free(threads);
+        free(matches);
+        free(tasks);
+        return EXIT_FAILURE;
+    }
+
+    batch_pool_t pool;
+    pool.batch = batch;
+    pool.tasks = tasks;
+    pool.count = count;
+    pool.kernels = kernels;
+    atomic_init(&pool.next, 0);
+    pool.precision = 0;
+    pool.shared = NULL;
+    pool.distinct = NULL;
+    pool.patterns = patterns;
+    if (distinctPrecision
+        && batch_distinct_init(&pool, workers, jobs, distinctPrecision) != 0) {
+        fprintf(stderr, "Out of memory\n");
+        batch_distinct_free(&pool, workers, jobs);
+        free(workers);
+        free(threads);
+        free(matches);
+        free(tasks);
         return EXIT_FAILURE;
     }
 
-    FILE* f = fopen(argv[1], "r");
-    if (!f) {
-        fprintf(stderr, "Failed to open '%s': %s\n", argv[1], strerror(errno));
+    double start = now_seconds();
+    size_t started = 0;
+    for (size_t i = 0; i < jobs; ++i) {
+        workers[i].pool = &pool;
+        if (patterns) workers[i].matches = &matches[i * pattern_count];
+    }
+    for (size_t i = 0; i + 1 < jobs; ++i) {
+        if (pthread_create(&threads[i], NULL, batch_worker, &workers[i]) != 0) {
+            // The threads that did start (and this one) take the rest.
+            break;
+        }
+        ++started;
+    }
+    batch_worker(&workers[jobs - 1]);
+    for (size_t i = 0; i < started; ++i) pthread_join(threads[i], NULL);
+    double elapsed = now_seconds() - start;
+
+    for (size_t i = 0; i < count; ++i) {
+        batch_file_t* f = &batch->files[tasks[i].file];
+        if (tasks[i].error && !f->error) {
+            f->error = tasks[i].error;
+            ++batch->errors;
+        }
+        add_counts(&f->counts, &tasks[i].counts);
+    }
+
+    counts_t total = { 0, 0, 0, 0, 0 };
+    printf("%12s %12s %12s %12s%s%s  %s\n", "words", "chars", "vowels",
+           "lines", kernels->invalid ? "      invalid" : "",
+           pool.precision ? "     distinct" : "", "file");
+    for (size_t i = 0; i < batch->count; ++i) {
+        const batch_file_t* f = &batch->files[i];
+        if (f->error) {
+            fprintf(stderr, "Failed to read '%s': %s\n", f->path,
+                    strerror(f->error));
+            continue;
+        }
+        printf("%12llu %12llu %12llu %12llu", f->counts.words,
+               f->counts.chars, f->counts.vowels, f->counts.lines);
+        if (kernels->invalid) printf(" %12llu", f->counts.invalid);
+        if (pool.precision) {
+            printf(" %12llu", pool.shared[i].registers
+                   ? hll_estimate(&pool.shared[i]) : pool.distinct[i]);
+        }
+        printf("  %s\n", f->path);
+        add_counts(&total, &f->counts);
+    }
+    printf("Total words   : %llu\n", total.words);
+    printf("Total chars   : %llu\n", total.chars);
+    printf("Total vowels  : %llu\n", total.vowels);
+    printf("Total lines   : %llu\n", total.lines);
+    if (kernels->invalid) printf("Invalid UTF-8 : %llu\n", total.invalid);
+    if (pool.precision) {
+        for (size_t i = 1; i < jobs; ++i) hll_merge(&workers[0].all, &workers[i].all);
+        print_distinct(&workers[0].all);
+    }
+    if (patterns) {
+        for (size_t i = 1; i < jobs; ++i) {
+            for (size_t k = 0; k < pattern_count; ++k) {
+                matches[k] += matches[i * pattern_count + k];
+            }
+        }
+        print_pattern_counts(patterns, matches, verbose);
+    }
+    printf("Files         : %zu (%zu failed)\n", batch->count, batch->errors);
+
+    if (verbose) {
+        fprintf(stderr, "Batch         : %zu pieces on %zu threads in %.3f s\n",
+                count, started + 1, elapsed);
+        for (size_t i = 0; i < jobs; ++i) {
+            fprintf(stderr, "Worker %-7zu: busy %.3f s, %llu pieces, "
+                    "%llu bytes\n", i, workers[i].busy, workers[i].pieces,
+                    workers[i].bytes);
+        }
+    }
+    if (pool.precision) batch_distinct_free(&pool, workers, jobs);
+    free(workers);
+    free(threads);
+    free(matches);
+    free(tasks);
+    return batch->errors ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/* Suffix of the sidecar index written by --index. */
+#define INDEX_SUFFIX ".lcidx"
+
+/* State shared by the threads that count the stale chunks of an index. */
+typedef struct {
+    const char* data;
+    const count_kernels_t* kernels;
+    index_chunk_t* chunks;
+    const size_t* stale;      /* indices into chunks */
+    size_t count;
+    _Atomic size_t next;
+} index_pool_t;
+
+static void* index_worker(void* arg) {
+    index_pool_t* p = (index_pool_t*)arg;
+    size_t i;
+    while ((i = atomic_fetch_add_explicit(&p->next, 1, memory_order_relaxed))
+           < p->count) {
+        index_chunk_t* c = &p->chunks[p->stale[i]];
+        size_t len = (size_t)(c->end - c->begin);
+        memset(&c->counts, 0, sizeof(c->counts));
+        if (len > 0) p->kernels->all(p->data + c->begin, len, &c->counts);
+        c->hash = count_index_hash(p->data + c->begin, len);
+    }
+    return NULL;
+}
+
+static void index_key_of(const struct stat* st, index_key_t* key) {
+    key->dev = (uint64_t)st->st_dev;
+    key->ino = (uint64_t)st->st_ino;
+    key->size = (uint64_t)st->st_size;
+    key->mtime_sec = (int64_t)st->st_mtim.tv_sec;
+    key->mtime_nsec = (int64_t)st->st_mtim.tv_nsec;
+}
+
+static void print_totals(const counts_t* total, const count_kernels_t* kernels) {
+    printf("Total words   : %llu\n", total->words);
+    printf("Total chars   : %llu\n", total->chars);
+    printf("Total vowels  : %llu\n", total->vowels);
+    printf("Total lines   : %llu\n", total->lines);
+    if (kernels->invalid) printf("Invalid UTF-8 : %llu\n", total->invalid);
+}
+
+/* Fill in the chunks of `fresh` from `old` where the bytes are the same and
+   count the others on `jobs` threads; *total gets the whole file. */
+static void count_stale_chunks(count_index_t* fresh, const count_index_t* old,
+                               const char* data, unsigned char* reused,
+                               size_t* stale, pthread_t* threads, size_t jobs,
+                               const count_kernels_t* kernels, counts_t* total,
+                               int verbose) {
+    int appended = old && count_index_appended(old, &fresh->key, data);
+    size_t reuse = 0;
+    if (old) reuse = count_index_reuse(fresh, old, data, appended, reused);
+    else memset(reused, 0, fresh->count);
+
+    index_pool_t pool;
+    pool.data = data;
+    pool.kernels = kernels;
+    pool.chunks = fresh->chunks;
+    pool.stale = stale;
+    pool.count = 0;
+    atomic_init(&pool.next, 0);
+    unsigned long long recount = 0;
+    for (size_t i = 0; i < fresh->count; ++i) {
+        if (reused[i]) continue;
+        stale[pool.count++] = i;
+        recount += fresh->chunks[i].end - fresh->chunks[i].begin;
+    }
+    if (jobs > pool.count) jobs = pool.count ? pool.count : 1;
+    size_t started = 0;
+    for (size_t i = 0; i + 1 < jobs; ++i) {
+        if (pthread_create(&threads[i], NULL, index_worker, &pool) != 0) break;
+        ++started;
+    }
+    index_worker(&pool);
+    for (size_t i = 0; i < started; ++i) pthread_join(threads[i], NULL);
+
+    for (size_t i = 0; i < fresh->count; ++i) {
+        total->words += fresh->chunks[i].counts.words;
+        total->chars += fresh->chunks[i].counts.chars;
+        total->vowels += fresh->chunks[i].counts.vowels;
+        total->lines += fresh->chunks[i].counts.lines;
+        total->invalid += fresh->chunks[i].counts.invalid;
+    }
+    if (verbose) {
+        fprintf(stderr, "Index         : %s, %zu of %zu chunks reused, "
+                "%llu bytes counted\n",
+                !old ? "new" : appended ? "appended" : "verified",
+                reuse, fresh->count, recount);
+    }
+}
+
+/* --index: whole-file totals like -j, reusing the per-chunk counts stored
+   next to the file by the previous run (count_index.c); only the chunks
+   that changed or were appended are counted. */
+static int run_indexed(const char* path, size_t jobs, int verbose,
+                       const count_kernels_t* kernels) {
+    size_t index_len = strlen(path) + sizeof(INDEX_SUFFIX);
+    char* index_path = malloc(index_len);
+    if (!index_path) {
+        fprintf(stderr, "Out of memory\n");
         return EXIT_FAILURE;
     }
+    snprintf(index_path, index_len, "%s%s", path, INDEX_SUFFIX);
+
+    struct stat st;
+    if (stat(path, &st) != 0 || !S_ISREG(st.st_mode)) {
+        fprintf(stderr, "--index needs a regular file '%s': %s\n", path,
+                strerror(errno ? errno : ENODEV));
+        free(index_path);
+        return EXIT_FAILURE;
+    }
+    count_index_t old;
+    int have_old = (count_index_load(&old, index_path) == 0);
+    uint32_t flags = kernels->invalid ? COUNT_INDEX_UTF8 : 0;
+    index_key_t key;
+    index_key_of(&st, &key);
+
+    counts_t total = { 0, 0, 0, 0, 0 };
+    if (have_old && memcmp(&old.key, &key, sizeof(key)) == 0
+        && old.flags == flags) {
+        // Unchanged since the last run: nothing to read.
+        for (size_t i = 0; i < old.count; ++i) {
+            total.words += old.chunks[i].counts.words;
+            total.chars += old.chunks[i].counts.chars;
+            total.vowels += old.chunks[i].counts.vowels;
+            total.lines += old.chunks[i].counts.lines;
+            total.invalid += old.chunks[i].counts.invalid;
+        }
+        print_totals(&total, kernels);
+        if (verbose) {
+            fprintf(stderr, "Index         : unchanged, %zu chunks reused\n",
+                    old.count);
+        }
+        count_index_free(&old);
+        free(index_path);
+        return EXIT_SUCCESS;
+    }
+
+    // Only the stale chunks are read, so no readahead of the whole file.
+    mapped_file_t mf;
+    count_index_t fresh;
+    unsigned char* reused = NULL;
+    size_t* stale = NULL;
+    pthread_t* threads = NULL;
+    int rc = EXIT_FAILURE;
+    if (mapped_file_open_sparse(&mf, path) != 0) {
+        fprintf(stderr, "--index needs a regular file '%s': %s\n", path,
+                strerror(errno));
+        if (have_old) count_index_free(&old);
+        free(index_path);
+        return EXIT_FAILURE;
+    }
+    // The size may have changed since stat(); describe what is mapped.
+    if (fstat(mf.fd, &st) == 0) index_key_of(&st, &key);
+    key.size = mf.size;
+    if (count_index_layout(&fresh, mf.data, mf.size,
+                           COUNT_INDEX_DEFAULT_CHUNK) != 0
+        || !(reused = malloc(fresh.count + 1))
+        || !(stale = malloc((fresh.count + 1) * sizeof(size_t)))
+        || !(threads = calloc(jobs, sizeof(pthread_t)))) {
+        fprintf(stderr, "Out of memory\n");
+    }
+    else {
+        fresh.key = key;
+        fresh.flags = flags;
+        count_stale_chunks(&fresh, have_old ? &old : NULL, mf.data, reused,
+                           stale, threads, jobs, kernels, &total, verbose);
+        print_totals(&total, kernels);
+        if (count_index_save(&fresh, index_path) != 0) {
+            // The counts are right; the next run will just be slower.
+            fprintf(stderr, "Failed to write index '%s': %s\n", index_path,
+                    strerror(errno));
+        }
+        rc = EXIT_SUCCESS;
+    }
+
+    free(threads);
+    free(stale);
+    free(reused);
+    count_index_free(&fresh);
+    if (have_old) count_index_free(&old);
+    mapped_file_close(&mf);
+    free(index_path);
+    return rc;
+}
+
+/* Command line settings. */
+typedef struct {
+    const count_kernels_t* kernels;
+    int self_check;
+    int utf8;
+    int index;           /* --index: reuse the counts of unchanged chunks */
+    int follow;          /* --follow: keep counting as the file grows */
+    size_t interval;     /* seconds between running totals of --follow */
+    int stats;           /* --stats: JSON report at exit and on SIGUSR1 */
+    const char* stats_path; /* NULL: stderr */
+    int verbose;
+    long jobs;           /* -1: classic three-thread round-robin mode */
+    size_t block_lines;
+    size_t block_bytes;
+    uint32_t queue_depth; /* blocks per worker ring */
+    size_t read_size;     /* stream reader buffer size */
+    int bounded;          /* --bounded: count long lines in pieces */
+    compression_t compression; /* of the single input */
+    dispatch_policy_t dispatch; /* round-robin mode: queue of each line */
+    size_t top;           /* --top: most frequent words to print, 0 = off */
+    size_t top_memory;    /* bytes all word tables may use */
+    unsigned distinct;    /* --distinct: HyperLogLog precision, 0 = off */
+    const char* patterns; /* --patterns: pattern file, NULL = off */
+} options_t;
+
+#define DEFAULT_FOLLOW_INTERVAL 5
+
+/* --follow: prints the workers' running totals every interval. */
+typedef struct {
+    worker_arg_t* workers;  /* the three round-robin workers */
+    size_t interval;        /* seconds */
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int stop;
+} ticker_t;
+
+static void* ticker_thread(void* arg) {
+    ticker_t* t = (ticker_t*)arg;
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    pthread_mutex_lock(&t->lock);
+    while (!t->stop) {
+        deadline.tv_sec += (time_t)t->interval;
+        while (!t->stop
+               && pthread_cond_timedwait(&t->cond, &t->lock, &deadline) == 0) {
+        }
+        if (t->stop) break;
+        unsigned long long lines = 0;
+        for (int i = 0; i < 3; ++i) {
+            lines += atomic_load_explicit(&t->workers[i].lines,
+                                          memory_order_relaxed);
+        }
+        printf("Running       : %llu words, %llu chars, %llu vowels, "
+               "%llu lines\n",
+               atomic_load_explicit(&t->workers[0].progress,
+                                    memory_order_relaxed),
+               atomic_load_explicit(&t->workers[1].progress,
+                                    memory_order_relaxed),
+               atomic_load_explicit(&t->workers[2].progress,
+                                    memory_order_relaxed), lines);
+        fflush(stdout);
+    }
+    pthread_mutex_unlock(&t->lock);
+    return NULL;
+}
+
+/* --stats: what the JSON report looks at. Every counter it reads is an
+   lc_stat_t, so a dump while the pipeline runs is safe. */
+typedef struct {
+    const char* path;        /* NULL: stderr */
+    spsc_ring_t* queues;
+    worker_arg_t* workers;
+    const dispatcher_t* dispatcher;
+    stream_reader_t* reader; /* NULL while mapped */
+    unsigned long long start_ns;
+    pthread_mutex_t lock;    /* one dump at a time */
+    _Atomic int quit;
+} stats_report_t;
+
+static double ns_to_s(unsigned long long ns) {
+    return (double)ns * 1e-9;
+}
+
+static double per_second(unsigned long long n, unsigned long long ns) {
+    return ns ? (double)n / ns_to_s(ns) : 0.0;
+}
+
+/* Write one line of JSON: the reader, each queue and each worker. */
+static void stats_dump(stats_report_t* st, const char* event) {
+    static const char* const metric[3] = { "words", "chars", "vowels" };
+    pthread_mutex_lock(&st->lock);
+    FILE* out = st->path ? fopen(st->path, "a") : stderr;
+    if (!out) {
+        fprintf(stderr, "Failed to open '%s': %s\n", st->path,
+                strerror(errno));
+        pthread_mutex_unlock(&st->lock);
+        return;
+    }
+    unsigned long long now = lc_stat_now_ns();
+    unsigned long long elapsed = now - st->start_ns;
+    const dispatcher_t* d = st->dispatcher;
+    unsigned long long reader_wait = 0;
+    for (int i = 0; i < 3; ++i) {
+        reader_wait += lc_stat_get(&st->queues[i].push_wait_ns);
+    }
+
+    fprintf(out, "{\"event\":\"%s\",\"elapsed_s\":%.6f,\"stats\":%s,"
+            "\"reader\":{\"lines\":%llu,\"bytes\":%llu,"
+            "\"lines_per_s\":%.0f,\"bytes_per_s\":%.0f,"
+            "\"queue_full_wait_s\":%.6f", event, ns_to_s(elapsed),
+            LC_STATS ? "true" : "false", lc_stat_get(&d->lines_out),
+            lc_stat_get(&d->bytes_out),
+            per_second(lc_stat_get(&d->lines_out), elapsed),
+            per_second(lc_stat_get(&d->bytes_out), elapsed),
+            ns_to_s(reader_wait));
+    if (st->reader) {
+        const stream_reader_t* r = st->reader;
+        fprintf(out, ",\"stream\":{\"reads\":%llu,\"bytes\":%llu,"
+                "\"pool_waits\":%llu,\"pool_wait_s\":%.6f,"
+                "\"pool_lock_contended\":%llu}", lc_stat_get(&r->reads),
+                lc_stat_get(&r->bytes), lc_stat_get(&r->pool_waits),
+                ns_to_s(lc_stat_get(&r->pool_wait_ns)),
+                lc_stat_get(&r->pool_contended));
+    }
+    fputs("},\"queues\":[", out);
+    for (int i = 0; i < 3; ++i) {
+        spsc_ring_t* q = &st->queues[i];
+        unsigned long long pushes = lc_stat_get(&q->pushes);
+        fprintf(out, "%s{\"worker\":%d,\"capacity\":%u,\"enqueues\":%llu,"
+                "\"depth_max\":%llu,\"depth_avg\":%.2f,"
+                "\"full_parks\":%llu,\"full_wait_s\":%.6f,"
+                "\"empty_parks\":%llu,\"empty_wait_s\":%.6f}",
+                i ? "," : "", i, q->mask + 1, pushes,
+                lc_stat_get(&q->depth_max),
+                pushes ? (double)lc_stat_get(&q->depth_sum) / (double)pushes
+                       : 0.0,
+                lc_stat_get(&q->push_parks),
+                ns_to_s(lc_stat_get(&q->push_wait_ns)),
+                lc_stat_get(&q->pop_parks),
+                ns_to_s(lc_stat_get(&q->pop_wait_ns)));
+    }
+    // The split so far, over what the workers have counted: the reader's
+    // own tally is not safe to read from this thread.
+    unsigned long long counted[3], counted_total = 0, counted_max = 0;
+    for (int i = 0; i < 3; ++i) {
+        counted[i] = atomic_load_explicit(&st->workers[i].done,
+                                          memory_order_relaxed);
+        counted_total += counted[i];
+        if (counted[i] > counted_max) counted_max = counted[i];
+    }
+    fprintf(out, "],\"dispatch\":{\"policy\":\"%s\",\"imbalance\":%.4f}",
+            line_dispatch_name(d->route.policy),
+            counted_total ? 3.0 * (double)counted_max / (double)counted_total
+                            - 1.0 : 0.0);
+    fputs(",\"workers\":[", out);
+    for (int i = 0; i < 3; ++i) {
+        worker_arg_t* w = &st->workers[i];
+        unsigned long long begin = lc_stat_get(&w->start_ns);
+        unsigned long long end = lc_stat_get(&w->end_ns);
+        unsigned long long run = begin ? (end ? end : now) - begin : 0;
+        unsigned long long waited = lc_stat_get(&st->queues[i].pop_wait_ns);
+        unsigned long long busy = run > waited ? run - waited : 0;
+        unsigned long long lines = atomic_load_explicit(&w->lines,
+                                                        memory_order_relaxed);
+        unsigned long long bytes = lc_stat_get(&w->bytes);
+        fprintf(out, "%s{\"worker\":%d,\"metric\":\"%s\",\"lines\":%llu,"
+                "\"bytes\":%llu,\"busy_s\":%.6f,\"idle_s\":%.6f,"
+                "\"lines_per_s\":%.0f,\"bytes_per_s\":%.0f}",
+                i ? "," : "", i, metric[i], lines, bytes, ns_to_s(busy),
+                ns_to_s(waited), per_second(lines, busy),
+                per_second(bytes, busy));
+    }
+    fputs("]}\n", out);
+    if (out == stderr) fflush(out);
+    else fclose(out);
+    pthread_mutex_unlock(&st->lock);
+}
+
+/* Dumps the report on every SIGUSR1, which every other thread blocks. */
+static void* stats_signal_thread(void* arg) {
+    stats_report_t* st = (stats_report_t*)arg;
+    sigset_t usr1;
+    sigemptyset(&usr1);
+    sigaddset(&usr1, SIGUSR1);
+    while (1) {
+        int sig;
+        if (sigwait(&usr1, &sig) != 0) continue;
+        if (atomic_load(&st->quit)) break;
+        stats_dump(st, "signal");
+    }
+    return NULL;
+}
+
+/* Threads for the modes that count whole files: -j if given, else one
+   per CPU. */
+static size_t default_jobs(long jobs) {
+    if (jobs > 0) return (size_t)jobs;
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    return (ncpu > 0 && ncpu <= MAX_JOBS) ? (size_t)ncpu : 1;
+}
+
+/* stream_source_fn over a decoder. */
+static ssize_t decoder_source(void* ctx, char* buf, size_t len) {
+    return decoder_read((decoder_t*)ctx, buf, len);
+}
 
-    queue_t queues[3];
-    for (int i = 0; i < 3; ++i) queue_init(&queues[i]);
+/* The original design: three workers, one metric each, lines dealt out
+   round-robin in blocks. With --follow the workers and queues stay up while
+   the file grows, until SIGINT or SIGTERM. */
+static int run_round_robin(const char* path, const options_t* opts) {
+    // Prefer a zero-copy mapping; stream pipes, devices and stdin.
+    mapped_file_t mf = { -1, NULL, 0 };
+    int fd = -1;
+    int from_stdin = (strcmp(path, "-") == 0);
+    int compressed = (opts->compression != COMPRESSION_NONE);
+    int mapped = !from_stdin && !opts->follow && !compressed
+        && (mapped_file_open(&mf, path) == 0);
+    // --follow: the reader thread learns about the signals from stop_fd;
+    // no thread may take them the default way, so block them before any
+    // thread starts.
+    int stop_fd = -1;
+    if (opts->follow) {
+        sigset_t stop_signals;
+        sigemptyset(&stop_signals);
+        sigaddset(&stop_signals, SIGINT);
+        sigaddset(&stop_signals, SIGTERM);
+        pthread_sigmask(SIG_BLOCK, &stop_signals, NULL);
+        stop_fd = signalfd(-1, &stop_signals, SFD_CLOEXEC);
+        if (stop_fd < 0) {
+            fprintf(stderr, "Failed to watch for signals: %s\n",
+                    strerror(errno));
+            return EXIT_FAILURE;
+        }
+    }
+    else if (!mapped) {
+        fd = from_stdin ? STDIN_FILENO : open(path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            fprintf(stderr, "Failed to open '%s': %s\n", path, strerror(errno));
+            return EXIT_FAILURE;
+        }
+    }
+
+    // --stats: SIGUSR1 goes to stats_signal_thread() only.
+    if (opts->stats) {
+        sigset_t usr1;
+        sigemptyset(&usr1);
+        sigaddset(&usr1, SIGUSR1);
+        pthread_sigmask(SIG_BLOCK, &usr1, NULL);
+    }
+
+    spsc_ring_t queues[3];
+    for (int i = 0; i < 3; ++i) {
+        if (spsc_ring_init(&queues[i], opts->queue_depth,
+                           sizeof(line_block_t*)) != 0) {
+            fprintf(stderr, "Out of memory\n");
+            if (fd > STDIN_FILENO) close(fd);
+            mapped_file_close(&mf);
+            return EXIT_FAILURE;
+        }
+    }
 
     pthread_t threads[3];
     worker_arg_t args[3];
+    dispatcher_t d;
+    if (dispatcher_init(&d, queues, args, opts->dispatch, opts->block_lines,
+                        opts->block_bytes) != 0) {
+        fprintf(stderr, "Out of memory\n");
+        for (int i = 0; i < 3; ++i) spsc_ring_destroy(&queues[i]);
+        if (fd > STDIN_FILENO) close(fd);
+        if (stop_fd >= 0) close(stop_fd);
+        mapped_file_close(&mf);
+        return EXIT_FAILURE;
+    }
     for (int i = 0; i < 3; ++i) {
         args[i].queue = &queues[i];
 		// Instead of mode, could use pointers to functions, but this is simpler
 		args[i].mode = i + 1; // 1=words, 2=chars, 3=vowels
+        args[i].kernels = opts->kernels;
+        args[i].invalid = 0;
+        atomic_init(&args[i].progress, 0);
+        atomic_init(&args[i].lines, 0);
+        atomic_init(&args[i].done, 0);
+        atomic_init(&args[i].bytes, 0);
+        atomic_init(&args[i].start_ns, 0);
+        atomic_init(&args[i].end_ns, 0);
         if (pthread_create(&threads[i], NULL, worker_thread, &args[i]) != 0) {
             fprintf(stderr, "Failed to create thread %d\n", i);
-            fclose(f);
+            // Stop the workers that did start; nothing was sent to them.
+            for (int j = 0; j < 3; ++j) {
+                if (j < i) {
+                    spsc_ring_push(&queues[j], &d.sentinels[j]);
+                    void* res;
+                    pthread_join(threads[j], &res);
+                    free(res);
+                }
+                else {
+                    free(d.sentinels[j]);
+                }
+            }
+            for (int j = 0; j < 3; ++j) spsc_ring_destroy(&queues[j]);
+            if (fd > STDIN_FILENO) close(fd);
+            if (stop_fd >= 0) close(stop_fd);
+            mapped_file_close(&mf);
             return EXIT_FAILURE;
         }
     }
 
-    /* Read lines and distribute round-robin. Use getline (POSIX). */
-    char* linebuf = NULL;
-    size_t cap = 0;
-    ssize_t nread;
-    int idx = 0;
-    // Manually added: count lines. See the C++ single line comment style?
-	size_t line_count = 0;
-    while ((nread = getline(&linebuf, &cap, f)) != -1) {
-        char* copy = strdup(linebuf);
-        if (!copy) {
-            fprintf(stderr, "Out of memory\n");
-            free(linebuf);
-            fclose(f);
-            return EXIT_FAILURE;
-        }
-        if (queue_enqueue(&queues[idx], copy) != 0) {
-            fprintf(stderr, "Failed to enqueue line\n");
-            free(copy);
-            free(linebuf); 
-            fclose(f);
-            return EXIT_FAILURE;
+    /* Read lines and distribute them, then signal completion. */
+    stream_reader_t reader;
+    int reading = 0; /* reader started: finish it */
+    decoder_t* decoder = NULL;
+    int rc;
+    ticker_t ticker;
+    pthread_t ticker_tid;
+    int ticking = 0;
+    stats_report_t stats;
+    pthread_t stats_tid;
+    int stats_started = 0;
+    if (opts->stats) {
+        stats.path = opts->stats_path;
+        stats.queues = queues;
+        stats.workers = args;
+        stats.dispatcher = &d;
+        stats.reader = NULL;
+        stats.start_ns = lc_stat_now_ns();
+        pthread_mutex_init(&stats.lock, NULL);
+        atomic_init(&stats.quit, 0);
+    }
+    if (mapped) {
+        if (opts->stats) {
+            stats_started = (pthread_create(&stats_tid, NULL,
+                                            stats_signal_thread, &stats) == 0);
         }
-        idx = (idx + 1) % 3;
-        ++line_count;
-		// linebuf will be freed by worker threads
+        rc = distribute_range(&d, mf.data, mf.size, NULL, 0, 0);
     }
-    free(linebuf);
-    fclose(f);
-
-    /* Send sentinel (NULL) to each queue to signal completion */
-    for (int i = 0; i < 3; ++i) {
-        queue_enqueue(&queues[i], NULL);
+    else if (compressed
+             && !(decoder = decoder_open(fd, opts->compression,
+                                         default_jobs(-1)))) {
+        fprintf(stderr, "Failed to read '%s': %s\n", path, strerror(errno));
+        rc = -1;
+    }
+    else if ((compressed
+              ? stream_reader_start_source(&reader, decoder_source, decoder,
+                                           opts->read_size,
+                                           STREAM_READER_DEFAULT_BUFFERS,
+                                           opts->bounded)
+              : opts->follow
+              ? stream_reader_follow(&reader, path, stop_fd, opts->read_size,
+                                     STREAM_READER_DEFAULT_BUFFERS,
+                                     opts->bounded)
+              : stream_reader_start(&reader, fd, opts->read_size,
+                                    STREAM_READER_DEFAULT_BUFFERS,
+                                    opts->bounded)) != 0) {
+        fprintf(stderr, "Failed to read '%s': %s\n", path, strerror(errno));
+        rc = -1;
+    }
+    else {
+        reading = 1;
+        if (opts->stats) {
+            stats.reader = &reader;
+            stats_started = (pthread_create(&stats_tid, NULL,
+                                            stats_signal_thread, &stats) == 0);
+        }
+        if (opts->follow) {
+            ticker.workers = args;
+            ticker.interval = opts->interval;
+            ticker.stop = 0;
+            pthread_mutex_init(&ticker.lock, NULL);
+            pthread_cond_init(&ticker.cond, NULL);
+            ticking = (pthread_create(&ticker_tid, NULL, ticker_thread,
+                                      &ticker) == 0);
+        }
+        rc = distribute_stream(&d, &reader);
     }
+    // Also on failure: the workers, the reader and the helper threads are
+    // stopped and joined the same way.
+    dispatch_finish(&d);
 
     /* Join threads and collect totals */
     unsigned long long totals[3] = { 0,0,0 };
@@ -229,13 +1778,438 @@ int main(int argc, char** argv) {
         else {
             totals[i] = 0;
         }
-        queue_destroy(&queues[i]);
+    }
+    if (stats_started) {
+        atomic_store(&stats.quit, 1);
+        pthread_kill(stats_tid, SIGUSR1);
+        pthread_join(stats_tid, NULL);
+    }
+    if (opts->stats) {
+        stats_dump(&stats, "exit");
+        pthread_mutex_destroy(&stats.lock);
+    }
+    // Workers may hold views into the mapping or the buffers until they
+    // are joined.
+    mapped_file_close(&mf);
+    if (reading) stream_reader_finish(&reader);
+    decoder_close(decoder);
+    if (fd > STDIN_FILENO) close(fd);
+    if (ticking) {
+        pthread_mutex_lock(&ticker.lock);
+        ticker.stop = 1;
+        pthread_cond_signal(&ticker.cond);
+        pthread_mutex_unlock(&ticker.lock);
+        pthread_join(ticker_tid, NULL);
+    }
+    if (stop_fd >= 0) close(stop_fd);
+    if (rc != 0) {
+        for (int i = 0; i < 3; ++i) spsc_ring_destroy(&queues[i]);
+        return EXIT_FAILURE;
     }
 
     printf("Total words   : %llu\n", totals[0]);
     printf("Total chars   : %llu\n", totals[1]);
     printf("Total vowels  : %llu\n", totals[2]);
-	printf("Total lines   : %zu\n", line_count);
+	printf("Total lines   : %llu\n", d.lines);
+    if (opts->kernels->invalid) {
+        printf("Invalid UTF-8 : %llu\n",
+               args[0].invalid + args[1].invalid + args[2].invalid);
+    }
 
+    if (opts->verbose) {
+        // Each block costs one push and one pop; a queue of single lines
+        // would pay both per line.
+        unsigned long long per_line = 2 * (d.lines + 3);
+        unsigned long long batched = 2 * (d.batches + 3);
+        unsigned long long push_parks = 0, pop_parks = 0;
+        for (int i = 0; i < 3; ++i) {
+            push_parks += lc_stat_get(&queues[i].push_parks);
+            pop_parks += lc_stat_get(&queues[i].pop_parks);
+        }
+        fprintf(stderr, "Queue blocks  : %llu for %llu lines\n",
+                d.batches, d.lines);
+        fprintf(stderr, "Queue ops     : %llu (%llu saved vs. one per line)\n",
+                batched, per_line - batched);
+        fprintf(stderr, "Sleeps        : reader %llu (ring full), "
+                "workers %llu (ring empty)\n", push_parks, pop_parks);
+        fprintf(stderr, "Dispatch      : %s, bytes %llu / %llu / %llu, "
+                "lines %llu / %llu / %llu, imbalance %.1f%%\n",
+                line_dispatch_name(d.route.policy), d.route.sent[0],
+                d.route.sent[1], d.route.sent[2], d.route.lines[0],
+                d.route.lines[1], d.route.lines[2],
+                100.0 * line_dispatch_imbalance(&d.route));
+        if (!mapped) {
+            // strdup + free per line would have been two calls each; the
+            // reader allocates its pooled and oversize buffers once each.
+            unsigned long long buffers = reader.buffers + reader.oversize;
+            fprintf(stderr, "Line buffers  : %llu lines in %llu buffers "
+                    "(%llu allocator calls avoided)\n", d.lines, buffers,
+                    d.lines > buffers ? 2 * (d.lines - buffers) : 0ULL);
+            fprintf(stderr, "Reader        : %llu bytes in %llu reads, "
+                    "%llu buffers (%llu oversize), waited %llu times for a "
+                    "free buffer\n", lc_stat_get(&reader.bytes),
+                    lc_stat_get(&reader.reads), reader.chunks_out,
+                    reader.oversize, lc_stat_get(&reader.pool_waits));
+            if (opts->bounded) {
+                fprintf(stderr, "Bounded       : %llu cuts, %llu pieces "
+                        "continued a line\n", reader.cuts, d.pieces);
+            }
+        }
+        if (compressed) {
+            size_t threads = decoder_threads(decoder);
+            if (threads) {
+                fprintf(stderr, "Decoder       : %s, %zu threads in "
+                        "parallel\n", decompress_name(opts->compression),
+                        threads);
+            }
+            else {
+                fprintf(stderr, "Decoder       : %s, on the reader thread\n",
+                        decompress_name(opts->compression));
+            }
+        }
+        if (opts->follow) {
+            fprintf(stderr, "Follow        : %llu truncations, "
+                    "%llu rotations\n", reader.truncations, reader.rotations);
+        }
+    }
+    for (int i = 0; i < 3; ++i) spsc_ring_destroy(&queues[i]);
     return EXIT_SUCCESS;
-}
\ No newline at end of file
+}
+
+/* Parse a positive size argument; returns 0 if it is not one. */
+static size_t parse_size(const char* arg) {
+    char* end;
+    errno = 0;
+    unsigned long long v = strtoull(arg, &end, 10);
+    if (*arg == '\0' || *arg == '-' || *end != '\0' || errno != 0) return 0;
+    return (size_t)v;
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr, "Usage: %s [options] <input-file | ->\n"
+            "       %s [options] <file | directory | pattern>...\n"
+            "  -j, --jobs N          count the whole file with N threads "
+            "(0 = one per CPU);\n"
+            "                        threads of the pool in batch mode\n"
+            "  -b, --block-lines N   lines per queued block (default %d)\n"
+            "      --block-bytes N   bytes per queued block (default %d)\n"
+            "      --queue-depth N   blocks buffered per worker (default %d)\n"
+            "      --read-size N     read buffer for pipes and stdin "
+            "(default %d)\n"
+            "      --bounded         count lines longer than the read "
+            "buffer in\n"
+            "                        pieces, in memory bounded by the "
+            "buffers\n"
+            "      --dispatch NAME   queue of each line: rr (round-robin, "
+            "default),\n"
+            "                        least (fewest bytes outstanding) or p2c\n"
+            "                        (less loaded of two random queues)\n"
+            "  -k, --kernel NAME     scalar, sse2, avx2 or avx512\n"
+            "      --utf8            count code points and Unicode whitespace,\n"
+            "                        report invalid UTF-8\n"
+            "      --index           keep per-chunk counts in <file>%s and\n"
+            "                        only count what changed since\n"
+            "  -f, --follow          keep counting as the file grows, print\n"
+            "                        running totals until SIGINT/SIGTERM\n"
+            "      --interval N      seconds between running totals "
+            "(default %d)\n"
+            "      --stats[=FILE]    JSON report of the queues and workers at\n"
+            "                        exit and on SIGUSR1 (default stderr)\n"
+            "      --top K           also print the K most frequent words "
+            "(-j mode)\n"
+            "      --top-memory MB   memory for the word tables before "
+            "counts\n"
+            "                        become estimates (default %d)\n"
+            "      --distinct[=PCT]  estimate distinct words (HyperLogLog) "
+            "with\n"
+            "                        PCT%% standard error (default %.2f; "
+            "-j, batch)\n"
+            "      --patterns FILE   also count the fixed strings of FILE, "
+            "one per\n"
+            "                        line (-j, batch)\n"
+            "      --self-check      compare all kernels on the input\n"
+            "  -v, --verbose         report queue statistics\n",
+            prog, prog, DEFAULT_BLOCK_LINES, DEFAULT_BLOCK_BYTES,
+            DEFAULT_QUEUE_DEPTH, STREAM_READER_DEFAULT_BUFFER, INDEX_SUFFIX,
+            DEFAULT_FOLLOW_INTERVAL, WORD_FREQ_DEFAULT_MEMORY >> 20,
+            100.0 * hll_error(HLL_DEFAULT_PRECISION));
+}
+
+/* Compression of a single input, from its first bytes; stdin may be a
+   file or a pipe (decompress_probe()). */
+static compression_t probe_input(const char* path) {
+    if (strcmp(path, "-") == 0) return decompress_probe(STDIN_FILENO);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return COMPRESSION_NONE; /* reported when it is opened */
+    compression_t format = decompress_probe(fd);
+    close(fd);
+    return format;
+}
+
+int main(int argc, char** argv) {
+    static const struct option long_options[] = {
+        { "kernel", required_argument, NULL, 'k' },
+        { "self-check", no_argument, NULL, 'C' },
+        { "utf8", no_argument, NULL, 'U' },
+        { "index", no_argument, NULL, 'I' },
+        { "follow", no_argument, NULL, 'f' },
+        { "interval", required_argument, NULL, 'T' },
+        { "stats", optional_argument, NULL, 'S' },
+        { "jobs", required_argument, NULL, 'j' },
+        { "block-lines", required_argument, NULL, 'b' },
+        { "block-bytes", required_argument, NULL, 'B' },
+        { "queue-depth", required_argument, NULL, 'Q' },
+        { "read-size", required_argument, NULL, 'R' },
+        { "dispatch", required_argument, NULL, 'L' },
+        { "bounded", no_argument, NULL, 'O' },
+        { "top", required_argument, NULL, 'K' },
+        { "top-memory", required_argument, NULL, 'M' },
+        { "distinct", optional_argument, NULL, 'D' },
+        { "patterns", required_argument, NULL, 'P' },
+        { "verbose", no_argument, NULL, 'v' },
+        { NULL, 0, NULL, 0 }
+    };
+    options_t opts = {
+        count_kernels_best(), 0, 0, 0, 0, DEFAULT_FOLLOW_INTERVAL, 0, NULL, 0,
+        -1,
+        DEFAULT_BLOCK_LINES, DEFAULT_BLOCK_BYTES, DEFAULT_QUEUE_DEPTH,
+        STREAM_READER_DEFAULT_BUFFER, 0, COMPRESSION_NONE, DISPATCH_ROUND_ROBIN,
+        0,
+        WORD_FREQ_DEFAULT_MEMORY, 0, NULL
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "k:j:b:fv", long_options, NULL)) != -1) {
+        switch (opt) {
+        case 'j': {
+            char* end;
+            opts.jobs = strtol(optarg, &end, 10);
+            if (*optarg == '\0' || *end != '\0' || opts.jobs < 0
+                || opts.jobs > MAX_JOBS) {
+                fprintf(stderr, "Invalid job count '%s'\n", optarg);
+                return EXIT_FAILURE;
+            }
+            if (opts.jobs == 0) {
+                long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+                opts.jobs = (ncpu > 0 && ncpu <= MAX_JOBS) ? ncpu : 1;
+            }
+            break;
+        }
+        case 'b':
+            opts.block_lines = parse_size(optarg);
+            if (opts.block_lines == 0) {
+                fprintf(stderr, "Invalid block line count '%s'\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'B':
+            opts.block_bytes = parse_size(optarg);
+            if (opts.block_bytes == 0) {
+                fprintf(stderr, "Invalid block size '%s'\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'Q': {
+            size_t depth = parse_size(optarg);
+            if (depth == 0 || depth > (1u << 20)) {
+                fprintf(stderr, "Invalid queue depth '%s'\n", optarg);
+                return EXIT_FAILURE;
+            }
+            opts.queue_depth = (uint32_t)depth;
+            break;
+        }
+        case 'R':
+            opts.read_size = parse_size(optarg);
+            if (opts.read_size == 0) {
+                fprintf(stderr, "Invalid read size '%s'\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'O':
+            opts.bounded = 1;
+            break;
+        case 'L':
+            if (line_dispatch_parse(optarg, &opts.dispatch) != 0) {
+                fprintf(stderr, "Unknown dispatch policy '%s'\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'k':
+            opts.kernels = count_kernels_by_name(optarg);
+            if (!opts.kernels) {
+                fprintf(stderr, "Kernel '%s' is unknown or not supported "
+                        "by this CPU\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'C':
+            opts.self_check = 1;
+            break;
+        case 'U':
+            opts.utf8 = 1;
+            break;
+        case 'I':
+            opts.index = 1;
+            break;
+        case 'f':
+            opts.follow = 1;
+            break;
+        case 'S':
+            opts.stats = 1;
+            opts.stats_path = optarg;
+            break;
+        case 'T':
+            opts.interval = parse_size(optarg);
+            if (opts.interval == 0) {
+                fprintf(stderr, "Invalid interval '%s'\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'K':
+            opts.top = parse_size(optarg);
+            if (opts.top == 0 || opts.top > (1u << 20)) {
+                fprintf(stderr, "Invalid word count '%s'\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'M': {
+            size_t mb = parse_size(optarg);
+            if (mb == 0 || mb > ((size_t)-1 >> 20)) {
+                fprintf(stderr, "Invalid memory size '%s'\n", optarg);
+                return EXIT_FAILURE;
+            }
+            opts.top_memory = mb << 20;
+            break;
+        }
+        case 'D':
+            opts.distinct = HLL_DEFAULT_PRECISION;
+            if (optarg) {
+                char* end;
+                double pct = strtod(optarg, &end);
+                if (*optarg == '\0' || *end != '\0' || !(pct > 0.0)) {
+                    fprintf(stderr, "Invalid error '%s'\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                opts.distinct = hll_precision_for(pct / 100.0);
+            }
+            break;
+        case 'P':
+            opts.patterns = optarg;
+            break;
+        case 'v':
+            opts.verbose = 1;
+            break;
+        default:
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (argc - optind < 1) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    const char* path = argv[optind];
+    int batch_mode = (argc - optind > 1) || file_batch_is_batch_arg(path);
+    if (batch_mode && (opts.self_check || opts.index)) {
+        fprintf(stderr, "%s takes a single file\n",
+                opts.self_check ? "--self-check" : "--index");
+        return EXIT_FAILURE;
+    }
+    if (opts.follow && (batch_mode || opts.self_check || opts.index
+                        || opts.jobs >= 0 || strcmp(path, "-") == 0)) {
+        fprintf(stderr, "--follow takes a single file and the round-robin "
+                "mode\n");
+        return EXIT_FAILURE;
+    }
+    if (opts.stats && (batch_mode || opts.self_check || opts.index
+                       || opts.jobs >= 0)) {
+        fprintf(stderr, "--stats reports on the round-robin mode\n");
+        return EXIT_FAILURE;
+    }
+    if ((opts.dispatch != DISPATCH_ROUND_ROBIN || opts.bounded)
+        && (batch_mode || opts.self_check || opts.index || opts.jobs >= 0)) {
+        fprintf(stderr, "%s applies to the round-robin mode\n",
+                opts.bounded ? "--bounded" : "--dispatch");
+        return EXIT_FAILURE;
+    }
+    if (opts.top && (batch_mode || opts.self_check || opts.index
+                     || opts.follow || opts.stats || opts.utf8)) {
+        fprintf(stderr, "--top counts a single file in the -j mode, "
+                "without --utf8\n");
+        return EXIT_FAILURE;
+    }
+    if (opts.distinct && (opts.self_check || opts.index || opts.follow
+                          || opts.stats || opts.utf8)) {
+        fprintf(stderr, "--distinct counts in the -j and batch modes, "
+                "without --utf8\n");
+        return EXIT_FAILURE;
+    }
+    if (opts.patterns && (opts.self_check || opts.index || opts.follow
+                          || opts.stats)) {
+        fprintf(stderr, "--patterns counts in the -j and batch modes\n");
+        return EXIT_FAILURE;
+    }
+    if ((opts.top || opts.distinct || opts.patterns) && opts.jobs < 0
+        && !batch_mode) {
+        opts.jobs = (long)default_jobs(-1);
+    }
+    if (!batch_mode) opts.compression = probe_input(path);
+    if (opts.compression != COMPRESSION_NONE) {
+        if (!decompress_supported(opts.compression)) {
+            fprintf(stderr, "'%s' is %s compressed, which this build cannot "
+                    "decode\n", path, decompress_name(opts.compression));
+            return EXIT_FAILURE;
+        }
+        if (opts.self_check || opts.index || opts.follow || opts.jobs >= 0) {
+            fprintf(stderr, "%s input is counted in the round-robin mode "
+                    "only\n", decompress_name(opts.compression));
+            return EXIT_FAILURE;
+        }
+    }
+    if (opts.self_check) return run_self_check(path, opts.utf8);
+    if (opts.utf8) opts.kernels = count_kernels_utf8(opts.kernels);
+    pattern_set_t* patterns = NULL;
+    if (opts.patterns) {
+        patterns = pattern_set_load(opts.patterns);
+        if (!patterns) {
+            fprintf(stderr, "Cannot load patterns from '%s': %s\n",
+                    opts.patterns, errno == EINVAL ? "no pattern"
+                                                   : strerror(errno));
+            return EXIT_FAILURE;
+        }
+    }
+    if (batch_mode) {
+        file_batch_t batch;
+        file_batch_init(&batch);
+        for (int i = optind; i < argc; ++i) {
+            if (strcmp(argv[i], "-") == 0) {
+                fprintf(stderr, "- cannot be combined with other inputs\n");
+                file_batch_free(&batch);
+                pattern_set_free(patterns);
+                return EXIT_FAILURE;
+            }
+            if (file_batch_add(&batch, argv[i]) != 0) {
+                fprintf(stderr, "Out of memory\n");
+                file_batch_free(&batch);
+                pattern_set_free(patterns);
+                return EXIT_FAILURE;
+            }
+        }
+        int rc = run_batch(&batch, default_jobs(opts.jobs), opts.verbose,
+                           opts.kernels, opts.distinct, patterns);
+        file_batch_free(&batch);
+        pattern_set_free(patterns);
+        return rc;
+    }
+    if (opts.index) {
+        return run_indexed(path, default_jobs(opts.jobs), opts.verbose,
+                           opts.kernels);
+    }
+    if (opts.jobs > 0) {
+        int rc = run_chunked(path, (size_t)opts.jobs, opts.verbose,
+                             opts.kernels, opts.top, opts.top_memory,
+                             opts.distinct, patterns);
+        pattern_set_free(patterns);
+        return rc;
+    }
+    return run_round_robin(path, &opts);
+}
@@ -1,208 +1,248 @@
 /*
 C11 threads version of the line-processing program.
 
+Regular files are memory-mapped and lines are passed to the workers as
+(pointer, length) views; other inputs, and standard input given as "-",
+fall back to getline() copies.
+Counting uses the fastest SIMD kernel the CPU supports (count_kernels.c).
+Lines travel through bounded lock-free SPSC rings (spsc_ring.c), to the
+next queue in turn by default or, with --dispatch least or p2c, to the one
+with fewer bytes left to count (line_dispatch.c); with those, the bytes
+each worker got and the resulting imbalance are printed with the totals.
+
 Build (Linux, gcc, release):
-   gcc -std=gnu11 -Wall -Wextra -O2 -pthread -o line_counters main_using_threads.c
+   gcc -std=gnu11 -Wall -Wextra -O2 -pthread -o line_counters main_using_threads.c mapped_file.c count_kernels.c spsc_ring.c line_dispatch.c
 
 Remove the -O2 optimization and add -g for debugging. Otherwise won't stop at breakpoints.
-   gcc -std=gnu11 -Wall -Wextra -g -pthread -o line_counters main_using_threads.c
+   gcc -std=gnu11 -Wall -Wextra -g -pthread -o line_counters main_using_threads.c mapped_file.c count_kernels.c spsc_ring.c line_dispatch.c
 
 Run:
   ./line_counters input.txt
+  ./line_counters --dispatch least input.txt
 */
 #include <sys/types.h>
+#include <stdatomic.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <threads.h>
 #include <unistd.h>
-#include <ctype.h>
 #include <errno.h>
+#include "count_kernels.h"
+#include "line_dispatch.h"
+#include "mapped_file.h"
+#include "spsc_ring.h"
 
-/* linked queue node */
-typedef struct node {// match return type of getline.
-    char* line;
-    struct node* next;
-} node_t;
-
-/* thread-safe FIFO queue */
+/* A line view; data == NULL is the end-of-stream sentinel.
+   owned is the heap copy to free (getline fallback), NULL for mapped views. */
 typedef struct {
-    node_t* head;
-    node_t* tail;
-    mtx_t mutex;
-    cnd_t cond;
-} queue_t;
-
-static void queue_init(queue_t* q) {
-    q->head = q->tail = NULL;
-    mtx_init(&q->mutex, (int) mtx_plain); // from a nameless enum
-    cnd_init(&q->cond);
+    const char* data;
+    size_t len;
+    char* owned;
+} line_t;
+
+/* Bounded lock-free SPSC ring of line views (see spsc_ring.c). main() is
+   the only producer and each worker the only consumer of its queue, so no
+   mutex is needed; a full queue makes main() wait instead of buffering the
+   rest of the file. */
+#define QUEUE_DEPTH 4096
+typedef spsc_ring_t queue_t;
+
+static int queue_init(queue_t* q) {
+    return spsc_ring_init(q, QUEUE_DEPTH, sizeof(line_t));
 }
 
-/* Note: queue_destroy assumes queue is drained (no outstanding nodes) */
+/* Note: queue_destroy assumes queue is drained (no outstanding lines) */
 static void queue_destroy(queue_t* q) {
-    mtx_destroy(&q->mutex);
-    cnd_destroy(&q->cond);
+    spsc_ring_destroy(q);
 }
-// match return type of getline.
-static int queue_enqueue(queue_t* q, char* line) {
-    node_t* n = malloc(sizeof(node_t));
-    if (!n) return -1;
-    n->line = line;
-    n->next = NULL;
-
-    mtx_lock(&q->mutex);
-    if (q->tail) {
-        q->tail->next = n;
-        q->tail = n;
-    }
-    else {
-        q->head = q->tail = n;
-    }
-    cnd_signal(&q->cond);
-    mtx_unlock(&q->mutex);
+
+/* Waits while the queue is full. Never fails; the int matches the callers. */
+static int queue_enqueue(queue_t* q, line_t line) {
+    spsc_ring_push(q, &line);
     return 0;
 }
 
-/* Blocks until an item is available. Returns ownership of returned char* (may be NULL sentinel). */
-static char* queue_dequeue(queue_t* q) {
-    mtx_lock(&q->mutex);
-    while (q->head == NULL) {
-        cnd_wait(&q->cond, &q->mutex);
-    }
-    node_t* n = q->head;
-    q->head = n->next;
-    if (q->head == NULL) 
-        q->tail = NULL;
-    mtx_unlock(&q->mutex);
-
-    char* line = n->line;
-    free(n);
+/* Blocks until an item is available. Returns ownership of line.owned (data may be NULL sentinel). */
+static line_t queue_dequeue(queue_t* q) {
+    line_t line;
+    spsc_ring_pop(q, &line);
     return line;
 }
 
-/* Counting helpers */
-static size_t count_words(const char* s) {
-    size_t words = 0;
-    int in_word = 0;
-    for (; *s; ++s) {
-        if (!isspace((unsigned char)*s)) {
-            if (!in_word) { in_word = 1; ++words; }
-        }
-        else {
-            in_word = 0;
-        }
-    }
-    return words;
-}
-
-static size_t count_chars(const char* s) {
-    size_t chars = 0;
-    for (; *s; ++s) {
-        if (*s != '\n') ++chars;
-    }
-    return chars;
-}
+/* Bytes a worker counts between two updates of its done counter. */
+#define DONE_STEP (64 * 1024)
 
-static size_t count_vowels(const char* s) {
-    size_t v = 0;
-    for (; *s; ++s) {
-        char c = tolower((unsigned char)*s);
-        if (c == 'a' || c == 'e' || c == 'i' || c == 'o' || c == 'u') ++v;
-    }
-    return v;
-}
-
-/* Thread argument */
+/* Thread argument. done has a cache line of its own, and the workers'
+   arguments do not share one, so publishing progress does not slow down
+   the reader or the other workers. */
 typedef struct {
     queue_t* queue;
     int mode; /* 1 = words, 2 = chars, 3 = vowels */
+    int publish; /* keep done up to date: the dispatch policy reads it */
+    const count_kernels_t* kernels;
     unsigned long long total;
+    _Alignas(SPSC_CACHE_LINE) _Atomic unsigned long long done; /* bytes counted */
 } worker_arg_t;
 
 /* Thread entry (C11 thrd_start_t) */
 static int worker(void* arg) {
     worker_arg_t* w = (worker_arg_t*)arg;
     unsigned long long total = 0ULL;
+    unsigned long long done = 0ULL;
+    unsigned long long published = 0ULL;
     printf("Thread mode %d running in process %d\n", w->mode, (int) getpid());
     for (;;) {
-        char* line = queue_dequeue(w->queue);
-        if (line == NULL) break; /* sentinel => no more data */
+        line_t line = queue_dequeue(w->queue);
+        if (line.data == NULL) break; /* sentinel => no more data */
 
         size_t c = 0;
-        if (w->mode == 1) c = count_words(line);
-        else if (w->mode == 2) c = count_chars(line);
-        else if (w->mode == 3) c = count_vowels(line);
+        if (w->mode == 1) c = w->kernels->words(line.data, line.len);
+        else if (w->mode == 2) c = w->kernels->chars(line.data, line.len);
+        else if (w->mode == 3) c = w->kernels->vowels(line.data, line.len);
 
         total += c;
-        free(line);
+        done += line.len;
+        if (w->publish && done - published >= DONE_STEP) {
+            atomic_store_explicit(&w->done, done, memory_order_relaxed);
+            published = done;
+        }
+        free(line.owned);
     }
+    atomic_store_explicit(&w->done, done, memory_order_relaxed);
 
     w->total = total;
     printf("Thread mode %d running in process %d returning total %lld\n", w->mode, (int) getpid(), w->total);
     return 0;
 }
 
+/* Distribute the lines of a mapped file as views into the mapping.
+   Returns the number of lines, or -1 if a line cannot be queued. */
+static long long distribute_mapped(queue_t* queues, line_dispatch_t* d,
+                                   const mapped_file_t* mf) {
+    const char* p = mf->data;
+    const char* const end = p + mf->size;
+    long long line_count = 0;
+    while (p < end) {
+        const char* nl = memchr(p, '\n', (size_t)(end - p));
+        size_t len = nl ? (size_t)(nl - p) + 1 : (size_t)(end - p);
+        line_t line = { p, len, NULL };
+        if (queue_enqueue(&queues[line_dispatch_pick(d, len)], line) != 0) {
+            fprintf(stderr, "Failed to enqueue line\n");
+            return -1;
+        }
+        ++line_count;
+        p += len;
+    }
+    return line_count;
+}
+
+/* Fallback for unmappable inputs: getline (POSIX) plus one heap copy per line.
+   Returns the number of lines, or -1 on error. */
+static long long distribute_getline(queue_t* queues, line_dispatch_t* d,
+                                    FILE* f) {
+    char* linebuf = NULL;
+    size_t cap = 0;
+    ssize_t nread; 
+    long long line_count = 0;
+
+    while ((nread = getline(&linebuf, &cap, f)) != -1) {
+        char* copy = malloc((size_t)nread + 1);
+        if (!copy) {
+            fprintf(stderr, "Out of memory\n");
+            free(linebuf);
+            return -1;
+        }
+        memcpy(copy, linebuf, (size_t)nread + 1);
+        line_t line = { copy, (size_t)nread, copy };
+        size_t idx = line_dispatch_pick(d, (size_t)nread);
+        if (queue_enqueue(&queues[idx], line) != 0) {
+            fprintf(stderr, "Failed to enqueue line\n");
+            free(copy);
+            free(linebuf);
+            return -1;
+        }
+        ++line_count;
+    }
+    free(linebuf);
+    return line_count;
+}
+
 int main(int argc, char** argv) {
+    dispatch_policy_t policy = DISPATCH_ROUND_ROBIN;
+    if (argc == 4 && strcmp(argv[1], "--dispatch") == 0) {
+        if (line_dispatch_parse(argv[2], &policy) != 0) {
+            fprintf(stderr, "Unknown dispatch policy '%s'\n", argv[2]);
+            return EXIT_FAILURE;
+        }
+        argv[2] = argv[0];
+        argv += 2;
+        argc -= 2;
+    }
     if (argc != 2) {
-        fprintf(stderr, "Usage: %s <input-file>\n", argv[0]);
+        fprintf(stderr, "Usage: %s [--dispatch rr|least|p2c] "
+                "<input-file | ->\n", argv[0]);
         return EXIT_FAILURE;
     }
 
-    FILE* f = fopen(argv[1], "r");
-    if (!f) {
-        fprintf(stderr, "Failed to open '%s': %s\n", argv[1], strerror(errno));
-        return EXIT_FAILURE;
+    mapped_file_t mf = { -1, NULL, 0 };
+    FILE* f = NULL;
+    int from_stdin = (strcmp(argv[1], "-") == 0);
+    int mapped = !from_stdin && (mapped_file_open(&mf, argv[1]) == 0);
+    if (!mapped) {
+        f = from_stdin ? stdin : fopen(argv[1], "r");
+        if (!f) {
+            fprintf(stderr, "Failed to open '%s': %s\n", argv[1], strerror(errno));
+            return EXIT_FAILURE;
+        }
     }
     printf("%s running with pid=%d on file %s\n", argv[0], (int) getpid(), argv[1]);
     queue_t queues[3];
-    for (int i = 0; i < 3; ++i) queue_init(&queues[i]);
+    for (int i = 0; i < 3; ++i) {
+        if (queue_init(&queues[i]) != 0) {
+            fprintf(stderr, "Out of memory\n");
+            if (f) fclose(f);
+            mapped_file_close(&mf);
+            return EXIT_FAILURE;
+        }
+    }
 
     thrd_t threads[3];
     worker_arg_t args[3];
     for (int i = 0; i < 3; ++i) {
         args[i].queue = &queues[i];
         args[i].mode = i + 1; /* 1=words,2=chars,3=vowels */
+        args[i].publish = (policy != DISPATCH_ROUND_ROBIN);
+        args[i].kernels = count_kernels_best();
         args[i].total = 0;
+        atomic_init(&args[i].done, 0);
         if (thrd_create(&threads[i], worker, &args[i]) != thrd_success) {
             fprintf(stderr, "Failed to create thread %d\n", i);
-            fclose(f);
+            if (f) fclose(f);
+            mapped_file_close(&mf);
             return EXIT_FAILURE;
         }
     }
 
-    /* Read lines and distribute round-robin using getline (POSIX) */
-    char* linebuf = NULL;
-    size_t cap = 0;
-    ssize_t nread; 
-    int idx = 0;
-    size_t line_count = 0;
-
-    while ((nread = getline(&linebuf, &cap, f)) != -1) {
-        char* copy = strdup(linebuf);
-        if (!copy) {
-            fprintf(stderr, "Out of memory\n");
-            free(linebuf);
-            fclose(f);
-            return EXIT_FAILURE;
-        }
-        if (queue_enqueue(&queues[idx], copy) != 0) {
-            fprintf(stderr, "Failed to enqueue line\n");
-            free(copy);
-            free(linebuf);
-            fclose(f);
-            return EXIT_FAILURE;
-        }
-        idx = (idx + 1) % 3;
-        ++line_count;
+    /* Read lines and distribute them */
+    const _Atomic unsigned long long* done[3] = {
+        &args[0].done, &args[1].done, &args[2].done
+    };
+    line_dispatch_t d;
+    line_dispatch_init(&d, policy, 3, done);
+    long long line_count = mapped ? distribute_mapped(queues, &d, &mf)
+                                  : distribute_getline(queues, &d, f);
+    if (f) fclose(f);
+    if (line_count < 0) {
+        mapped_file_close(&mf);
+        return EXIT_FAILURE;
     }
-    free(linebuf);
-    fclose(f);
 
     /* Send sentinel (NULL) to each queue to signal completion */
+    const line_t sentinel = { NULL, 0, NULL };
     for (int i = 0; i < 3; ++i) {
-        queue_enqueue(&queues[i], NULL);
+        queue_enqueue(&queues[i], sentinel);
     }
 
     /* Join threads and collect totals */
@@ -212,11 +252,17 @@ int main(int argc, char** argv) {
         totals[i] = args[i].total;
         queue_destroy(&queues[i]);
     }
+    mapped_file_close(&mf); /* workers are joined; no views remain */
 
     printf("One third words   : %llu\n", totals[0]);
     printf("One third chars   : %llu\n", totals[1]);
     printf("One third vowels  : %llu\n", totals[2]);
-    printf("Total lines   : %zu\n", line_count);
+    printf("Total lines   : %lld\n", line_count);
+    if (policy != DISPATCH_ROUND_ROBIN) {
+        printf("Dispatch      : %s, bytes %llu / %llu / %llu, imbalance %.1f%%\n",
+               line_dispatch_name(policy), d.sent[0], d.sent[1], d.sent[2],
+               100.0 * line_dispatch_imbalance(&d));
+    }
 
     return EXIT_SUCCESS;
 }
\ No newline at end of file
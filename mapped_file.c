@@ -0,0 +1,86 @@
+/*
+Memory-mapped input for the line counters.
+
+Mapping the file lets the reader hand (pointer, length) views of each line
+to the workers instead of copying every line to the heap. The kernel pages
+the file in on demand; the madvise/fadvise hints below ask it to read ahead
+aggressively and drop pages behind us, which is what a single linear scan
+over a multi-GB log wants.
+*/
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <unistd.h>
+#include "mapped_file.h"
+
+static int map_file(mapped_file_t* mf, const char* path, int sequential) {
+    mf->fd = -1;
+    mf->data = NULL;
+    mf->size = 0;
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        // Pipes, ttys and devices cannot be mapped; let the caller stream them.
+        int saved = (errno != 0) ? errno : ENODEV;
+        close(fd);
+        errno = saved;
+        return -1;
+    }
+
+    mf->fd = fd;
+    mf->size = (size_t)st.st_size;
+    if (mf->size == 0) return 0; /* mmap rejects zero-length mappings */
+
+    void* p = mmap(NULL, mf->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p == MAP_FAILED) {
+        int saved = errno;
+        close(fd);
+        mf->fd = -1;
+        mf->size = 0;
+        errno = saved;
+        return -1;
+    }
+    mf->data = p;
+
+    // Hints only: failures are harmless, so the return values are ignored.
+    if (sequential) {
+        (void)posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        (void)madvise(p, mf->size, MADV_SEQUENTIAL);
+        (void)madvise(p, mf->size, MADV_WILLNEED);
+    }
+    return 0;
+}
+
+int mapped_file_open(mapped_file_t* mf, const char* path) {
+    return map_file(mf, path, 1);
+}
+
+int mapped_file_open_sparse(mapped_file_t* mf, const char* path) {
+    return map_file(mf, path, 0);
+}
+
+void mapped_file_advise(const mapped_file_t* mf, size_t begin, size_t end) {
+    if (!mf->data || begin >= end || end > mf->size) return;
+    // madvise wants a page-aligned start; the hints stay harmless if they fail.
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t start = begin - begin % page;
+    (void)posix_fadvise(mf->fd, (off_t)begin, (off_t)(end - begin),
+                        POSIX_FADV_WILLNEED);
+    (void)madvise((void*)(mf->data + start), end - start, MADV_SEQUENTIAL);
+    (void)madvise((void*)(mf->data + start), end - start, MADV_WILLNEED);
+}
+
+void mapped_file_close(mapped_file_t* mf) {
+    if (mf->data) munmap((void*)mf->data, mf->size);
+    if (mf->fd >= 0) close(mf->fd);
+    mf->fd = -1;
+    mf->data = NULL;
+    mf->size = 0;
+}
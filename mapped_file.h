@@ -0,0 +1,30 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <stddef.h>
+
+/* A read-only memory mapping of a whole input file. */
+typedef struct {
+    int fd;
+    const char* data;  /* NULL when the file is empty */
+    size_t size;
+} mapped_file_t;
+
+/* Map a regular file for sequential reading.
+   Returns 0 on success, -1 if the input cannot be mapped (pipe, tty,
+   special file, mmap failure); errno is set and the caller should fall
+   back to stream reading. */
+int mapped_file_open(mapped_file_t* mf, const char* path);
+
+/* Like mapped_file_open(), but without asking the kernel to read the whole
+   file ahead: for callers that touch only a few parts of a large file. */
+int mapped_file_open_sparse(mapped_file_t* mf, const char* path);
+
+/* Ask for sequential readahead of [begin, end) only, for a caller that
+   scans one piece of a file opened with mapped_file_open_sparse(). */
+void mapped_file_advise(const mapped_file_t* mf, size_t begin, size_t end);
+
+/* Unmap and close. Safe to call after a failed mapped_file_open(). */
+void mapped_file_close(mapped_file_t* mf);
+
+#endif /* MAPPED_FILE_H */
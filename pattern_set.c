@@ -0,0 +1,562 @@
+/*
+Fixed-string pattern counts for --patterns.
+
+Counting a few dozen error codes or host names with grep means another pass
+over the file per run, or per pattern. Here the -j and batch workers scan
+every range for all patterns right after counting its words, while the
+bytes are still in cache.
+
+Small sets (up to 64 patterns) use Teddy, the SIMD prefilter of Hyperscan:
+patterns are grouped into 8 buckets and, for each of the first 1-3 bytes of
+a pattern, two 16-entry tables map the low and high nibble of a byte to the
+buckets that have that nibble there. One pshufb per table looks up 16 (or
+32 with AVX2) input bytes at once, and ANDing the results for the three
+positions leaves, per input byte, the buckets that may have a pattern
+starting there. Those rare candidates are verified with memcmp against the
+bucket's patterns. Patterns are sorted before being bucketed, so patterns
+with the same prefix share a bucket and do not widen the others' masks.
+
+Larger sets use an Aho-Corasick automaton compiled into a DFA: bytes that
+occur in no pattern share one class, which keeps the transition table at
+states x classes entries, and states are numbered so that every state where
+a pattern ends comes last. The inner loop is then one table load per byte
+and one compare; the patterns ending at a state (its own and those of its
+suffixes) are listed once, when the automaton is built.
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "pattern_set.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define PATTERN_SET_X86 1
+#include <immintrin.h>
+#endif
+
+#define TEDDY_BUCKETS 8
+#define TEDDY_FINGERPRINT 3  /* leading bytes looked up per pattern */
+
+typedef void (*scan_fn)(const pattern_set_t* ps, const char* text,
+                        size_t len, unsigned long long* counts);
+
+/* Patterns ending at a match state of the automaton. */
+typedef struct {
+    uint32_t start;
+    uint32_t count;
+} match_list_t;
+
+struct pattern_set {
+    char* text;               /* the pattern file; patterns point into it */
+    const char** patterns;
+    size_t* lens;
+    size_t count;
+    size_t min_len;
+    scan_fn scan;
+    const char* matcher;
+
+    /* Aho-Corasick */
+    uint8_t classes[256];     /* byte -> class; 0 for bytes in no pattern */
+    uint32_t class_count;
+    uint32_t* delta;          /* state * class_count + class -> next state,
+                                 pre-multiplied by class_count */
+    uint32_t first_match;     /* states from here on end a pattern */
+    match_list_t* matches;    /* per match state */
+    uint32_t* outputs;
+
+    /* Teddy */
+    uint8_t lo[TEDDY_FINGERPRINT][16];  /* low nibble -> buckets */
+    uint8_t hi[TEDDY_FINGERPRINT][16];  /* high nibble -> buckets */
+    uint32_t bucket_start[TEDDY_BUCKETS + 1];
+    uint32_t* bucket_patterns;
+};
+
+/* ---- Loading ----------------------------------------------------------------- */
+
+/* Read all of fd into a malloc'd buffer; returns NULL with errno set. */
+static char* read_all(int fd, size_t* size) {
+    size_t cap = 4096, n = 0;
+    char* buf = malloc(cap);
+    while (buf) {
+        if (n == cap) {
+            char* grown = realloc(buf, cap * 2);
+            if (!grown) break;
+            buf = grown;
+            cap *= 2;
+        }
+        ssize_t r = read(fd, buf + n, cap - n);
+        if (r < 0 && errno == EINTR) continue;
+        if (r < 0) {
+            int error = errno;
+            free(buf);
+            errno = error;
+            return NULL;
+        }
+        if (r == 0) {
+            *size = n;
+            return buf;
+        }
+        n += (size_t)r;
+    }
+    free(buf);
+    errno = ENOMEM;
+    return NULL;
+}
+
+/* Split the file into patterns, one per non-empty line. */
+static int split_patterns(pattern_set_t* ps, size_t size) {
+    size_t lines = 1;
+    for (size_t i = 0; i < size; ++i) lines += (ps->text[i] == '\n');
+    ps->patterns = malloc(lines * sizeof(const char*));
+    ps->lens = malloc(lines * sizeof(size_t));
+    if (!ps->patterns || !ps->lens) return ENOMEM;
+    const char* s = ps->text;
+    const char* end = ps->text + size;
+    while (s < end) {
+        const char* nl = memchr(s, '\n', (size_t)(end - s));
+        const char* line_end = nl ? nl : end;
+        size_t len = (size_t)(line_end - s);
+        if (len > 0) {
+            ps->patterns[ps->count] = s;
+            ps->lens[ps->count] = len;
+            if (ps->count == 0 || len < ps->min_len) ps->min_len = len;
+            ++ps->count;
+        }
+        s = line_end + 1;
+    }
+    return ps->count ? 0 : EINVAL;
+}
+
+/* ---- Aho-Corasick ------------------------------------------------------------ */
+
+static void scan_automaton(const pattern_set_t* ps, const char* text,
+                           size_t len, unsigned long long* counts) {
+    const uint32_t* delta = ps->delta;
+    const uint8_t* classes = ps->classes;
+    const uint32_t first_match = ps->first_match;
+    uint32_t s = 0;
+    for (size_t i = 0; i < len; ++i) {
+        s = delta[s + classes[(unsigned char)text[i]]];
+        if (s >= first_match) {
+            const match_list_t* m =
+                &ps->matches[(s - first_match) / ps->class_count];
+            for (uint32_t k = 0; k < m->count; ++k) {
+                ++counts[ps->outputs[m->start + k]];
+            }
+        }
+    }
+}
+
+/* Scratch space of the construction. */
+typedef struct {
+    uint32_t* node_of;   /* pattern -> state where it ends */
+    uint32_t* fail;
+    uint32_t* order;     /* states in breadth-first order */
+    uint32_t* own;       /* patterns ending exactly at a state */
+    uint32_t* total;     /* ... and at its suffixes */
+    uint32_t* start;     /* first output of a state */
+    uint32_t* renumber;
+} ac_build_t;
+
+static void ac_build_free(ac_build_t* b) {
+    free(b->node_of);
+    free(b->fail);
+    free(b->order);
+    free(b->own);
+    free(b->total);
+    free(b->start);
+    free(b->renumber);
+}
+
+/* Build the trie in ps->delta; returns the number of states. */
+static uint32_t build_trie(pattern_set_t* ps, ac_build_t* b) {
+    const uint32_t nc = ps->class_count;
+    uint32_t states = 1;
+    for (size_t i = 0; i < ps->count; ++i) {
+        uint32_t s = 0;
+        for (size_t j = 0; j < ps->lens[i]; ++j) {
+            unsigned char c = (unsigned char)ps->patterns[i][j];
+            uint32_t* next = &ps->delta[(size_t)s * nc + ps->classes[c]];
+            if (!*next) *next = states++;  /* no edge leads back to the root */
+            s = *next;
+        }
+        b->node_of[i] = s;
+    }
+    return states;
+}
+
+/* Turn the trie into a DFA: a missing edge goes where the longest proper
+   suffix that is in the trie would go. Breadth-first, so that the row of
+   a state's failure link is complete before it is used. */
+static void build_failure(pattern_set_t* ps, ac_build_t* b) {
+    const uint32_t nc = ps->class_count;
+    size_t head = 0, tail = 1;
+    b->order[0] = 0;
+    b->fail[0] = 0;
+    while (head < tail) {
+        uint32_t s = b->order[head++];
+        for (uint32_t c = 0; c < nc; ++c) {
+            uint32_t* next = &ps->delta[(size_t)s * nc + c];
+            uint32_t via_fail = s ? ps->delta[(size_t)b->fail[s] * nc + c] : 0;
+            if (*next) {
+                b->fail[*next] = via_fail;
+                b->order[tail++] = *next;
+            }
+            else {
+                *next = via_fail;
+            }
+        }
+    }
+}
+
+/* List, per state, the patterns that end there or at one of its suffixes. */
+static int build_outputs(pattern_set_t* ps, ac_build_t* b, uint32_t states) {
+    for (size_t i = 0; i < ps->count; ++i) ++b->own[b->node_of[i]];
+    size_t outputs = 0;
+    for (uint32_t k = 0; k < states; ++k) {
+        uint32_t s = b->order[k];
+        b->total[s] = b->own[s] + (s ? b->total[b->fail[s]] : 0);
+        b->start[s] = (uint32_t)outputs;
+        outputs += b->total[s];
+        if (outputs > UINT32_MAX) return E2BIG;
+    }
+    ps->outputs = malloc((outputs ? outputs : 1) * sizeof(uint32_t));
+    if (!ps->outputs) return ENOMEM;
+    // Own patterns first, in file order; b->own becomes a fill cursor.
+    for (uint32_t s = 0; s < states; ++s) b->own[s] = b->start[s];
+    for (size_t i = 0; i < ps->count; ++i) {
+        ps->outputs[b->own[b->node_of[i]]++] = (uint32_t)i;
+    }
+    for (uint32_t k = 1; k < states; ++k) {
+        uint32_t s = b->order[k];
+        uint32_t f = b->fail[s];
+        memcpy(&ps->outputs[b->own[s]], &ps->outputs[b->start[f]],
+               b->total[f] * sizeof(uint32_t));
+    }
+    return 0;
+}
+
+/* Number the states without output first, so that "a pattern ends here"
+   is one compare, and pre-multiply the targets by the class count. */
+static int renumber_states(pattern_set_t* ps, ac_build_t* b, uint32_t states) {
+    const uint32_t nc = ps->class_count;
+    uint32_t quiet = 0;
+    for (uint32_t s = 0; s < states; ++s) quiet += (b->total[s] == 0);
+    ps->matches = malloc(((states - quiet) ? states - quiet : 1)
+                         * sizeof(match_list_t));
+    uint32_t* delta = malloc((size_t)states * nc * sizeof(uint32_t));
+    if (!ps->matches || !delta) {
+        free(delta);
+        return ENOMEM;
+    }
+    uint32_t next_quiet = 0, next_match = 0;
+    for (uint32_t s = 0; s < states; ++s) {
+        if (b->total[s] == 0) {
+            b->renumber[s] = next_quiet++;  /* the root stays 0 */
+        }
+        else {
+            ps->matches[next_match].start = b->start[s];
+            ps->matches[next_match].count = b->total[s];
+            b->renumber[s] = quiet + next_match++;
+        }
+    }
+    for (uint32_t s = 0; s < states; ++s) {
+        const uint32_t* from = &ps->delta[(size_t)s * nc];
+        uint32_t* to = &delta[(size_t)b->renumber[s] * nc];
+        for (uint32_t c = 0; c < nc; ++c) to[c] = b->renumber[from[c]] * nc;
+    }
+    free(ps->delta);
+    ps->delta = delta;
+    ps->first_match = quiet * nc;
+    return 0;
+}
+
+static int build_automaton(pattern_set_t* ps) {
+    uint32_t nc = 1;
+    size_t total_len = 0;
+    for (size_t i = 0; i < ps->count; ++i) {
+        for (size_t j = 0; j < ps->lens[i]; ++j) {
+            unsigned char c = (unsigned char)ps->patterns[i][j];
+            if (!ps->classes[c]) ps->classes[c] = (uint8_t)nc++;
+        }
+        total_len += ps->lens[i];
+    }
+    ps->class_count = nc;
+    // Worst case every byte of every pattern is a state of its own.
+    size_t max_states = total_len + 1;
+    if (max_states > UINT32_MAX / nc) return E2BIG;
+    ps->delta = calloc(max_states * nc, sizeof(uint32_t));
+    ac_build_t b = {
+        malloc(ps->count * sizeof(uint32_t)),
+        calloc(max_states, sizeof(uint32_t)),
+        calloc(max_states, sizeof(uint32_t)),
+        calloc(max_states, sizeof(uint32_t)),
+        calloc(max_states, sizeof(uint32_t)),
+        calloc(max_states, sizeof(uint32_t)),
+        calloc(max_states, sizeof(uint32_t))
+    };
+    int rc = ENOMEM;
+    if (ps->delta && b.node_of && b.fail && b.order && b.own && b.total
+        && b.start && b.renumber) {
+        uint32_t states = build_trie(ps, &b);
+        build_failure(ps, &b);
+        rc = build_outputs(ps, &b, states);
+        if (rc == 0) rc = renumber_states(ps, &b, states);
+    }
+    ac_build_free(&b);
+    ps->scan = scan_automaton;
+    ps->matcher = "aho-corasick";
+    return rc;
+}
+
+/* ---- Teddy ------------------------------------------------------------------- */
+
+/* Leading bytes of every pattern that the tables look at. */
+static inline size_t fingerprint_len(const pattern_set_t* ps) {
+    return ps->min_len < TEDDY_FINGERPRINT ? ps->min_len : TEDDY_FINGERPRINT;
+}
+
+/* Count the patterns of the candidate buckets that start at text[pos]. */
+static inline void teddy_verify(const pattern_set_t* ps, const char* text,
+                                size_t len, size_t pos, unsigned buckets,
+                                unsigned long long* counts) {
+    while (buckets) {
+        unsigned b = (unsigned)__builtin_ctz(buckets);
+        buckets &= buckets - 1;
+        for (uint32_t k = ps->bucket_start[b]; k < ps->bucket_start[b + 1]; ++k) {
+            uint32_t id = ps->bucket_patterns[k];
+            size_t n = ps->lens[id];
+            if (n <= len - pos && memcmp(text + pos, ps->patterns[id], n) == 0) {
+                ++counts[id];
+            }
+        }
+    }
+}
+
+/* The last bytes, one position at a time with the same tables. */
+static void teddy_tail(const pattern_set_t* ps, const char* text, size_t len,
+                       size_t pos, unsigned long long* counts) {
+    // No pattern is shorter than the fingerprint, so none starts later.
+    size_t m = fingerprint_len(ps);
+    for (; pos + m <= len; ++pos) {
+        unsigned buckets = 0xff;
+        for (size_t k = 0; k < m; ++k) {
+            unsigned char c = (unsigned char)text[pos + k];
+            buckets &= ps->lo[k][c & 15] & ps->hi[k][c >> 4];
+        }
+        if (buckets) teddy_verify(ps, text, len, pos, buckets, counts);
+    }
+}
+
+#ifdef PATTERN_SET_X86
+
+#define SSSE3_TARGET __attribute__((target("ssse3")))
+#define AVX2_TARGET __attribute__((target("avx2")))
+
+/* Buckets that may have a pattern starting at each of the 16 bytes. */
+SSSE3_TARGET static inline __m128i teddy_ssse3(const pattern_set_t* ps,
+                                               const char* s) {
+    const __m128i nibble = _mm_set1_epi8(0x0f);
+    __m128i res = _mm_set1_epi8(-1);
+    for (int k = 0; k < TEDDY_FINGERPRINT; ++k) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(s + k));
+        __m128i lo = _mm_shuffle_epi8(
+            _mm_loadu_si128((const __m128i*)ps->lo[k]), _mm_and_si128(v, nibble));
+        __m128i hi = _mm_shuffle_epi8(
+            _mm_loadu_si128((const __m128i*)ps->hi[k]),
+            _mm_and_si128(_mm_srli_epi16(v, 4), nibble));
+        res = _mm_and_si128(res, _mm_and_si128(lo, hi));
+    }
+    return res;
+}
+
+SSSE3_TARGET static void scan_teddy_ssse3(const pattern_set_t* ps,
+                                          const char* text, size_t len,
+                                          unsigned long long* counts) {
+    size_t i = 0;
+    for (; i + 16 + TEDDY_FINGERPRINT - 1 <= len; i += 16) {
+        __m128i res = teddy_ssse3(ps, text + i);
+        uint32_t hits = ~(uint32_t)_mm_movemask_epi8(
+            _mm_cmpeq_epi8(res, _mm_setzero_si128())) & 0xffff;
+        if (!hits) continue;
+        uint8_t buckets[16];
+        _mm_storeu_si128((__m128i*)buckets, res);
+        for (; hits; hits &= hits - 1) {
+            unsigned j = (unsigned)__builtin_ctz(hits);
+            teddy_verify(ps, text, len, i + j, buckets[j], counts);
+        }
+    }
+    teddy_tail(ps, text, len, i, counts);
+}
+
+/* The same on 32 bytes; pshufb looks up within each 128-bit lane, so the
+   tables are repeated in both. */
+AVX2_TARGET static void scan_teddy_avx2(const pattern_set_t* ps,
+                                        const char* text, size_t len,
+                                        unsigned long long* counts) {
+    const __m256i nibble = _mm256_set1_epi8(0x0f);
+    __m256i lo[TEDDY_FINGERPRINT], hi[TEDDY_FINGERPRINT];
+    for (int k = 0; k < TEDDY_FINGERPRINT; ++k) {
+        lo[k] = _mm256_broadcastsi128_si256(
+            _mm_loadu_si128((const __m128i*)ps->lo[k]));
+        hi[k] = _mm256_broadcastsi128_si256(
+            _mm_loadu_si128((const __m128i*)ps->hi[k]));
+    }
+    size_t i = 0;
+    for (; i + 32 + TEDDY_FINGERPRINT - 1 <= len; i += 32) {
+        __m256i res = _mm256_set1_epi8(-1);
+        for (int k = 0; k < TEDDY_FINGERPRINT; ++k) {
+            __m256i v = _mm256_loadu_si256((const __m256i*)(text + i + k));
+            __m256i l = _mm256_shuffle_epi8(lo[k], _mm256_and_si256(v, nibble));
+            __m256i h = _mm256_shuffle_epi8(
+                hi[k], _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble));
+            res = _mm256_and_si256(res, _mm256_and_si256(l, h));
+        }
+        uint32_t hits = ~(uint32_t)_mm256_movemask_epi8(
+            _mm256_cmpeq_epi8(res, _mm256_setzero_si256()));
+        if (!hits) continue;
+        uint8_t buckets[32];
+        _mm256_storeu_si256((__m256i*)buckets, res);
+        for (; hits; hits &= hits - 1) {
+            unsigned j = (unsigned)__builtin_ctz(hits);
+            teddy_verify(ps, text, len, i + j, buckets[j], counts);
+        }
+    }
+    teddy_tail(ps, text, len, i, counts);
+}
+
+#endif /* PATTERN_SET_X86 */
+
+typedef struct {
+    const char* pattern;
+    size_t len;
+    uint32_t id;
+} teddy_sort_t;
+
+/* Byte order, so that patterns with a common prefix end up together. */
+static int by_bytes(const void* a, const void* b) {
+    const teddy_sort_t* x = a;
+    const teddy_sort_t* y = b;
+    size_t n = x->len < y->len ? x->len : y->len;
+    int c = memcmp(x->pattern, y->pattern, n);
+    if (c) return c;
+    if (x->len != y->len) return x->len < y->len ? -1 : 1;
+    return (x->id > y->id) - (x->id < y->id);
+}
+
+/* Returns 0 if Teddy is set up, 1 if it does not apply to this set or CPU,
+   or an errno. */
+static int build_teddy(pattern_set_t* ps) {
+#ifdef PATTERN_SET_X86
+    if (ps->count > PATTERN_SET_TEDDY_MAX
+        || !__builtin_cpu_supports("ssse3")) {
+        return 1;
+    }
+    teddy_sort_t* sorted = malloc(ps->count * sizeof(teddy_sort_t));
+    ps->bucket_patterns = malloc(ps->count * sizeof(uint32_t));
+    if (!sorted || !ps->bucket_patterns) {
+        free(sorted);
+        return ENOMEM;
+    }
+    for (size_t i = 0; i < ps->count; ++i) {
+        teddy_sort_t e = { ps->patterns[i], ps->lens[i], (uint32_t)i };
+        sorted[i] = e;
+    }
+    qsort(sorted, ps->count, sizeof(teddy_sort_t), by_bytes);
+    for (size_t i = 0; i < ps->count; ++i) ps->bucket_patterns[i] = sorted[i].id;
+    free(sorted);
+    // Contiguous runs of the sorted patterns, as even as possible.
+    for (unsigned b = 0; b <= TEDDY_BUCKETS; ++b) {
+        ps->bucket_start[b] = (uint32_t)(ps->count * b / TEDDY_BUCKETS);
+    }
+    // Positions past the fingerprint accept any byte.
+    size_t m = fingerprint_len(ps);
+    memset(ps->lo, 0, sizeof(ps->lo));
+    memset(ps->hi, 0, sizeof(ps->hi));
+    for (size_t k = m; k < TEDDY_FINGERPRINT; ++k) {
+        memset(ps->lo[k], 0xff, 16);
+        memset(ps->hi[k], 0xff, 16);
+    }
+    for (unsigned b = 0; b < TEDDY_BUCKETS; ++b) {
+        for (uint32_t i = ps->bucket_start[b]; i < ps->bucket_start[b + 1]; ++i) {
+            const char* p = ps->patterns[ps->bucket_patterns[i]];
+            for (size_t k = 0; k < m; ++k) {
+                unsigned char c = (unsigned char)p[k];
+                ps->lo[k][c & 15] |= (uint8_t)(1u << b);
+                ps->hi[k][c >> 4] |= (uint8_t)(1u << b);
+            }
+        }
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        ps->scan = scan_teddy_avx2;
+        ps->matcher = "teddy-avx2";
+    }
+    else {
+        ps->scan = scan_teddy_ssse3;
+        ps->matcher = "teddy-ssse3";
+    }
+    return 0;
+#else
+    (void)ps;
+    return 1;
+#endif
+}
+
+/* ---- Interface --------------------------------------------------------------- */
+
+pattern_set_t* pattern_set_load(const char* path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return NULL;
+    pattern_set_t* ps = calloc(1, sizeof(pattern_set_t));
+    size_t size = 0;
+    int rc = ENOMEM;
+    if (ps) {
+        ps->text = read_all(fd, &size);
+        rc = ps->text ? split_patterns(ps, size) : errno;
+    }
+    close(fd);
+    if (rc == 0) {
+        rc = build_teddy(ps);
+        if (rc == 1) rc = build_automaton(ps);
+    }
+    if (rc != 0) {
+        pattern_set_free(ps);
+        errno = rc;
+        return NULL;
+    }
+    return ps;
+}
+
+void pattern_set_free(pattern_set_t* ps) {
+    if (!ps) return;
+    free(ps->text);
+    free(ps->patterns);
+    free(ps->lens);
+    free(ps->delta);
+    free(ps->matches);
+    free(ps->outputs);
+    free(ps->bucket_patterns);
+    free(ps);
+}
+
+size_t pattern_set_size(const pattern_set_t* ps) {
+    return ps->count;
+}
+
+const char* pattern_set_pattern(const pattern_set_t* ps, size_t i,
+                                size_t* len) {
+    *len = ps->lens[i];
+    return ps->patterns[i];
+}
+
+const char* pattern_set_matcher(const pattern_set_t* ps) {
+    return ps->matcher;
+}
+
+void pattern_set_scan(const pattern_set_t* ps, const char* text, size_t len,
+                      unsigned long long* counts) {
+    ps->scan(ps, text, len, counts);
+}
@@ -0,0 +1,39 @@
+#ifndef PATTERN_SET_H
+#define PATTERN_SET_H
+
+#include <stddef.h>
+
+/* A compiled list of fixed strings, counted in one pass over the text.
+   Every occurrence counts, overlapping ones included: "aa" occurs twice in
+   "aaa". */
+typedef struct pattern_set pattern_set_t;
+
+/* Sets of at most this many patterns are matched with the Teddy SIMD
+   prefilter when the CPU has SSSE3; larger ones with Aho-Corasick. */
+#define PATTERN_SET_TEDDY_MAX 64
+
+/* Load the patterns of a file, one per line; empty lines are skipped and
+   a line is taken as is, without its '\n'. Returns NULL with errno set if
+   the file cannot be read, holds no pattern (EINVAL) or memory runs out. */
+pattern_set_t* pattern_set_load(const char* path);
+
+void pattern_set_free(pattern_set_t* ps);
+
+/* Number of patterns, in file order. */
+size_t pattern_set_size(const pattern_set_t* ps);
+
+/* Pattern i and its length. */
+const char* pattern_set_pattern(const pattern_set_t* ps, size_t i,
+                                size_t* len);
+
+/* Name of the matcher in use: "teddy-avx2", "teddy-ssse3" or
+   "aho-corasick". */
+const char* pattern_set_matcher(const pattern_set_t* ps);
+
+/* Add the occurrences of every pattern in text to counts[0, size). A
+   pattern without '\n' never spans two lines, so whole-line ranges can be
+   scanned independently and their counts summed. */
+void pattern_set_scan(const pattern_set_t* ps, const char* text, size_t len,
+                      unsigned long long* counts);
+
+#endif /* PATTERN_SET_H */
@@ -0,0 +1,160 @@
+/*
+Bounded single-producer/single-consumer ring used between the reader and
+each line-counting worker.
+
+Indices are free-running 32-bit counters; the slot is index & mask and the
+ring is full when tail - head == capacity. Unsigned wrap-around keeps that
+test valid after 2^32 operations.
+
+Sleeping uses a futex on the other side's index, with the classic Dekker
+handshake: the sleeper sets its *_waiting flag, issues a full fence and
+re-reads the index; the waker stores the index, issues a full fence and
+reads the flag. At least one of them sees the other's store, so a wake-up
+cannot be lost, and FUTEX_WAIT itself returns at once if the index moved
+in between.
+*/
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "spsc_ring.h"
+
+/* Polls of the other side's index before going to sleep. */
+#define SPSC_SPIN_LIMIT 256
+
+static inline void cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+static void futex_wait(_Atomic uint32_t* addr, uint32_t expected) {
+    // EAGAIN (value changed) and EINTR are both fine: callers re-check.
+    (void)syscall(SYS_futex, (uint32_t*)addr, FUTEX_WAIT_PRIVATE, expected,
+                  NULL, NULL, 0);
+}
+
+static void futex_wake(_Atomic uint32_t* addr) {
+    (void)syscall(SYS_futex, (uint32_t*)addr, FUTEX_WAKE_PRIVATE, 1,
+                  NULL, NULL, 0);
+}
+
+int spsc_ring_init(spsc_ring_t* ring, uint32_t capacity, size_t elemSize) {
+    uint32_t cap = 1;
+    while (cap < capacity && cap < (UINT32_C(1) << 31)) cap <<= 1;
+    ring->slots = malloc((size_t)cap * elemSize);
+    if (!ring->slots) return -1;
+    ring->mask = cap - 1;
+    ring->elem_size = elemSize;
+    ring->head_cache = 0;
+    ring->tail_cache = 0;
+    atomic_init(&ring->push_parks, 0);
+    atomic_init(&ring->pushes, 0);
+    atomic_init(&ring->depth_sum, 0);
+    atomic_init(&ring->depth_max, 0);
+    atomic_init(&ring->push_wait_ns, 0);
+    atomic_init(&ring->pop_parks, 0);
+    atomic_init(&ring->pop_wait_ns, 0);
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    atomic_init(&ring->producer_waiting, 0);
+    atomic_init(&ring->consumer_waiting, 0);
+    return 0;
+}
+
+void spsc_ring_destroy(spsc_ring_t* ring) {
+    free(ring->slots);
+    ring->slots = NULL;
+}
+
+int spsc_ring_try_push(spsc_ring_t* ring, const void* elem) {
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    if (tail - ring->head_cache > ring->mask) {
+        // Looks full from the cached view; refresh it from the consumer.
+        ring->head_cache = atomic_load_explicit(&ring->head,
+                                                memory_order_acquire);
+        if (tail - ring->head_cache > ring->mask) return 0;
+    }
+    memcpy(ring->slots + (size_t)(tail & ring->mask) * ring->elem_size,
+           elem, ring->elem_size);
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+    // Depth as the producer sees it: the cached head may be a little old,
+    // so this can overstate it, but costs no shared cache line.
+    LC_STAT_ADD(ring->pushes, 1);
+    LC_STAT_ADD(ring->depth_sum, tail + 1 - ring->head_cache);
+    LC_STAT_MAX(ring->depth_max, tail + 1 - ring->head_cache);
+
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&ring->consumer_waiting, memory_order_relaxed)) {
+        futex_wake(&ring->tail);
+    }
+    return 1;
+}
+
+int spsc_ring_try_pop(spsc_ring_t* ring, void* elem) {
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    if (head == ring->tail_cache) {
+        ring->tail_cache = atomic_load_explicit(&ring->tail,
+                                                memory_order_acquire);
+        if (head == ring->tail_cache) return 0;
+    }
+    memcpy(elem, ring->slots + (size_t)(head & ring->mask) * ring->elem_size,
+           ring->elem_size);
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&ring->producer_waiting, memory_order_relaxed)) {
+        futex_wake(&ring->head);
+    }
+    return 1;
+}
+
+void spsc_ring_push(spsc_ring_t* ring, const void* elem) {
+    unsigned spins = 0;
+    while (!spsc_ring_try_push(ring, elem)) {
+        if (++spins < SPSC_SPIN_LIMIT) {
+            cpu_relax();
+            continue;
+        }
+        // Still full: park until the consumer moves head.
+        uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        atomic_store_explicit(&ring->producer_waiting, 1, memory_order_relaxed);
+        atomic_thread_fence(memory_order_seq_cst);
+        uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+        if (tail - head > ring->mask) {
+            lc_stat_add(&ring->push_parks, 1);
+            LC_STAT_START(t0);
+            futex_wait(&ring->head, head);
+            LC_STAT_ELAPSED(ring->push_wait_ns, t0);
+        }
+        atomic_store_explicit(&ring->producer_waiting, 0, memory_order_relaxed);
+        spins = 0;
+    }
+}
+
+void spsc_ring_pop(spsc_ring_t* ring, void* elem) {
+    unsigned spins = 0;
+    while (!spsc_ring_try_pop(ring, elem)) {
+        if (++spins < SPSC_SPIN_LIMIT) {
+            cpu_relax();
+            continue;
+        }
+        // Still empty: park until the producer moves tail.
+        uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+        atomic_store_explicit(&ring->consumer_waiting, 1, memory_order_relaxed);
+        atomic_thread_fence(memory_order_seq_cst);
+        uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        if (tail == head) {
+            lc_stat_add(&ring->pop_parks, 1);
+            LC_STAT_START(t0);
+            futex_wait(&ring->tail, tail);
+            LC_STAT_ELAPSED(ring->pop_wait_ns, t0);
+        }
+        atomic_store_explicit(&ring->consumer_waiting, 0, memory_order_relaxed);
+        spins = 0;
+    }
+}
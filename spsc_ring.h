@@ -0,0 +1,64 @@
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "lc_stats.h"
+
+#define SPSC_CACHE_LINE 64
+
+/* Bounded single-producer/single-consumer ring of fixed-size elements.
+
+   Exactly one thread may push and exactly one thread may pop. Each side owns
+   its index on its own cache line and keeps a cached copy of the other
+   side's index, so it only touches the shared line when the cached view
+   says the ring is full (producer) or empty (consumer). A full ring makes
+   the producer spin briefly and then sleep on a futex until the consumer
+   frees a slot, which bounds memory use; an empty ring does the same for
+   the consumer. No mutex is taken on either path. */
+typedef struct {
+    /* Producer side. */
+    _Alignas(SPSC_CACHE_LINE) _Atomic uint32_t tail; /* next slot to fill */
+    uint32_t head_cache;
+    lc_stat_t push_parks;  /* times the producer slept on full */
+    lc_stat_t pushes;
+    lc_stat_t depth_sum;   /* depth after each push, for the average */
+    lc_stat_t depth_max;
+    lc_stat_t push_wait_ns; /* time the producer slept */
+
+    /* Consumer side. */
+    _Alignas(SPSC_CACHE_LINE) _Atomic uint32_t head; /* next slot to drain */
+    uint32_t tail_cache;
+    lc_stat_t pop_parks;   /* times the consumer slept on empty */
+    lc_stat_t pop_wait_ns; /* time the consumer slept */
+
+    /* Rarely written: set only by a side that is about to sleep. */
+    _Alignas(SPSC_CACHE_LINE) _Atomic uint32_t producer_waiting;
+    _Atomic uint32_t consumer_waiting;
+
+    /* Read-only after init. */
+    _Alignas(SPSC_CACHE_LINE) unsigned char* slots;
+    uint32_t mask;
+    size_t elem_size;
+} spsc_ring_t;
+
+/* Create a ring of at least `capacity` elements of `elemSize` bytes
+   (rounded up to a power of two). Returns 0, or -1 if out of memory. */
+int spsc_ring_init(spsc_ring_t* ring, uint32_t capacity, size_t elemSize);
+
+/* Release the slot array. The ring must no longer be in use. */
+void spsc_ring_destroy(spsc_ring_t* ring);
+
+/* Copy *elem into the ring; blocks while the ring is full. Producer only. */
+void spsc_ring_push(spsc_ring_t* ring, const void* elem);
+
+/* Copy the oldest element to *elem; blocks while the ring is empty.
+   Consumer only. */
+void spsc_ring_pop(spsc_ring_t* ring, void* elem);
+
+/* Non-blocking variants. Return 1 on success, 0 if full/empty. */
+int spsc_ring_try_push(spsc_ring_t* ring, const void* elem);
+int spsc_ring_try_pop(spsc_ring_t* ring, void* elem);
+
+#endif /* SPSC_RING_H */
@@ -0,0 +1,438 @@
+/*
+Double-buffered reader for pipes and other inputs that cannot be mapped.
+
+getline() on a FILE* reads 4 KB at a time and costs a call per line. Here a
+dedicated thread read()s straight into 1 MB buffers while the consumer is
+still splitting the previous buffer into lines, so reading and counting
+overlap and each syscall moves as much as the pipe holds.
+
+The buffers are line slabs (line_arena.h): workers get views into them and
+release the lines once counted; the last release puts the buffer back in
+the pool instead of freeing it. A small pool bounds memory and makes the
+reader wait when the workers fall behind.
+
+Each buffer has headroom in front of its read area. A line that straddles
+two reads is copied into the headroom of the next buffer, right before the
+new data, so chunks only ever hold whole lines and every read() targets a
+cache-line aligned address. Lines longer than the headroom get a one-off
+buffer sized to fit, which is freed rather than pooled. In bounded mode
+they are handed over in pieces instead, so that a 4 GB line costs no more
+memory than the pool; the consumer carries what it needs (a word running
+across the cut) from one piece to the next.
+
+A source function can stand in for read(): compressed input is decoded
+straight into the buffers (decompress.c).
+
+In follow mode the end of the file is not the end of the stream: the reader
+hands over what it has, keeps the partial last line in the headroom of the
+next buffer as usual and sleeps in poll() on an inotify watch until the
+file grows, shrinks or is replaced.
+*/
+
+#define _GNU_SOURCE /* memrchr */
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "stream_reader.h"
+
+/* Room for a line split across two reads; longer ones take the slow path. */
+#define STREAM_HEADROOM (64 * 1024)
+
+/* Take the pool lock, counting how often someone else holds it. */
+static void lock_pool(stream_reader_t* r) {
+#if LC_STATS
+    if (pthread_mutex_trylock(&r->pool_lock) == 0) return;
+    pthread_mutex_lock(&r->pool_lock);
+    lc_stat_add(&r->pool_contended, 1);
+#else
+    pthread_mutex_lock(&r->pool_lock);
+#endif
+}
+
+/* line_slab_recycle_fn: a pooled buffer was fully released. */
+static void pool_put(line_slab_t* slab, void* ctx) {
+    stream_reader_t* r = ctx;
+    lock_pool(r);
+    r->pool[r->pool_count++] = slab;
+    pthread_cond_signal(&r->pool_cond);
+    pthread_mutex_unlock(&r->pool_lock);
+}
+
+static line_slab_t* pool_get(stream_reader_t* r) {
+    lock_pool(r);
+    if (r->pool_count == 0) {
+        lc_stat_add(&r->pool_waits, 1);
+        LC_STAT_START(t0);
+        while (r->pool_count == 0) {
+            pthread_cond_wait(&r->pool_cond, &r->pool_lock);
+        }
+        LC_STAT_ELAPSED(r->pool_wait_ns, t0);
+    }
+    line_slab_t* slab = r->pool[--r->pool_count];
+    pthread_mutex_unlock(&r->pool_lock);
+    line_slab_reset(slab);
+    return slab;
+}
+
+/* A buffer with at least `carry` bytes of headroom; *room is set to where
+   its read area starts. Returns NULL if out of memory. */
+static line_slab_t* buffer_get(stream_reader_t* r, size_t carry, size_t* room) {
+    if (carry <= STREAM_HEADROOM) {
+        *room = STREAM_HEADROOM;
+        return pool_get(r);
+    }
+    // Grow with the line so that a huge one is not copied over and over.
+    size_t head = (carry + 63) & ~(size_t)63;
+    size_t body = carry > r->buffer_size ? carry : r->buffer_size;
+    line_slab_t* slab = line_slab_new(head + body);
+    if (!slab) return NULL;
+    ++r->oversize;
+    *room = head;
+    return slab;
+}
+
+/* Pass the whole lines of a buffer to the consumer; a buffer without any
+   goes straight back. */
+static void hand_over(stream_reader_t* r, line_slab_t* slab, const char* data,
+                      size_t len, int open) {
+    if (len == 0) {
+        line_slab_retire(slab); /* nothing handed out: recycles or frees */
+        return;
+    }
+    stream_chunk_t chunk = { slab, data, len, open };
+    spsc_ring_push(&r->chunks, &chunk);
+    ++r->chunks_out;
+}
+
+/* What follow_wait() found. */
+typedef enum {
+    FOLLOW_DATA,     /* the open file has grown */
+    FOLLOW_RESTART,  /* truncated or rotated: reading from offset 0 */
+    FOLLOW_STOP
+} follow_event_t;
+
+/* Bounded mode: where to cut a line of len bytes that does not fit. Before
+   the last byte that may start a multi-byte UTF-8 sequence if one is among
+   the last four, so that no sequence (valid or not) is split; a byte that
+   precedes four continuation bytes cannot belong with them. */
+static size_t piece_end(const char* s, size_t len) {
+    for (size_t k = 1; k <= 4 && k < len; ++k) {
+        if ((unsigned char)s[len - k] >= 0xc0) return len - k;
+    }
+    return len;
+}
+
+/* While nothing happens, check the path this often anyway: inotify misses
+   changes on network file systems, and a rotated path may take a while to
+   be created again. */
+#define FOLLOW_POLL_MS 1000
+
+#define FOLLOW_EVENTS (IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF)
+
+/* The path names a different file than the one open; 0 if it names the
+   same one or nothing (yet). */
+static int path_rotated(stream_reader_t* r) {
+    struct stat now, open_st;
+    if (stat(r->path, &now) != 0 || fstat(r->fd, &open_st) != 0) return 0;
+    return now.st_dev != open_st.st_dev || now.st_ino != open_st.st_ino;
+}
+
+static int reopen(stream_reader_t* r) {
+    int fd = open(r->path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+    inotify_rm_watch(r->watch_fd, r->watch);
+    close(r->fd);
+    r->fd = fd;
+    r->watch = inotify_add_watch(r->watch_fd, r->path, FOLLOW_EVENTS);
+    r->offset = 0;
+    ++r->rotations;
+    return 0;
+}
+
+static int stop_requested(stream_reader_t* r) {
+    struct pollfd pfd = { r->stop_fd, POLLIN, 0 };
+    return poll(&pfd, 1, 0) > 0;
+}
+
+/* Sleep until the open file has bytes past r->offset, starts over, or the
+   reader is told to stop. */
+static follow_event_t follow_wait(stream_reader_t* r) {
+    while (1) {
+        if (atomic_load_explicit(&r->cancel, memory_order_relaxed)) {
+            return FOLLOW_STOP;
+        }
+        struct stat st;
+        if (fstat(r->fd, &st) == 0) {
+            if ((unsigned long long)st.st_size > r->offset) return FOLLOW_DATA;
+            if ((unsigned long long)st.st_size < r->offset) {
+                // Truncated in place (copytruncate rotation): start over.
+                if (lseek(r->fd, 0, SEEK_SET) == 0) {
+                    r->offset = 0;
+                    ++r->truncations;
+                    return FOLLOW_RESTART;
+                }
+            }
+        }
+        // The old file is drained: switch if the path has a new one.
+        if (path_rotated(r) && reopen(r) == 0) return FOLLOW_RESTART;
+
+        struct pollfd fds[2] = {
+            { r->stop_fd, POLLIN, 0 },
+            { r->watch_fd, POLLIN, 0 }
+        };
+        int n = poll(fds, 2, FOLLOW_POLL_MS);
+        if (n < 0 && errno != EINTR) return FOLLOW_STOP;
+        if (n > 0 && (fds[0].revents & (POLLIN | POLLHUP | POLLERR))) {
+            return FOLLOW_STOP;
+        }
+        if (n > 0 && (fds[1].revents & POLLIN)) {
+            // The events only say "look again"; drain them.
+            _Alignas(struct inotify_event) char events[4096];
+            while (read(r->watch_fd, events, sizeof(events)) > 0) {
+            }
+        }
+    }
+}
+
+static void* reader_thread(void* arg) {
+    stream_reader_t* r = arg;
+    line_slab_t* slab = NULL;  /* buffer of the previous read */
+    const char* begin = NULL;  /* its bytes: `whole` lines, then `carry` */
+    size_t whole = 0;
+    size_t carry = 0;
+    int open = 0;              /* whole ends with a piece of a long line */
+    int eof = 0;
+    int caught_up = 0; /* follow mode: read everything there was */
+
+    while (!eof) {
+        size_t room;
+        line_slab_t* next = buffer_get(r, carry, &room);
+        if (!next) {
+            r->error = ENOMEM;
+            break;
+        }
+        char* area = next->data + room;
+        if (carry) memcpy(area - carry, begin + whole, carry);
+        if (slab) hand_over(r, slab, begin, whole, open);
+        slab = next;
+        begin = area - carry;
+        whole = 0;
+        open = 0;
+
+        if (atomic_load_explicit(&r->cancel, memory_order_relaxed)) {
+            break; /* nothing more is wanted, not even the carry */
+        }
+        if (!caught_up && r->follow && stop_requested(r)) {
+            // Stopped in the middle of a file that keeps growing.
+            whole = carry;
+            carry = 0;
+            break;
+        }
+        if (caught_up) {
+            caught_up = 0;
+            follow_event_t ev = follow_wait(r);
+            if (ev != FOLLOW_DATA) {
+                // The partial line will not be continued: it was the last
+                // line of the old content.
+                whole = carry;
+                carry = 0;
+                if (ev == FOLLOW_STOP) break;
+                continue;
+            }
+        }
+
+        // Fill the whole read area: a pipe returns at most its capacity
+        // (64 KB by default) per call.
+        size_t cap = slab->size - room;
+        size_t filled = 0;
+        while (filled < cap) {
+            ssize_t n = r->source
+                ? r->source(r->source_ctx, area + filled, cap - filled)
+                : read(r->fd, area + filled, cap - filled);
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0) r->error = errno;
+            if (n == 0 && r->follow) {
+                caught_up = 1;
+                break;
+            }
+            if (n <= 0) {
+                eof = 1;
+                break;
+            }
+            lc_stat_add(&r->reads, 1);
+            filled += (size_t)n;
+        }
+        lc_stat_add(&r->bytes, filled);
+        r->offset += filled;
+
+        size_t total = carry + filled;
+        const char* nl = eof ? NULL : memrchr(begin, '\n', total);
+        // At the end of the stream an unterminated last line is whole too.
+        whole = eof ? total : nl ? (size_t)(nl - begin) + 1 : 0;
+        carry = total - whole;
+        if (r->bounded && carry > STREAM_HEADROOM) {
+            // Too long for the headroom: pass on what there is of it.
+            whole += piece_end(begin + whole, carry);
+            carry = total - whole;
+            open = 1;
+            ++r->cuts;
+        }
+    }
+    if (slab) hand_over(r, slab, begin, whole, open);
+
+    stream_chunk_t end = { NULL, NULL, 0, 0 };
+    spsc_ring_push(&r->chunks, &end);
+    return NULL;
+}
+
+/* Set up everything but the thread. Returns 0, or -1 after cleaning up. */
+static int reader_init(stream_reader_t* r, int fd, size_t bufferSize,
+                       size_t buffers, int bounded) {
+    if (buffers < 2) buffers = 2; /* one being filled, one being counted */
+    r->fd = fd;
+    r->source = NULL;
+    r->source_ctx = NULL;
+    r->follow = 0;
+    r->path = NULL;
+    r->stop_fd = -1;
+    r->watch_fd = -1;
+    r->watch = -1;
+    r->offset = 0;
+    r->truncations = 0;
+    r->rotations = 0;
+    r->buffer_size = bufferSize;
+    r->bounded = bounded;
+    r->error = 0;
+    atomic_init(&r->cancel, 0);
+    r->pool_count = 0;
+    r->buffers = 0;
+    atomic_init(&r->reads, 0);
+    atomic_init(&r->bytes, 0);
+    r->chunks_out = 0;
+    r->oversize = 0;
+    r->cuts = 0;
+    atomic_init(&r->pool_waits, 0);
+    atomic_init(&r->pool_wait_ns, 0);
+    atomic_init(&r->pool_contended, 0);
+    r->pool = malloc(buffers * sizeof(line_slab_t*));
+    if (!r->pool) return -1;
+    if (spsc_ring_init(&r->chunks, (uint32_t)buffers,
+                       sizeof(stream_chunk_t)) != 0) {
+        free(r->pool);
+        return -1;
+    }
+    pthread_mutex_init(&r->pool_lock, NULL);
+    pthread_cond_init(&r->pool_cond, NULL);
+
+    for (; r->buffers < buffers; ++r->buffers) {
+        line_slab_t* slab = line_slab_new(STREAM_HEADROOM + bufferSize);
+        if (!slab) break;
+        slab->recycle = pool_put;
+        slab->recycle_ctx = r;
+        r->pool[r->pool_count++] = slab;
+    }
+    if (r->buffers < buffers) {
+        r->thread = pthread_self(); /* nothing to join */
+        stream_reader_finish(r);
+        return -1;
+    }
+    return 0;
+}
+
+int stream_reader_start(stream_reader_t* r, int fd, size_t bufferSize,
+                        size_t buffers, int bounded) {
+    if (reader_init(r, fd, bufferSize, buffers, bounded) != 0) return -1;
+    if (pthread_create(&r->thread, NULL, reader_thread, r) != 0) {
+        r->thread = pthread_self();
+        stream_reader_finish(r);
+        return -1;
+    }
+    return 0;
+}
+
+int stream_reader_start_source(stream_reader_t* r, stream_source_fn source,
+                               void* ctx, size_t bufferSize, size_t buffers,
+                               int bounded) {
+    if (reader_init(r, -1, bufferSize, buffers, bounded) != 0) return -1;
+    r->source = source;
+    r->source_ctx = ctx;
+    if (pthread_create(&r->thread, NULL, reader_thread, r) != 0) {
+        r->thread = pthread_self();
+        stream_reader_finish(r);
+        return -1;
+    }
+    return 0;
+}
+
+int stream_reader_follow(stream_reader_t* r, const char* path, int stopFd,
+                         size_t bufferSize, size_t buffers, int bounded) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+    int watch_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    int watch = watch_fd < 0 ? -1
+        : inotify_add_watch(watch_fd, path, FOLLOW_EVENTS);
+    if (watch < 0) {
+        int saved = errno;
+        if (watch_fd >= 0) close(watch_fd);
+        close(fd);
+        errno = saved;
+        return -1;
+    }
+    if (reader_init(r, fd, bufferSize, buffers, bounded) != 0) {
+        close(watch_fd);
+        close(fd);
+        errno = ENOMEM;
+        return -1;
+    }
+    r->follow = 1;
+    r->path = path;
+    r->stop_fd = stopFd;
+    r->watch_fd = watch_fd;
+    r->watch = watch;
+    if (pthread_create(&r->thread, NULL, reader_thread, r) != 0) {
+        r->thread = pthread_self();
+        stream_reader_finish(r);
+        errno = EAGAIN;
+        return -1;
+    }
+    return 0;
+}
+
+int stream_reader_next(stream_reader_t* r, stream_chunk_t* chunk) {
+    spsc_ring_pop(&r->chunks, chunk);
+    return chunk->slab != NULL;
+}
+
+void stream_reader_cancel(stream_reader_t* r) {
+    atomic_store_explicit(&r->cancel, 1, memory_order_relaxed);
+    stream_chunk_t chunk;
+    while (stream_reader_next(r, &chunk)) {
+        chunk.slab->handed_out = 0;
+        line_slab_retire(chunk.slab);
+    }
+}
+
+void stream_reader_finish(stream_reader_t* r) {
+    if (!pthread_equal(r->thread, pthread_self())) {
+        pthread_join(r->thread, NULL);
+    }
+    for (size_t i = 0; i < r->pool_count; ++i) free(r->pool[i]);
+    free(r->pool);
+    r->pool = NULL;
+    spsc_ring_destroy(&r->chunks);
+    pthread_mutex_destroy(&r->pool_lock);
+    pthread_cond_destroy(&r->pool_cond);
+    if (r->follow) {
+        // The reader may have reopened the file: it is ours to close.
+        close(r->watch_fd);
+        close(r->fd);
+        r->watch_fd = -1;
+        r->fd = -1;
+    }
+}
@@ -0,0 +1,113 @@
+#ifndef STREAM_READER_H
+#define STREAM_READER_H
+
+#include <sys/types.h>
+#include <pthread.h>
+#include <stddef.h>
+#include "lc_stats.h"
+#include "line_arena.h"
+#include "spsc_ring.h"
+
+/* Whole lines read from the stream. data points into slab, which the
+   consumer owns: it sets slab->handed_out to the number of lines it passed
+   on and calls line_slab_retire() once it is done with the chunk.
+   In bounded mode a line too long for a buffer is cut into pieces, each
+   ending one chunk (open set) or starting the next. */
+typedef struct {
+    line_slab_t* slab;
+    const char* data;
+    size_t len;  /* ends with '\n', except for an unterminated last line */
+    int open;    /* the last line goes on in the next chunk */
+} stream_chunk_t;
+
+/* Where the reader gets its bytes instead of read(fd) (see
+   stream_reader_start_source()): fills up to len bytes of buf and returns
+   their number, 0 at the end of the data, or -1 with errno set. */
+typedef ssize_t (*stream_source_fn)(void* ctx, char* buf, size_t len);
+
+/* A thread that fills a small pool of large buffers with read() while the
+   consumer splits the previous ones into lines. */
+typedef struct {
+    int fd;
+    stream_source_fn source; /* read(fd) if NULL */
+    void* source_ctx;
+    size_t buffer_size;  /* bytes read into each buffer */
+    int bounded;         /* cut long lines into pieces, never grow a buffer */
+    int error;           /* errno of a failed read, 0 if none */
+    _Atomic int cancel;  /* stream_reader_cancel(): stop reading */
+    spsc_ring_t chunks;  /* reader thread -> consumer */
+    pthread_t thread;
+
+    pthread_mutex_t pool_lock;
+    pthread_cond_t pool_cond;
+    line_slab_t** pool;  /* free buffers */
+    size_t pool_count;
+    size_t buffers;      /* buffers owned by the pool */
+
+    /* Follow mode (stream_reader_follow()). */
+    int follow;
+    const char* path;    /* reopened when the file is rotated */
+    int stop_fd;         /* readable once the reader should stop */
+    int watch_fd;        /* inotify instance, -1 if not following */
+    int watch;           /* its watch on the open file */
+    unsigned long long offset;      /* bytes read from the open file */
+    unsigned long long truncations; /* times the file shrank under us */
+    unsigned long long rotations;   /* times the path got a new file */
+
+    lc_stat_t reads;        /* read() calls */
+    lc_stat_t bytes;
+    unsigned long long chunks_out; /* chunks handed to the consumer */
+    unsigned long long oversize;   /* one-off buffers for very long lines */
+    unsigned long long cuts;       /* bounded mode: lines cut at a buffer */
+    lc_stat_t pool_waits;   /* times the reader found no free buffer */
+    lc_stat_t pool_wait_ns; /* time it waited for one */
+    lc_stat_t pool_contended; /* pool lock found taken (counted under it) */
+} stream_reader_t;
+
+#define STREAM_READER_DEFAULT_BUFFER (1024 * 1024)
+#define STREAM_READER_DEFAULT_BUFFERS 4
+
+/* Allocate `buffers` buffers (at least 2) of bufferSize bytes and start
+   reading fd on a new thread. The fd is not closed. Unless bounded is set,
+   a line longer than the headroom of a buffer (64 KB) gets a one-off
+   buffer that holds it whole; with bounded set it is handed over in pieces
+   and memory stays within the buffers, whatever the line length. Pieces
+   are cut before a byte that may start a UTF-8 sequence, so no code point
+   is split. Returns 0, or -1. */
+int stream_reader_start(stream_reader_t* r, int fd, size_t bufferSize,
+                        size_t buffers, int bounded);
+
+/* Like stream_reader_start(), but the bytes come from source(ctx, ...),
+   e.g. a decoder (decompress.h), rather than from an fd. */
+int stream_reader_start_source(stream_reader_t* r, stream_source_fn source,
+                               void* ctx, size_t bufferSize, size_t buffers,
+                               int bounded);
+
+/* Like stream_reader_start(), but on a file that keeps growing: at the end
+   of the file the reader hands over the whole lines it has, keeps the
+   partial last line and waits with inotify for the file to change. A file
+   that is truncated is read again from the start, and when the path is
+   rotated (moved or deleted, then created again) the rest of the old file
+   is read and the new one is opened. Either way the partial last line of
+   the old content is passed on as a line. The reader stops, passing on the
+   partial line too, once stopFd becomes readable. The file is opened and
+   closed by the reader. Returns 0, or -1 with errno set. */
+int stream_reader_follow(stream_reader_t* r, const char* path, int stopFd,
+                         size_t bufferSize, size_t buffers, int bounded);
+
+/* Wait for the next chunk. Returns 1 with *chunk filled in, or 0 at the end
+   of the stream; r->error is then set if a read failed. */
+int stream_reader_next(stream_reader_t* r, stream_chunk_t* chunk);
+
+/* Stop the reader early, e.g. when the consumer cannot go on: the reader
+   stops before its next read (or, following, its next wait), and the
+   chunks still coming are retired unread until the end of the stream.
+   Lines already handed out stay valid until released. */
+void stream_reader_cancel(stream_reader_t* r);
+
+/* Join the reader thread and free the buffers. Call after
+   stream_reader_next() returned 0 (or stream_reader_cancel()) and every
+   line has been released. */
+void stream_reader_finish(stream_reader_t* r);
+
+#endif /* STREAM_READER_H */
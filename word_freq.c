@@ -0,0 +1,529 @@
+/*
+Word frequencies for --top.
+
+`sort | uniq -c | sort -n` over a large log sorts every word in it. Here
+each -j worker counts the words of the ranges it scans into its own hash
+table, with no locking, and the tables are only combined at the end. The
+tables are split into 64 shards by the top bits of the word's hash, so shard
+s of every worker holds the same words: merging is done shard by shard on
+all threads at once, and each thread keeps a size-K min-heap of the best
+words it saw, which are combined into the result.
+
+Words are views into the mapped file; a table stores the hash, a pointer,
+a length and a count per word (32 bytes), so the vocabulary is what costs
+memory, not the text. When a worker's table would outgrow its share of
+--top-memory, its counts are folded into a count-min sketch of about the
+same size and it keeps going in constant memory: each word then bumps one
+counter per sketch row, and only the words whose estimate is high enough to
+matter are kept by name (heavy hitters). At the end the sketches are summed
+and the kept words ranked by their estimates, which can only be too high,
+by at most e / width of all words with high probability.
+*/
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include "count_index.h" /* count_index_hash() */
+#include "word_freq.h"
+
+#define SHARD_BITS 6  /* log2(WORD_FREQ_SHARDS) */
+#define SHARD_INITIAL 64
+#define SKETCH_DEPTH 4
+#define SKETCH_MIN_WIDTH 1024
+
+static const unsigned char is_space[256] = {
+    [' '] = 1, ['\t'] = 1, ['\n'] = 1, ['\v'] = 1, ['\f'] = 1, ['\r'] = 1
+};
+
+/* ---- Hash table shards ---------------------------------------------------- */
+
+static word_entry_t* shard_lookup(word_shard_t* s, uint64_t hash,
+                                  const char* word, size_t len) {
+    size_t mask = s->capacity - 1;
+    for (size_t i = (size_t)hash & mask;; i = (i + 1) & mask) {
+        word_entry_t* e = &s->slots[i];
+        if (!e->word || (e->hash == hash && e->len == len
+                         && memcmp(e->word, word, len) == 0)) {
+            return e;
+        }
+    }
+}
+
+static int shard_resize(word_shard_t* s, size_t capacity) {
+    word_entry_t* slots = calloc(capacity, sizeof(word_entry_t));
+    if (!slots) return -1;
+    word_shard_t next = { slots, capacity, s->used };
+    for (size_t i = 0; i < s->capacity; ++i) {
+        const word_entry_t* e = &s->slots[i];
+        if (e->word) *shard_lookup(&next, e->hash, e->word, e->len) = *e;
+    }
+    free(s->slots);
+    *s = next;
+    return 0;
+}
+
+/* Add n to a word's count; *grown is increased by the bytes of slots
+   allocated for it. Returns 0, or -1 if out of memory. */
+static int shard_add(word_shard_t* s, uint64_t hash, const char* word,
+                     size_t len, unsigned long long n, size_t* grown) {
+    if ((s->used + 1) * 10 > s->capacity * 7) {
+        size_t old = s->capacity;
+        size_t capacity = old ? old * 2 : SHARD_INITIAL;
+        if (shard_resize(s, capacity) != 0) return -1;
+        *grown += (capacity - old) * sizeof(word_entry_t);
+    }
+    word_entry_t* e = shard_lookup(s, hash, word, len);
+    if (!e->word) {
+        e->hash = hash;
+        e->word = word;
+        e->len = len;
+        e->count = 0;
+        ++s->used;
+    }
+    e->count += n;
+    return 0;
+}
+
+static void shard_free(word_shard_t* s) {
+    free(s->slots);
+    s->slots = NULL;
+    s->capacity = 0;
+    s->used = 0;
+}
+
+/* ---- Top-K min-heap ------------------------------------------------------- */
+
+typedef struct {
+    word_count_t* items;
+    size_t count;
+    size_t k;
+} word_top_t;
+
+static int top_init(word_top_t* t, size_t k) {
+    t->items = malloc((k ? k : 1) * sizeof(word_count_t));
+    t->count = 0;
+    t->k = k;
+    return t->items ? 0 : -1;
+}
+
+/* a ranks below b: fewer occurrences, or as many and later in byte order. */
+static int ranks_below(const word_count_t* a, const word_count_t* b) {
+    if (a->count != b->count) return a->count < b->count;
+    size_t len = a->len < b->len ? a->len : b->len;
+    int c = memcmp(a->word, b->word, len);
+    return c != 0 ? c > 0 : a->len > b->len;
+}
+
+static void top_sift_down(word_top_t* t, size_t i) {
+    while (1) {
+        size_t low = i, l = 2 * i + 1, r = l + 1;
+        if (l < t->count && ranks_below(&t->items[l], &t->items[low])) low = l;
+        if (r < t->count && ranks_below(&t->items[r], &t->items[low])) low = r;
+        if (low == i) return;
+        word_count_t tmp = t->items[i];
+        t->items[i] = t->items[low];
+        t->items[low] = tmp;
+        i = low;
+    }
+}
+
+/* Keep the word if it is among the k best seen so far. The root is the
+   worst word kept, so most offers end in one comparison. */
+static void top_offer(word_top_t* t, const char* word, size_t len,
+                      unsigned long long count) {
+    word_count_t w = { word, len, count };
+    if (t->count < t->k) {
+        size_t i = t->count++;
+        while (i > 0 && ranks_below(&w, &t->items[(i - 1) / 2])) {
+            t->items[i] = t->items[(i - 1) / 2];
+            i = (i - 1) / 2;
+        }
+        t->items[i] = w;
+    }
+    else if (t->k > 0 && ranks_below(&t->items[0], &w)) {
+        t->items[0] = w;
+        top_sift_down(t, 0);
+    }
+}
+
+/* Heap sort in place: best word first. */
+static void top_sort(word_top_t* t) {
+    size_t n = t->count;
+    while (t->count > 1) {
+        word_count_t worst = t->items[0];
+        t->items[0] = t->items[--t->count];
+        top_sift_down(t, 0);
+        t->items[t->count] = worst;
+    }
+    t->count = n;
+}
+
+/* ---- Count-min sketch ----------------------------------------------------- */
+
+/* Row i uses h1 + i * h2 (Kirsch and Mitzenmacher): one hash serves all
+   rows. */
+static size_t sketch_cell(const count_min_t* cm, uint64_t hash, unsigned row) {
+    uint64_t h1 = (uint32_t)hash;
+    uint64_t h2 = (hash >> 32) | 1;
+    return row * cm->width + (size_t)((h1 + row * h2) & (cm->width - 1));
+}
+
+/* Add n and return the word's new estimate. */
+static unsigned long long sketch_add(count_min_t* cm, uint64_t hash,
+                                     unsigned long long n) {
+    unsigned long long est = ~0ULL;
+    for (unsigned row = 0; row < cm->depth; ++row) {
+        unsigned long long* c = &cm->cells[sketch_cell(cm, hash, row)];
+        *c += n;
+        if (*c < est) est = *c;
+    }
+    return est;
+}
+
+static unsigned long long sketch_estimate(const count_min_t* cm,
+                                          uint64_t hash) {
+    unsigned long long est = ~0ULL;
+    for (unsigned row = 0; row < cm->depth; ++row) {
+        unsigned long long c = cm->cells[sketch_cell(cm, hash, row)];
+        if (c < est) est = c;
+    }
+    return est;
+}
+
+/* The same width for the same budget, so that sketches can be summed. */
+static size_t sketch_width(size_t budget) {
+    size_t width = SKETCH_MIN_WIDTH;
+    while (width * 2 * SKETCH_DEPTH * sizeof(unsigned long long) <= budget) {
+        width *= 2;
+    }
+    return width;
+}
+
+/* ---- Heavy hitters -------------------------------------------------------- */
+
+static int by_count_desc(const void* a, const void* b) {
+    const word_entry_t* x = a;
+    const word_entry_t* y = b;
+    return (x->count < y->count) - (x->count > y->count);
+}
+
+/* The candidate table is full: keep the better half and raise the bar for
+   getting in to the worst estimate kept. Amortized over the half that can
+   be added before the next pruning. */
+static int hitters_prune(word_freq_t* wf) {
+    word_entry_t* kept = malloc(wf->hitters.used * sizeof(word_entry_t));
+    if (!kept) return -1;
+    size_t n = 0;
+    for (size_t i = 0; i < wf->hitters.capacity; ++i) {
+        if (wf->hitters.slots[i].word) kept[n++] = wf->hitters.slots[i];
+    }
+    qsort(kept, n, sizeof(word_entry_t), by_count_desc);
+    n /= 2;
+    memset(wf->hitters.slots, 0, wf->hitters.capacity * sizeof(word_entry_t));
+    wf->hitters.used = n;
+    for (size_t i = 0; i < n; ++i) {
+        *shard_lookup(&wf->hitters, kept[i].hash, kept[i].word,
+                      kept[i].len) = kept[i];
+    }
+    wf->floor = n ? kept[n - 1].count : 0;
+    free(kept);
+    return 0;
+}
+
+static int sketch_word(word_freq_t* wf, uint64_t hash, const char* word,
+                       size_t len, unsigned long long n) {
+    unsigned long long est = sketch_add(&wf->sketch, hash, n);
+    // Candidates are never below the floor, so this word is not one.
+    if (est < wf->floor) return 0;
+    word_entry_t* e = shard_lookup(&wf->hitters, hash, word, len);
+    if (!e->word && wf->hitters.used == wf->hitters_max) {
+        if (hitters_prune(wf) != 0) return -1;
+        if (est < wf->floor) return 0;
+        e = shard_lookup(&wf->hitters, hash, word, len);
+    }
+    if (!e->word) {
+        e->hash = hash;
+        e->word = word;
+        e->len = len;
+        ++wf->hitters.used;
+    }
+    e->count = est;
+    return 0;
+}
+
+/* Fold the exact counts into a sketch and keep the best words as the
+   first candidates. */
+static int to_sketch(word_freq_t* wf) {
+    count_min_t* cm = &wf->sketch;
+    cm->depth = SKETCH_DEPTH;
+    cm->width = sketch_width(wf->budget);
+    cm->cells = calloc(cm->depth * cm->width, sizeof(unsigned long long));
+    size_t capacity = SHARD_INITIAL;
+    while (capacity < 2 * wf->hitters_max) capacity *= 2;
+    wf->hitters.slots = calloc(capacity, sizeof(word_entry_t));
+    wf->hitters.capacity = capacity;
+    wf->hitters.used = 0;
+    word_top_t best;
+    if (!cm->cells || !wf->hitters.slots
+        || top_init(&best, wf->hitters_max) != 0) {
+        return -1;
+    }
+    for (size_t s = 0; s < WORD_FREQ_SHARDS; ++s) {
+        const word_shard_t* sh = &wf->shards[s];
+        for (size_t i = 0; i < sh->capacity; ++i) {
+            const word_entry_t* e = &sh->slots[i];
+            if (!e->word) continue;
+            sketch_add(cm, e->hash, e->count);
+            top_offer(&best, e->word, e->len, e->count);
+        }
+    }
+    for (size_t i = 0; i < best.count; ++i) {
+        const word_count_t* w = &best.items[i];
+        uint64_t hash = count_index_hash(w->word, w->len);
+        word_entry_t* e = shard_lookup(&wf->hitters, hash, w->word, w->len);
+        e->hash = hash;
+        e->word = w->word;
+        e->len = w->len;
+        e->count = sketch_estimate(cm, hash);
+        ++wf->hitters.used;
+    }
+    free(best.items);
+    for (size_t s = 0; s < WORD_FREQ_SHARDS; ++s) shard_free(&wf->shards[s]);
+    wf->bytes = 0;
+    return 0;
+}
+
+/* ---- Counting ------------------------------------------------------------- */
+
+void word_freq_init(word_freq_t* wf, size_t budget, size_t k) {
+    memset(wf, 0, sizeof(*wf));
+    wf->budget = budget;
+    wf->hitters_max = 4 * k > WORD_FREQ_MIN_HITTERS ? 4 * k
+                                                    : WORD_FREQ_MIN_HITTERS;
+}
+
+void word_freq_free(word_freq_t* wf) {
+    for (size_t s = 0; s < WORD_FREQ_SHARDS; ++s) shard_free(&wf->shards[s]);
+    shard_free(&wf->hitters);
+    free(wf->sketch.cells);
+    wf->sketch.cells = NULL;
+}
+
+static int add_word(word_freq_t* wf, const char* word, size_t len) {
+    uint64_t hash = count_index_hash(word, len);
+    ++wf->tokens;
+    if (wf->sketch.cells) return sketch_word(wf, hash, word, len, 1);
+    size_t grown = 0;
+    int counted = shard_add(&wf->shards[hash >> (64 - SHARD_BITS)], hash,
+                            word, len, 1, &grown) == 0;
+    wf->bytes += grown;
+    if (counted && wf->bytes <= wf->budget) return 0;
+    if (to_sketch(wf) != 0) return -1;
+    return counted ? 0 : sketch_word(wf, hash, word, len, 1);
+}
+
+int word_freq_add_text(word_freq_t* wf, const char* text, size_t len) {
+    const char* p = text;
+    const char* end = text + len;
+    while (p < end) {
+        while (p < end && is_space[(unsigned char)*p]) ++p;
+        const char* word = p;
+        while (p < end && !is_space[(unsigned char)*p]) ++p;
+        if (p > word && add_word(wf, word, (size_t)(p - word)) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* ---- Results -------------------------------------------------------------- */
+
+/* State shared by the threads merging exact tables. */
+typedef struct {
+    word_freq_t* tables;
+    size_t count;
+    _Atomic size_t next;   /* next shard to merge */
+    _Atomic int failed;
+} merge_pool_t;
+
+typedef struct {
+    merge_pool_t* pool;
+    word_top_t top;
+    unsigned long long distinct;
+} merge_arg_t;
+
+/* Merge shard s of every table into the first table's, then rank it. */
+static void* merge_worker(void* arg) {
+    merge_arg_t* m = arg;
+    merge_pool_t* p = m->pool;
+    size_t s;
+    while ((s = atomic_fetch_add(&p->next, 1)) < WORD_FREQ_SHARDS) {
+        word_shard_t* into = &p->tables[0].shards[s];
+        for (size_t t = 1; t < p->count; ++t) {
+            word_shard_t* from = &p->tables[t].shards[s];
+            for (size_t i = 0; i < from->capacity; ++i) {
+                const word_entry_t* e = &from->slots[i];
+                size_t grown = 0;
+                if (e->word && shard_add(into, e->hash, e->word, e->len,
+                                         e->count, &grown) != 0) {
+                    atomic_store(&p->failed, 1);
+                    return NULL;
+                }
+            }
+            shard_free(from);
+        }
+        for (size_t i = 0; i < into->capacity; ++i) {
+            const word_entry_t* e = &into->slots[i];
+            if (e->word) top_offer(&m->top, e->word, e->len, e->count);
+        }
+        m->distinct += into->used;
+        shard_free(into);
+    }
+    return NULL;
+}
+
+static long top_exact(word_freq_t* tables, size_t count, size_t k,
+                      size_t threads, word_top_t* result,
+                      unsigned long long* distinct) {
+    merge_pool_t pool;
+    pool.tables = tables;
+    pool.count = count;
+    atomic_init(&pool.next, 0);
+    atomic_init(&pool.failed, 0);
+    if (threads > WORD_FREQ_SHARDS) threads = WORD_FREQ_SHARDS;
+    if (threads == 0) threads = 1;
+    merge_arg_t* args = calloc(threads, sizeof(merge_arg_t));
+    pthread_t* tids = calloc(threads, sizeof(pthread_t));
+    size_t ready = 0;
+    while (args && tids && ready < threads
+           && top_init(&args[ready].top, k) == 0) {
+        args[ready].pool = &pool;
+        ++ready;
+    }
+    long rc = -1;
+    if (ready == threads) {
+        size_t started = 0;
+        for (size_t i = 0; i + 1 < threads; ++i) {
+            // The last one runs here; the others take over what is left.
+            if (pthread_create(&tids[i], NULL, merge_worker, &args[i]) != 0) {
+                break;
+            }
+            ++started;
+        }
+        merge_worker(&args[threads - 1]);
+        for (size_t i = 0; i < started; ++i) pthread_join(tids[i], NULL);
+        if (!atomic_load(&pool.failed)) {
+            *distinct = 0;
+            for (size_t i = 0; i < threads; ++i) {
+                *distinct += args[i].distinct;
+                for (size_t j = 0; j < args[i].top.count; ++j) {
+                    const word_count_t* w = &args[i].top.items[j];
+                    top_offer(result, w->word, w->len, w->count);
+                }
+            }
+            rc = 0;
+        }
+    }
+    for (size_t i = 0; i < ready; ++i) free(args[i].top.items);
+    free(args);
+    free(tids);
+    return rc;
+}
+
+/* Sum the sketches (exact tables are added word by word) and rank the
+   candidates of every table by their estimate in the sum. */
+static long top_sketched(word_freq_t* tables, size_t count,
+                         word_top_t* result, unsigned long long* error) {
+    count_min_t* sum = NULL;
+    unsigned long long tokens = 0;
+    for (size_t t = 0; t < count; ++t) {
+        tokens += tables[t].tokens;
+        if (!tables[t].sketch.cells) continue;
+        if (!sum) {
+            sum = &tables[t].sketch;
+            continue;
+        }
+        for (size_t i = 0; i < sum->depth * sum->width; ++i) {
+            sum->cells[i] += tables[t].sketch.cells[i];
+        }
+    }
+    word_shard_t candidates = { NULL, 0, 0 };
+    for (size_t t = 0; t < count; ++t) {
+        word_freq_t* wf = &tables[t];
+        if (wf->sketch.cells) {
+            for (size_t i = 0; i < wf->hitters.capacity; ++i) {
+                const word_entry_t* e = &wf->hitters.slots[i];
+                size_t grown = 0;
+                if (e->word && shard_add(&candidates, e->hash, e->word,
+                                         e->len, 0, &grown) != 0) {
+                    shard_free(&candidates);
+                    return -1;
+                }
+            }
+            continue;
+        }
+        // An exact table: all of it goes into the sum, its best words
+        // into the candidates.
+        word_top_t best;
+        if (top_init(&best, wf->hitters_max) != 0) {
+            shard_free(&candidates);
+            return -1;
+        }
+        for (size_t s = 0; s < WORD_FREQ_SHARDS; ++s) {
+            const word_shard_t* sh = &wf->shards[s];
+            for (size_t i = 0; i < sh->capacity; ++i) {
+                const word_entry_t* e = &sh->slots[i];
+                if (!e->word) continue;
+                sketch_add(sum, e->hash, e->count);
+                top_offer(&best, e->word, e->len, e->count);
+            }
+        }
+        int failed = 0;
+        for (size_t i = 0; i < best.count && !failed; ++i) {
+            const word_count_t* w = &best.items[i];
+            size_t grown = 0;
+            failed = shard_add(&candidates, count_index_hash(w->word, w->len),
+                               w->word, w->len, 0, &grown) != 0;
+        }
+        free(best.items);
+        if (failed) {
+            shard_free(&candidates);
+            return -1;
+        }
+    }
+    for (size_t i = 0; i < candidates.capacity; ++i) {
+        const word_entry_t* e = &candidates.slots[i];
+        if (e->word) {
+            top_offer(result, e->word, e->len, sketch_estimate(sum, e->hash));
+        }
+    }
+    shard_free(&candidates);
+    // e / width of all words, rounded up.
+    *error = (unsigned long long)(2.718281828 * (double)tokens
+                                  / (double)sum->width) + 1;
+    return 0;
+}
+
+long word_freq_top(word_freq_t* tables, size_t count, size_t k,
+                   size_t threads, word_count_t** out, int* approximate,
+                   unsigned long long* error, unsigned long long* distinct) {
+    word_top_t result;
+    if (top_init(&result, k) != 0) return -1;
+    *approximate = 0;
+    *error = 0;
+    *distinct = 0;
+    for (size_t t = 0; t < count; ++t) {
+        if (tables[t].sketch.cells) *approximate = 1;
+    }
+    long rc = *approximate
+        ? top_sketched(tables, count, &result, error)
+        : top_exact(tables, count, k, threads, &result, distinct);
+    if (rc != 0) {
+        free(result.items);
+        return -1;
+    }
+    top_sort(&result);
+    *out = result.items;
+    return (long)result.count;
+}
@@ -0,0 +1,87 @@
+#ifndef WORD_FREQ_H
+#define WORD_FREQ_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* A word and how often it occurs. word points into the counted text, which
+   must stay mapped until the results are printed. */
+typedef struct {
+    const char* word;
+    size_t len;
+    unsigned long long count;
+} word_count_t;
+
+/* Open-addressing slot; word == NULL marks it empty. */
+typedef struct {
+    uint64_t hash;
+    const char* word;
+    size_t len;
+    unsigned long long count;
+} word_entry_t;
+
+/* One shard of a table: linear probing, kept at most 70% full. */
+typedef struct {
+    word_entry_t* slots;
+    size_t capacity;  /* power of two, 0 before the first word */
+    size_t used;
+} word_shard_t;
+
+/* Tables are split by the top bits of the hash, so that shard s of every
+   worker holds the same words and the shards can be merged in parallel. */
+#define WORD_FREQ_SHARDS 64
+
+/* Count-min sketch: depth rows of width counters; a word's estimate is
+   its smallest counter, never below the true count. */
+typedef struct {
+    unsigned long long* cells;
+    size_t width;  /* power of two */
+    unsigned depth;
+} count_min_t;
+
+/* The words of one worker. Exact until its slots need more than `budget`
+   bytes; then every count is folded into a count-min sketch of about that
+   size and only the likely heavy hitters are kept by name, with their
+   estimates. */
+typedef struct {
+    word_shard_t shards[WORD_FREQ_SHARDS];
+    size_t bytes;            /* slot memory of the shards */
+    size_t budget;
+    count_min_t sketch;      /* cells == NULL while exact */
+    word_shard_t hitters;    /* sketch mode: candidates by estimate */
+    size_t hitters_max;
+    unsigned long long floor; /* sketch mode: estimate needed to get in */
+    unsigned long long tokens;
+} word_freq_t;
+
+/* Smallest number of candidates kept per worker in sketch mode; at least
+   four times K are kept. */
+#define WORD_FREQ_MIN_HITTERS 1024
+
+/* Default memory cap for all tables together (--top-memory). */
+#define WORD_FREQ_DEFAULT_MEMORY (1024 * 1024 * 1024)
+
+/* budget: bytes the table may use before it falls back to a sketch; every
+   worker of a run must get the same one so that sketches can be merged.
+   k: how many words the caller will ask for. */
+void word_freq_init(word_freq_t* wf, size_t budget, size_t k);
+
+void word_freq_free(word_freq_t* wf);
+
+/* Count the words of text (split on ASCII whitespace, as in the "C"
+   locale). Returns 0, or -1 if out of memory. */
+int word_freq_add_text(word_freq_t* wf, const char* text, size_t len);
+
+/* The most frequent words over all tables, most frequent first, ties in
+   byte order. Exact tables are merged shard by shard on `threads` threads;
+   if any table fell back to a sketch, the result is estimated from the sum
+   of all sketches and *approximate is set, with *error the most any count
+   may be too high by (with probability 1 - e^-depth).
+   *distinct is the number of different words (exact mode only).
+   The tables are consumed. Returns the number of words in *out (malloc'd),
+   or -1 if out of memory. */
+long word_freq_top(word_freq_t* tables, size_t count, size_t k,
+                   size_t threads, word_count_t** out, int* approximate,
+                   unsigned long long* error, unsigned long long* distinct);
+
+#endif /* WORD_FREQ_H */
@@ -0,0 +1,80 @@
+/*
+Chase-Lev work-stealing deque, in the C11 formulation of Le, Pop, Cohen and
+Zappa Nardelli, "Correct and Efficient Work-Stealing for Weak Memory
+Models" (PPoPP 2013), with a fixed-size array: the -j scheduler creates
+work by halving ranges, so a deque never holds more than a few dozen.
+
+bottom and top are signed so that take() may briefly move bottom below top
+on an empty deque.
+*/
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "ws_deque.h"
+
+int ws_deque_init(ws_deque_t* q, size_t capacity) {
+    size_t cap = 1;
+    while (cap < capacity) cap <<= 1;
+    q->slots = calloc(cap, sizeof(ws_slot_t));
+    if (!q->slots) return -1;
+    q->mask = (int64_t)cap - 1;
+    atomic_init(&q->bottom, 0);
+    atomic_init(&q->top, 0);
+    return 0;
+}
+
+void ws_deque_destroy(ws_deque_t* q) {
+    free(q->slots);
+    q->slots = NULL;
+}
+
+int ws_deque_push(ws_deque_t* q, const ws_range_t* range) {
+    int64_t b = atomic_load_explicit(&q->bottom, memory_order_relaxed);
+    int64_t t = atomic_load_explicit(&q->top, memory_order_acquire);
+    if (b - t > q->mask) return 0;
+    ws_slot_t* slot = &q->slots[b & q->mask];
+    atomic_store_explicit(&slot->begin, range->begin, memory_order_relaxed);
+    atomic_store_explicit(&slot->end, range->end, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&q->bottom, b + 1, memory_order_relaxed);
+    return 1;
+}
+
+static void slot_read(const ws_slot_t* slot, ws_range_t* range) {
+    range->begin = atomic_load_explicit(&slot->begin, memory_order_relaxed);
+    range->end = atomic_load_explicit(&slot->end, memory_order_relaxed);
+}
+
+int ws_deque_take(ws_deque_t* q, ws_range_t* range) {
+    int64_t b = atomic_load_explicit(&q->bottom, memory_order_relaxed) - 1;
+    atomic_store_explicit(&q->bottom, b, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    int64_t t = atomic_load_explicit(&q->top, memory_order_relaxed);
+    if (t > b) {
+        // Empty: undo the reservation.
+        atomic_store_explicit(&q->bottom, b + 1, memory_order_relaxed);
+        return 0;
+    }
+    slot_read(&q->slots[b & q->mask], range);
+    if (t < b) return 1;
+
+    // Last element: race the thieves for it by advancing top ourselves.
+    int won = atomic_compare_exchange_strong_explicit(
+        &q->top, &t, t + 1, memory_order_seq_cst, memory_order_relaxed);
+    atomic_store_explicit(&q->bottom, b + 1, memory_order_relaxed);
+    return won;
+}
+
+int ws_deque_steal(ws_deque_t* q, ws_range_t* range) {
+    int64_t t = atomic_load_explicit(&q->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    int64_t b = atomic_load_explicit(&q->bottom, memory_order_acquire);
+    if (t >= b) return 0;
+    slot_read(&q->slots[t & q->mask], range);
+    if (!atomic_compare_exchange_strong_explicit(
+            &q->top, &t, t + 1, memory_order_seq_cst, memory_order_relaxed)) {
+        return -1;
+    }
+    return 1;
+}
@@ -0,0 +1,52 @@
+#ifndef WS_DEQUE_H
+#define WS_DEQUE_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define WS_CACHE_LINE 64
+
+/* A byte range [begin, end) of the input. The fields are atomics only so
+   that a thief racing with the owner reads them without a data race; a
+   torn read is discarded when the thief's CAS on top fails. */
+typedef struct {
+    _Atomic size_t begin;
+    _Atomic size_t end;
+} ws_slot_t;
+
+typedef struct {
+    size_t begin;
+    size_t end;
+} ws_range_t;
+
+/* Bounded Chase-Lev work-stealing deque of byte ranges.
+
+   The owning worker pushes and takes at the bottom, like a stack, so it
+   keeps working on the data it touched last. Other workers steal from the
+   top, where the oldest and therefore largest pieces of work are. The owner
+   only contends with thieves when a single element is left. */
+typedef struct {
+    _Alignas(WS_CACHE_LINE) _Atomic int64_t bottom; /* owner side */
+    _Alignas(WS_CACHE_LINE) _Atomic int64_t top;    /* thieves' side */
+    _Alignas(WS_CACHE_LINE) ws_slot_t* slots;       /* read-only after init */
+    int64_t mask;
+} ws_deque_t;
+
+/* Create a deque of at least `capacity` ranges (rounded up to a power of
+   two). Returns 0, or -1 if out of memory. */
+int ws_deque_init(ws_deque_t* q, size_t capacity);
+
+void ws_deque_destroy(ws_deque_t* q);
+
+/* Owner only. Returns 1, or 0 if the deque is full. */
+int ws_deque_push(ws_deque_t* q, const ws_range_t* range);
+
+/* Owner only: the most recently pushed range. Returns 1, or 0 if empty. */
+int ws_deque_take(ws_deque_t* q, ws_range_t* range);
+
+/* Any thread: the oldest range. Returns 1, 0 if empty, or -1 if another
+   thread won the race for it (worth retrying). */
+int ws_deque_steal(ws_deque_t* q, ws_range_t* range);
+
+#endif /* WS_DEQUE_H */